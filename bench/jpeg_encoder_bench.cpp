@@ -0,0 +1,361 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file jpeg_encoder_bench.cpp
+*
+* Compares JPEG encoder backends on the same YUV 4:2:0 frames: libavcodec
+* MJPEG encoder configured as ffmpeg_cap does, and jpeg_encoder backends
+* (turbojpeg). Prints encoding rate and average size of encoded frame.
+* Before measuring, checks that JPEG range YUV420P picture copied by capture
+* pipeline keeps its range and is encoded the same as decoder output.
+*
+* Usage: jpeg_encoder_bench [width height [frames [qscale [file.yuv]]]]
+*   file.yuv - raw full range YUV 4:2:0 frames of given geometry, synthetic
+*   frames are generated if it's not given.
+*/
+
+#include "ugcs/vstreamer/ffmpeg_utils.h"
+#include "ugcs/vstreamer/ffmpeg_encoder_cache.h"
+#include "ugcs/vstreamer/jpeg_encoder.h"
+#include "ugcs/vstreamer/encoded_frame.h"
+#include "ugcs/vstreamer/utils.h"
+#include "ugcs/vstreamer/capture_pipeline.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef AV_PIX_FMT_YUV420P
+#define AV_PIX_FMT_YUV420P PIX_FMT_YUV420P
+#endif
+
+#ifndef AV_PIX_FMT_YUVJ420P
+#define AV_PIX_FMT_YUVJ420P PIX_FMT_YUVJ420P
+#endif
+
+#ifndef AV_CODEC_ID_MJPEG
+#define AV_CODEC_ID_MJPEG CODEC_ID_MJPEG
+#endif
+
+// distinct pictures encoded in turn
+#define BENCH_PICTURES 25
+
+using namespace ugcs::vstreamer;
+
+namespace {
+
+    struct bench_result {
+        int frames;
+        int64_t elapsed_us;
+        int64_t bytes;
+    };
+
+    /** @brief Encoder input format, the same as ffmpeg_cap uses on this libavcodec */
+    AVPixelFormat get_encoded_format() {
+#if ((LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0)) && (LIBAVCODEC_VERSION_INT < ((56<<16)+(1<<8)+0)))
+        return AV_PIX_FMT_YUV420P;
+#else
+        return AV_PIX_FMT_YUVJ420P;
+#endif
+    }
+
+    AVFrame* alloc_picture(int width, int height) {
+        AVFrame *picture = ffmpeg_utils::frame_alloc();
+        if (picture == NULL) {
+            return NULL;
+        }
+        int size = avpicture_get_size(get_encoded_format(), width, height);
+        uint8_t *buffer = (uint8_t *)av_malloc(size);
+        if (buffer == NULL) {
+            ffmpeg_utils::frame_free(&picture);
+            return NULL;
+        }
+        avpicture_fill((AVPicture *)picture, buffer, get_encoded_format(), width, height);
+        picture->width = width;
+        picture->height = height;
+        picture->format = get_encoded_format();
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+        // decoder output passed to encoders as is, see ffmpeg_converter
+        picture->color_range = AVCOL_RANGE_JPEG;
+#endif
+        return picture;
+    }
+
+    void free_picture(AVFrame *picture) {
+        av_free(picture->data[0]);
+        ffmpeg_utils::frame_free(&picture);
+    }
+
+    /** @brief Camera-like picture: gradients, moving edges and sensor noise */
+    void fill_synthetic(AVFrame *picture, int index) {
+        unsigned seed = 12345 + index;
+        for (int y = 0; y < picture->height; y++) {
+            uint8_t *row = picture->data[0] + y * picture->linesize[0];
+            for (int x = 0; x < picture->width; x++) {
+                seed = seed * 1103515245 + 12345;
+                int value = (x + y + index * 8) % 256;
+                if (((x + index * 4) / 64 + y / 64) % 2 == 0) {
+                    value = 255 - value;
+                }
+                value += (int)((seed >> 16) % 9) - 4;
+                row[x] = (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+            }
+        }
+        for (int plane = 1; plane < 3; plane++) {
+            for (int y = 0; y < (picture->height + 1) / 2; y++) {
+                uint8_t *row = picture->data[plane] + y * picture->linesize[plane];
+                for (int x = 0; x < (picture->width + 1) / 2; x++) {
+                    row[x] = (uint8_t)(128 + (plane == 1 ? x - y : y - x + index) % 64);
+                }
+            }
+        }
+    }
+
+    bool fill_from_file(AVFrame *picture, FILE *input) {
+        for (int plane = 0; plane < 3; plane++) {
+            int width = plane == 0 ? picture->width : (picture->width + 1) / 2;
+            int height = plane == 0 ? picture->height : (picture->height + 1) / 2;
+            for (int y = 0; y < height; y++) {
+                if (fread(picture->data[plane] + y * picture->linesize[plane], 1, width, input) != (size_t)width) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::shared_ptr<encoded_frame> encode_libavcodec(ffmpeg_encoder_cache &cache, AVCodec *codec,
+                                                     AVFrame *picture, int qscale) {
+        std::shared_ptr<encoded_frame> encoded;
+        encoder_key key;
+        key.codec_id = codec->id;
+        key.width = picture->width;
+        key.height = picture->height;
+        key.pix_fmt = picture->format;
+        key.qmin = qscale;
+        key.qmax = qscale;
+        AVCodecContext *context = cache.get(codec, key, [picture, qscale](AVCodecContext *ctx) {
+            ctx->pix_fmt = (AVPixelFormat)picture->format;
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+            ctx->color_range = AVCOL_RANGE_JPEG;
+            ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+#endif
+            ctx->width = picture->width;
+            ctx->height = picture->height;
+            ctx->time_base.num = 1;
+            ctx->time_base.den = 25;
+            ctx->qmin = qscale;
+            ctx->qmax = qscale;
+        });
+        if (context == NULL) {
+            return encoded;
+        }
+#if (LIBAVCODEC_VERSION_INT > ((53<<16)+(99<<8)+0))
+        AVPacket packet;
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        int got_output = 0;
+        if (avcodec_encode_video2(context, &packet, picture, &got_output) >= 0 && got_output) {
+            encoded = encoded_frame::create_from_packet(&packet, VSTR_CODEC_MJPEG);
+        }
+        av_free_packet(&packet);
+#else
+        int buffer_size = picture->width * picture->height * 4;
+        uint8_t *buffer = (uint8_t *)av_malloc(buffer_size);
+        int size = avcodec_encode_video(context, buffer, buffer_size, picture);
+        if (size > 0) {
+            encoded = encoded_frame::create(size, VSTR_CODEC_MJPEG);
+            if (encoded) {
+                memcpy(encoded->get_writable_data(), buffer, size);
+            }
+        }
+        av_free(buffer);
+#endif
+        return encoded;
+    }
+
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+    /** @brief Copy picture as decoder stage does, compare range and JPEG of copy with the original */
+    bool check_copied_picture(AVFrame *picture, int qscale) {
+        pipeline_picture copy;
+        if (!copy.copy_from(picture)) {
+            fprintf(stderr, "pipeline copy: copying failed\n");
+            return false;
+        }
+        if (copy.frame->color_range != AVCOL_RANGE_JPEG) {
+            fprintf(stderr, "pipeline copy: JPEG colour range is lost (%d)\n", (int)copy.frame->color_range);
+            return false;
+        }
+        std::unique_ptr<jpeg_encoder> encoder = jpeg_encoder::create(JPEG_ENCODER_TURBOJPEG);
+        if (encoder) {
+            std::shared_ptr<encoded_frame> direct = encoder->encode(picture, qscale);
+            std::shared_ptr<encoded_frame> copied = encoder->encode(copy.frame, qscale);
+            if (!direct || !copied || direct->get_size() != copied->get_size() ||
+                memcmp(direct->get_data(), copied->get_data(), direct->get_size()) != 0) {
+                fprintf(stderr, "pipeline copy: %s encodes copied picture differently\n", JPEG_ENCODER_TURBOJPEG);
+                return false;
+            }
+        }
+        printf("pipeline copy: ok\n");
+        return true;
+    }
+#endif
+
+    /** @brief JPEG range YUV420P picture (decoder output passed through on libavcodec 55.0-56.1)
+    *   copied to pipeline picture as decoder stage does must keep its range and give the same JPEG.
+    */
+    bool check_pipeline_copy(AVFrame *source, int qscale) {
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+        AVFrame *picture = alloc_picture(source->width, source->height);
+        if (picture == NULL) {
+            return false;
+        }
+        // YUV420P and YUVJ420P have the same layout, only range tells them apart
+        av_picture_copy((AVPicture *)picture, (const AVPicture *)source, AV_PIX_FMT_YUV420P,
+                        source->width, source->height);
+        picture->format = AV_PIX_FMT_YUV420P;
+        picture->color_range = AVCOL_RANGE_JPEG;
+        bool ok = check_copied_picture(picture, qscale);
+        free_picture(picture);
+        return ok;
+#else
+        return true;
+#endif
+    }
+
+    template <class Encode>
+    bool run(const char *name, const std::vector<AVFrame *> &pictures, int frames, Encode encode, bench_result &result) {
+        // the first frame opens encoder, it's not measured
+        if (!encode(pictures[0])) {
+            fprintf(stderr, "%s: encoding failed\n", name);
+            return false;
+        }
+        result.frames = frames;
+        result.bytes = 0;
+        int64_t start_us = utils::getMicroseconds();
+        for (int i = 0; i < frames; i++) {
+            std::shared_ptr<encoded_frame> encoded = encode(pictures[i % pictures.size()]);
+            if (!encoded) {
+                fprintf(stderr, "%s: encoding of frame %d failed\n", name, i);
+                return false;
+            }
+            result.bytes += encoded->get_size();
+        }
+        result.elapsed_us = utils::getMicroseconds() - start_us;
+        if (result.elapsed_us <= 0) {
+            result.elapsed_us = 1;
+        }
+        return true;
+    }
+
+    void print(const char *name, const bench_result &result, const bench_result *baseline) {
+        double fps = result.frames * 1000000.0 / result.elapsed_us;
+        double bytes = (double)result.bytes / result.frames;
+        printf("%-10s %8.1f fps %8.2f ms/frame %10.0f bytes/frame", name, fps,
+               result.elapsed_us / 1000.0 / result.frames, bytes);
+        if (baseline) {
+            double baseline_fps = baseline->frames * 1000000.0 / baseline->elapsed_us;
+            double baseline_bytes = (double)baseline->bytes / baseline->frames;
+            printf("   x%.2f speed, %+.1f%% size", fps / baseline_fps, (bytes / baseline_bytes - 1.0) * 100.0);
+        }
+        printf("\n");
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    int width = argc > 2 ? atoi(argv[1]) : 1280;
+    int height = argc > 2 ? atoi(argv[2]) : 720;
+    int frames = argc > 3 ? atoi(argv[3]) : 500;
+    int qscale = argc > 4 ? atoi(argv[4]) : 4;
+    const char *filename = argc > 5 ? argv[5] : NULL;
+    if (width <= 0 || height <= 0 || frames <= 0 || qscale <= 0) {
+        fprintf(stderr, "Usage: %s [width height [frames [qscale [file.yuv]]]]\n", argv[0]);
+        return 1;
+    }
+
+    avcodec_register_all();
+    AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (codec == NULL) {
+        fprintf(stderr, "MJPEG encoder is not found\n");
+        return 1;
+    }
+
+    FILE *input = NULL;
+    if (filename) {
+        input = fopen(filename, "rb");
+        if (input == NULL) {
+            fprintf(stderr, "Cannot open %s\n", filename);
+            return 1;
+        }
+    }
+    std::vector<AVFrame *> pictures;
+    for (int i = 0; i < BENCH_PICTURES; i++) {
+        AVFrame *picture = alloc_picture(width, height);
+        if (picture == NULL) {
+            fprintf(stderr, "Cannot allocate %dx%d picture\n", width, height);
+            return 1;
+        }
+        if (input) {
+            if (!fill_from_file(picture, input)) {
+                free_picture(picture);
+                break;
+            }
+        } else {
+            fill_synthetic(picture, i);
+        }
+        pictures.push_back(picture);
+    }
+    if (input) {
+        fclose(input);
+    }
+    if (pictures.empty()) {
+        fprintf(stderr, "No %dx%d frames in %s\n", width, height, filename);
+        return 1;
+    }
+
+    printf("%dx%d, %d frames (%d distinct), qscale %d\n", width, height, frames, (int)pictures.size(), qscale);
+
+    int status = 0;
+    if (!check_pipeline_copy(pictures[0], qscale)) {
+        status = 1;
+    }
+
+    ffmpeg_encoder_cache cache;
+    bench_result baseline;
+    bool has_baseline = run(JPEG_ENCODER_FFMPEG, pictures, frames, [&](AVFrame *picture) {
+        return encode_libavcodec(cache, codec, picture, qscale);
+    }, baseline);
+    if (has_baseline) {
+        print(JPEG_ENCODER_FFMPEG, baseline, NULL);
+    } else {
+        status = 1;
+    }
+
+    const char *backends[] = { JPEG_ENCODER_TURBOJPEG };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        std::unique_ptr<jpeg_encoder> encoder = jpeg_encoder::create(backends[i]);
+        if (!encoder) {
+            printf("%-10s not available\n", backends[i]);
+            continue;
+        }
+        bench_result result;
+        if (run(backends[i], pictures, frames, [&](AVFrame *picture) {
+            return encoder->encode(picture, qscale);
+        }, result)) {
+            print(backends[i], result, has_baseline ? &baseline : NULL);
+        } else {
+            status = 1;
+        }
+    }
+
+    for (auto iter = pictures.begin(); iter != pictures.end(); ++iter) {
+        free_picture(*iter);
+    }
+    return status;
+}
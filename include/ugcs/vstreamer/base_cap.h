@@ -12,7 +12,10 @@
 #define VSTREAMER_BASE_CAP_H_
 
 #include "ugcs/vstreamer/common.h"
+#include "ugcs/vstreamer/ffmpeg_utils.h"
+#include "ugcs/vstreamer/encoded_frame.h"
 #include "video_device.h"
+#include <json/json.h>
 
 namespace ugcs{
     namespace vstreamer {
@@ -29,10 +32,10 @@ namespace ugcs{
             /** @brief Get current frame from given device.
             *
             * @param video_device_ - video device to grab from.
-            * @param encoded_buffer - returned frame data.
-            * @param encoded_buffer_size - returned frame size.
+            * @param frames - captured frames by codec (out).
+            * @param codec_type - requested codecs (VSTR_CODEC_MJPEG, VSTR_CODEC_FLV).
             */
-            virtual bool get_frame(video_device* video_device_, std::map<int, video_frame*> &frames, int codec_type) = 0;
+            virtual bool get_frame(video_device* video_device_, std::map<int, std::shared_ptr<encoded_frame>> &frames, int codec_type) = 0;
 
             /** @brief Close capturing process, free device.
             */
@@ -44,6 +47,69 @@ namespace ugcs{
             */
             virtual bool check(video_device* video_device_) = 0;
 
+            /** @brief Fill capturing statistics for monitoring.
+            *
+            * @param stats - json object to fill.
+            */
+            virtual void get_stats(Json::Value &stats) {}
+
+            /** @brief Capture can run as staged pipeline (see capture_pipeline).
+            * Otherwise device uses get_frame() for the whole capture cycle.
+            */
+            virtual bool is_staged() { return false; }
+
+            /** @brief Break blocking read of reader stage. Capture is reset by next open(). */
+            virtual void interrupt() {}
+
+            /** @brief Reader stage: read next packet of video stream.
+            *
+            * @param video_device_ - video device to read from.
+            * @param packet - read packet, freed by caller (out).
+            * @return false if capturing failed.
+            */
+            virtual bool read_packet(video_device* video_device_, AVPacket *packet) { return false; }
+
+            /** @brief Decoder stage: take packet as encoded frame if source
+            *        already gives frames of given codec.
+            *
+            * @return frame or NULL if packet has to be decoded.
+            */
+            virtual std::shared_ptr<encoded_frame> forward_packet(AVPacket *packet, int codec_type) { return std::shared_ptr<encoded_frame>(); }
+
+            /** @brief Decoder stage: decode packet into picture for encoders.
+            *
+            * @param picture - decoded picture valid until next call or NULL if decoder needs more data (out).
+            * @return false on decoding error.
+            */
+            virtual bool decode_packet(video_device* video_device_, AVPacket *packet, AVFrame **picture) { return false; }
+
+            /** @brief Encoder stage. Called from one thread per codec.
+            *
+            * @param picture - decoded picture.
+            * @param codec_type - output codec (VSTR_CODEC_MJPEG, VSTR_CODEC_FLV).
+            * @return encoded frame or NULL on error.
+            */
+            virtual std::shared_ptr<encoded_frame> encode_picture(video_device* video_device_, AVFrame *picture, int codec_type) { return std::shared_ptr<encoded_frame>(); }
+
+            /** @brief Encoder stage of one of parallel MJPEG encoders. Called from one thread per worker.
+            *
+            * Every worker encodes with its own encoder session, worker 0 uses the session of encode_picture().
+            * @param picture - decoded picture.
+            * @param worker - worker index.
+            * @return encoded frame or NULL on error.
+            */
+            virtual std::shared_ptr<encoded_frame> encode_mjpeg(video_device* video_device_, AVFrame *picture, int worker) {
+                return worker == 0 ? encode_picture(video_device_, picture, VSTR_CODEC_MJPEG) : std::shared_ptr<encoded_frame>();
+            }
+
+            /** @brief Encoder stage of smaller MJPEG rendition. Called from one thread per rendition.
+            *
+            * @param picture - decoded picture of full size.
+            * @param scale - divisor of picture width and height (2 for 1/2).
+            * @return encoded frame or NULL on error.
+            */
+            virtual std::shared_ptr<encoded_frame> encode_rendition(video_device* video_device_, AVFrame *picture, int scale) { return std::shared_ptr<encoded_frame>(); }
+
         };
     }
 }
@@ -12,8 +12,13 @@
 #define VSTREAMER_BASE_SAVE_H_
 
 #include "ugcs/vstreamer/common.h"
+#include "ugcs/vstreamer/encoded_frame.h"
 #include <mutex>
 #include <map>
+#include <vector>
+#include <condition_variable>
+
+#include <json/json.h>
 
 namespace ugcs{
     namespace vstreamer {
@@ -26,13 +31,16 @@ namespace ugcs{
 
         class base_save {
         public:
-            void add_frame(std::map<int, video_frame*> *frames, int frame_type);
-
-            bool is_process_running();
+            /** @brief Add frame for saving. Saver keeps reference to the frame, data is not copied.
+            */
+            virtual void add_frame(const encoded_frame::Ptr &frame);
 
-            /** @brief Add frame for saving.
+            /** @brief Frames captured before recording request, saved before live frames.
+            *   Must be set before the first frame is added.
             */
-            //void add_frame(std::map<int, video_frame*> *frames, int frame_type);
+            void set_preroll(const std::vector<encoded_frame::Ptr> &frames);
+
+            bool is_process_running();
 
             /** @brief Open capture for given device.
             */
@@ -62,7 +70,11 @@ namespace ugcs{
             /** @brief get recording duration */
             virtual int64_t get_recording_duration() = 0;
 
-            video_frame *frame;
+            /** @brief Fill queue and write counters of saving process */
+            virtual void get_stats(Json::Value &stats) {}
+
+            /** last added frame (accessed with std::atomic_load/atomic_store) */
+            encoded_frame::Ptr frame;
 
             std::string output_filename;
 
@@ -79,6 +91,16 @@ namespace ugcs{
 
         protected:
 
+            /** @brief Get last added frame */
+            encoded_frame::Ptr get_current_frame();
+
+            /** frames to save before the first live frame, the oldest first */
+            std::vector<encoded_frame::Ptr> preroll_frames;
+
+            /** notified when new frame is added */
+            std::condition_variable frame_condition_;
+            /** new frame waiting mutex */
+            std::mutex frame_mutex_;
             /** condition for stopping run-loop */
             std::condition_variable stopping_condition_;
             /** stopping run-loop mutex */
@@ -0,0 +1,146 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file bounded_queue.h
+*
+* Fixed capacity queue between pipeline stages
+*/
+
+#ifndef VSTREAMER_BOUNDED_QUEUE_H_
+#define VSTREAMER_BOUNDED_QUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <cinttypes>
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Thread-safe queue of fixed capacity.
+        *
+        * Producer never blocks: when queue is full the oldest element is
+        * dropped to make room for the new one, so consumers always get the
+        * freshest data. Depth and drop counters are kept for monitoring.
+        */
+        template<typename T>
+        class bounded_queue {
+        public:
+
+            /**
+            * @brief  Constructor
+            * @param capacity - maximum number of queued elements.
+            */
+            explicit bounded_queue(size_t capacity) {
+                this->capacity = capacity > 0 ? capacity : 1;
+                this->closed = false;
+                this->pushed_count = 0;
+                this->dropped_count = 0;
+            }
+
+            /** @brief Add element, drop the oldest one if queue is full.
+            * @return false if some element was dropped.
+            */
+            bool push(const T &item) {
+                bool no_drops = true;
+                {
+                    std::lock_guard<std::mutex> lock(queue_mutex);
+                    if (closed) {
+                        return true;
+                    }
+                    while (items.size() >= capacity) {
+                        items.pop_front();
+                        dropped_count++;
+                        no_drops = false;
+                    }
+                    items.push_back(item);
+                    pushed_count++;
+                }
+                queue_condition.notify_one();
+                return no_drops;
+            }
+
+            /** @brief Take the oldest element, wait for it if queue is empty.
+            * @param item - taken element (out).
+            * @param timeout_ms - maximum time to wait.
+            * @return false on timeout or if queue was closed.
+            */
+            bool pop(T &item, int timeout_ms) {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                if (!queue_condition.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                              [this] { return closed || !items.empty(); })) {
+                    return false;
+                }
+                if (items.empty()) {
+                    return false;
+                }
+                item = items.front();
+                items.pop_front();
+                return true;
+            }
+
+            /** @brief Remove all queued elements (they are not counted as dropped) */
+            void clear() {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                items.clear();
+            }
+
+            /** @brief Wake up all waiting consumers, reject new elements */
+            void close() {
+                {
+                    std::lock_guard<std::mutex> lock(queue_mutex);
+                    closed = true;
+                    items.clear();
+                }
+                queue_condition.notify_all();
+            }
+
+            /** @brief Accept elements again after close() */
+            void reopen() {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                closed = false;
+            }
+
+            size_t get_capacity() {
+                return capacity;
+            }
+
+            /** @brief Current number of queued elements */
+            size_t get_depth() {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                return items.size();
+            }
+
+            int64_t get_pushed_count() {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                return pushed_count;
+            }
+
+            /** @brief Number of elements dropped because of overflow */
+            int64_t get_dropped_count() {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                return dropped_count;
+            }
+
+        private:
+            size_t capacity;
+
+            std::deque<T> items;
+
+            std::mutex queue_mutex;
+
+            std::condition_variable queue_condition;
+
+            bool closed;
+
+            int64_t pushed_count;
+
+            int64_t dropped_count;
+        };
+    }
+}
+
+#endif
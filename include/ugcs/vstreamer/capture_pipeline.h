@@ -0,0 +1,207 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file capture_pipeline.h
+*
+* Staged capturing: reader, decoder and encoders running on their own threads
+*/
+
+#ifndef VSTREAMER_CAPTURE_PIPELINE_H_
+#define VSTREAMER_CAPTURE_PIPELINE_H_
+
+#include "ugcs/vstreamer/common.h"
+#include "ugcs/vstreamer/ffmpeg_utils.h"
+#include "ugcs/vstreamer/bounded_queue.h"
+
+#include <json/json.h>
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+// default capacity of queue between reader and decoder
+#define PIPELINE_DEFAULT_PACKET_QUEUE_SIZE 16
+// default capacity of queue between decoder and every encoder
+#define PIPELINE_DEFAULT_PICTURE_QUEUE_SIZE 2
+// time to wait for queue element before checking stop flag
+#define PIPELINE_QUEUE_WAIT_MS 100
+// maximum number of parallel MJPEG encoders of device
+#define PIPELINE_MAX_MJPEG_ENCODERS 16
+
+namespace ugcs{
+    namespace vstreamer {
+
+        class video_device;
+        class base_cap;
+        class encoded_frame;
+
+        /** @brief Decoded picture passed from decoder to encoders.
+        *
+        * Buffer is kept between frames and reallocated only when
+        * picture geometry or format changes.
+        */
+        class pipeline_picture {
+        public:
+            pipeline_picture();
+
+            ~pipeline_picture();
+
+            /** @brief Copy picture data from decoder frame */
+            bool copy_from(AVFrame *src);
+
+            /** picture data */
+            AVFrame *frame;
+
+            /** number of picture among decoded ones, encoded frames are published in this order */
+            int64_t seq;
+
+            /** time when decoder gave the picture, ms; timestamp of frames encoded from it */
+            int64_t capture_ms;
+
+        private:
+            uint8_t *buffer;
+            int width;
+            int height;
+            int format;
+        };
+
+
+        /** @brief Staged capturing pipeline of video device.
+        *
+        * Reader thread reads packets from capture, decoder thread decodes them
+        * (or forwards as is) and every output codec has its own encoder thread.
+        * MJPEG may be encoded by several threads at once: consecutive pictures go
+        * to free encoders and frames are published in picture order.
+        * Smaller MJPEG renditions of device are scaled from the same decoded
+        * picture on their own encoder threads. Only outputs which have
+        * subscribers are encoded, without subscribers nothing is decoded.
+        * Stages are joined by bounded queues which drop the oldest element when
+        * the next stage can't keep up. Encoded frames are published through
+        * video_device::publish_frame().
+        */
+        class capture_pipeline {
+        public:
+
+            /**
+            * @brief  Constructor
+            * @param video_device_ - device to publish frames to.
+            * @param cap - opened capture, must support staged capturing.
+            */
+            capture_pipeline(video_device *video_device_, base_cap *cap);
+
+            ~capture_pipeline();
+
+            /** @brief Start stage threads */
+            void start();
+
+            /** @brief Stop and join stage threads */
+            void stop();
+
+            /** @brief false if pipeline was stopped or capture failed */
+            bool is_running();
+
+            /** @brief Fill queue depths, drop counters and stage counters */
+            void get_stats(Json::Value &stats);
+
+        private:
+
+            typedef std::shared_ptr<AVPacket> packet_ptr;
+            typedef std::shared_ptr<pipeline_picture> picture_ptr;
+            typedef bounded_queue<packet_ptr> packet_queue;
+            typedef bounded_queue<picture_ptr> picture_queue;
+
+            /** @brief Reader stage loop */
+            void reader();
+
+            /** @brief Decoder stage loop */
+            void decoder();
+
+            /** @brief Encoder stage loop for one output codec */
+            void encoder(int codec_type);
+
+            /** @brief Encoder stage loop for one of parallel MJPEG encoders */
+            void mjpeg_encoder(int worker);
+
+            /** @brief Publish encoded MJPEG frame after frames of all earlier pictures
+            * @param encoded - frame or NULL if encoding failed.
+            */
+            void publish_mjpeg(int64_t seq, const std::shared_ptr<encoded_frame> &encoded);
+
+            /** @brief Encoder stage loop for one smaller MJPEG rendition */
+            void rendition_encoder(int scale);
+
+            /** @brief Rendition has viewers now */
+            bool is_rendition_requested(int scale);
+
+            /** @brief Codecs which are needed by device consumers now */
+            int get_requested_codecs();
+
+            /** @brief Copy decoded frame into free picture from pool */
+            picture_ptr copy_picture(AVFrame *src);
+
+            video_device *video_device_;
+
+            base_cap *cap;
+
+            std::shared_ptr<packet_queue> packets;
+
+            /** queues to encoders. key - codec type */
+            std::map<int, std::shared_ptr<picture_queue>> pictures;
+
+            /** queues to rendition encoders. key - scale divisor */
+            std::map<int, std::shared_ptr<picture_queue>> rendition_pictures;
+
+            /** number of parallel MJPEG encoders */
+            int mjpeg_workers;
+
+            /** MJPEG pictures are taken from queue one by one, so they are registered in order */
+            std::mutex dispatch_mutex;
+
+            /** MJPEG pictures being encoded and frames waiting for earlier ones. key - picture seq */
+            struct mjpeg_slot {
+                bool done;
+                std::shared_ptr<encoded_frame> frame;
+            };
+            std::map<int64_t, mjpeg_slot> mjpeg_in_flight;
+            std::mutex reorder_mutex;
+
+            /** frames which were encoded before frame of earlier picture and waited for it */
+            std::atomic<int64_t> frames_reordered;
+
+            /** pictures which can be reused by decoder */
+            std::vector<picture_ptr> picture_pool;
+
+            std::vector<std::thread> threads;
+
+            std::atomic<bool> stop_requested;
+
+            std::atomic<bool> running;
+
+            /** some packets were dropped, decoder waits for next key frame */
+            std::atomic<bool> wait_keyframe;
+
+            std::atomic<int64_t> packets_read;
+            std::atomic<int64_t> packets_skipped;
+            /** packets read while no output had subscribers, not decoded */
+            std::atomic<int64_t> packets_idle;
+            std::atomic<int64_t> frames_decoded;
+            std::atomic<int64_t> frames_forwarded;
+            std::atomic<int64_t> decode_errors;
+
+            /** encoded frames and errors. key - codec type */
+            std::map<int, std::atomic<int64_t>> frames_encoded;
+            std::map<int, std::atomic<int64_t>> encode_errors;
+
+            /** encoded frames and errors of renditions. key - scale divisor */
+            std::map<int, std::atomic<int64_t>> renditions_encoded;
+            std::map<int, std::atomic<int64_t>> rendition_errors;
+        };
+    }
+}
+
+#endif
@@ -24,7 +24,9 @@
 
 #define VS_WAIT(ms) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 
-#define VSTR_RECORDING_VIDEO_EXTENSION "mkv"
+// recordings are fragmented MP4, older versions wrote MPEG-PS to .mkv files
+#define VSTR_RECORDING_VIDEO_EXTENSION "mp4"
+#define VSTR_RECORDING_LEGACY_VIDEO_EXTENSION "mkv"
 #define VSTR_RECORDING_VIDEO_METADATA_EXTENSION "md"
 
 namespace ugcs{
@@ -52,19 +54,10 @@ namespace vstreamer {
         std::vector<std::string> excluded_devices;
         /** devices that will be checked for stream even thea are not autodetected */
         std::vector<std::string> allowed_devices;
+        /** every device has streaming server on its own port (besides /stream/ of control server) */
+        bool per_device_ports;
     } vstreamer_parameters;
 
-    typedef struct {
-        unsigned char *encoded_buffer;
-        int encoded_buffer_size;
-        int64_t ts;
-        /** condition for video stream */
-        std::condition_variable video_condition_;
-        /** video stream mutex */
-        std::mutex video_mutex_;
-
-    } video_frame;
-
     /** outer (broadcating) stream type */
     typedef enum {
         VSTR_OST_USTREAM, VSTR_OST_TWITCH, VSTR_OST_YOUTUBE
@@ -26,21 +26,61 @@
 #include "ugcs/vstreamer/sockets.h"
 #include "ugcs/vstreamer/utils.h"
 #include "ugcs/vstreamer/http_generic_server.h"
+#include "ugcs/vstreamer/http_request.h"
+#include "ugcs/vstreamer/stream_poller.h"
 #include "ugcs/vstreamer/mjpeg_server.h"
 #include "ugcs/vstreamer/video.h"
 #include <ugcs/vstreamer/video_device.h>
 #include <ugcs/vstreamer/ffmpeg_playback.h>
+#include <ugcs/vstreamer/worker_pool.h>
+#include <ugcs/vstreamer/recording_manifest.h>
+#include <ugcs/vstreamer/recording_metadata.h>
 #include <json/json.h>
 
+#include <memory>
+#include <atomic>
 
-#define CONTROL_HELP_MESSAGE "<html><b>Use the following links to control streaming server</b><br><ul><li><a href=\"/streams\">Get streams info</a></li><li><a href=\"/parameters\">Get or set parameters</a></li></ul></html>"
+
+#define CONTROL_HELP_MESSAGE "<html><b>Use the following links to control streaming server</b><br><ul><li><a href=\"/streams\">Get streams info</a></li><li><a href=\"/parameters\">Get or set parameters</a></li><li><a href=\"/stats\">Get server stats</a></li></ul></html>"
 #define CHUNK_SIZE 64000
+// maximum time to receive the whole request
+#define CONTROL_REQUEST_TIMEOUT_MS 10000
+// default time after which keep-alive connection without requests is closed
+#define CONTROL_DEFAULT_IDLE_TIMEOUT_SEC 15
+// longest sleep of idle connections watcher
+#define CONTROL_IDLE_POLL_MS 1000
+// default age of the last frame after which snapshot is captured again
+#define SNAPSHOT_DEFAULT_MAX_AGE_MS 1000
 #define SSDP_VIDEO_SERVICE_NT "ugcs:video"
 
 namespace ugcs{
 namespace vstreamer {
 
     class video_device;
+
+    /** @brief Control API connection, serves requests one by one until it is closed */
+    struct control_connection {
+        control_connection() : fd((sockets::Socket_handle)-1), keep_alive(false), released(false),
+                               served(0), idle_since(0) {}
+        ~control_connection() {
+            if (!released) {
+                sockets::Close_socket(fd);
+            }
+        }
+        control_connection(const control_connection&) = delete;
+        control_connection& operator=(const control_connection&) = delete;
+        sockets::Socket_handle fd;
+        /** received data, pipelined requests wait in it */
+        http_request request;
+        /** connection stays open after response to current request */
+        bool keep_alive;
+        /** socket is closed or handed over to stream or playback */
+        bool released;
+        /** number of answered requests */
+        int served;
+        /** time of the last response, milliseconds */
+        int64_t idle_since;
+    };
 	  
 class ControlServer : HttpGenericServer {
 		public:
@@ -73,6 +113,12 @@ class ControlServer : HttpGenericServer {
 			 */
 			void client(sockets::Socket_handle& fd);
 
+			/**
+			 * @brief  Park accepted connection until request arrives, then serve it
+			 *         on request pool instead of starting thread for every request
+			 */
+			void dispatchClient(sockets::Socket_handle fd);
+
 			/**
 			 * SSDP Detection handler
 			 */
@@ -104,6 +150,25 @@ class ControlServer : HttpGenericServer {
 			/** ssdp discoverer */
 			ugcs::vsm::Service_discovery_processor::Ptr discoverer;
 
+			/** workers serving control requests */
+			std::unique_ptr<worker_pool> request_pool;
+
+			/** watches keep-alive connections waiting for the next request */
+			std::unique_ptr<stream_poller> idle_poller;
+
+			/** connections to be added to idle_poller */
+			std::vector<std::shared_ptr<control_connection>> parked_connections;
+
+			std::mutex idle_mutex;
+
+			/** number of connections waiting for the next request */
+			std::atomic<int> idle_count;
+
+			int idle_timeout_ms;
+
+			/** snapshot is served from the last frame if it is not older than this */
+			int snapshot_max_age_ms;
+
 			/**
 			 * @brief  detect devices and runs mjpeg servers
 			 */
@@ -117,60 +182,143 @@ class ControlServer : HttpGenericServer {
             /**
             * @brief  send help message to client
             *
-            * @param fd - client socket
+            * @param connection - client connection
             */
-			void sendHelpMessage(ugcs::vstreamer::sockets::Socket_handle& fd);
+			void sendHelpMessage(control_connection &connection);
 
             /**
             * @brief  create and send JSON-message with info about current streams
             *
-            * @param fd - client socket
+            * @param connection - client connection
+            */
+            void sendStreamsInfo(control_connection &connection);
+
+            /**
+            * @brief  answer request which type is already known
+            *
+            * @param connection - client connection with parsed request
+            * @param type - request type
+            */
+            void answer(control_connection &connection, answer_t type, int64_t request_ts_milli, int64_t request_ts_micro);
+
+            /**
+            * @brief  read and answer requests while they are already received, then park connection
+            */
+            void serveConnection(std::shared_ptr<control_connection> connection);
+
+            /**
+            * @brief  prepare connection for the next request after response
+            * @return true if the next request is already received
+            */
+            bool finishRequest(const std::shared_ptr<control_connection> &connection);
+
+            /**
+            * @brief  serve connection on worker
+            */
+            void queueConnection(const std::shared_ptr<control_connection> &connection);
+
+            /**
+            * @brief  wait for the next request of connection without holding a worker
+            */
+            void parkConnection(const std::shared_ptr<control_connection> &connection);
+
+            /**
+            * @brief  thread function watching parked connections and closing idle ones
+            */
+            void watchIdleConnections();
+
+            /**
+            * @brief  close connection socket if it is still open
+            */
+            void releaseConnection(control_connection &connection);
+
+            /**
+            * @brief  send response, connection is closed unless it is keep-alive
+            */
+            void sendResponse(control_connection &connection, int response_code, const char *message, std::string content_type = "text/html");
+
+            /**
+            * @brief  send response with binary body and additional headers
+            */
+            void sendResponse(control_connection &connection, int response_code, const std::string &content_type,
+                              const std::string &headers, const void *body, size_t body_size);
+
+            /**
+            * @brief  create and send JSON-message with request pool counters
+            *
+            * @param connection - client connection
             */
-            void sendStreamsInfo(ugcs::vstreamer::sockets::Socket_handle& fd);
+            void sendServerStats(control_connection &connection);
 
             /**
             * @brief  create and send JSON-message with info about params value
             *
-            * @param fd - client socket
+            * @param connection - client connection
             */
-            void sendParamsInfo(ugcs::vstreamer::sockets::Socket_handle& fd);
+            void sendParamsInfo(control_connection &connection);
 
             /**
             * @brief  accept JSON-message with info about params value and update parameters with new values
             *
-            * @param fd - client socket
+            * @param connection - client connection
+            */
+            void writeParamsInfo(control_connection &connection, std::string body);
+
+			/**
+            * @brief  stream MJPEG of device through control server port
+            *
+            * @param connection - client connection
+            * @param device_id - device name or index
+            */
+			void startStream(control_connection &connection, std::string device_id);
+
+			/**
+            * @brief  device name by name or index given in request, empty if there is no such streaming device
+            */
+			std::string findDeviceName(std::string device_id);
+
+			/**
+            * @brief  the last MJPEG frame of device if it is not older than snapshot_max_age_ms
+            */
+			encoded_frame::Ptr getCachedSnapshot(const std::string &device_name);
+
+			/**
+            * @brief  send the last JPEG of device, capture it if device is idle
+            *
+            * @param connection - client connection
+            * @param device_id - device name or index
             */
-            void writeParamsInfo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string body);
+			void sendSnapshot(control_connection &connection, std::string device_id);
 
 			/**
             * @brief  start playback request handler
             */
-			void startPlayback(ugcs::vstreamer::sockets::Socket_handle& fd, std::string query, int64_t ts_micro);
+			void startPlayback(control_connection &connection, std::string query, int64_t ts_micro);
 
 			/**
 			* @brief  get video metadata (duration) request handler
 			*/
-			void getVideoMetadata(ugcs::vstreamer::sockets::Socket_handle& fd, std::string video_id);
+			void getVideoMetadata(control_connection &connection, std::string video_id);
 
 			/**
 			* @brief  delete video request handler
 			*/
-			void deleteVideo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string video_id);
+			void deleteVideo(control_connection &connection, std::string video_id);
 
 			/**
 			* @brief  download video request handler
 			*/
-			void downloadVideo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string video_id);
+			void downloadVideo(control_connection &connection, std::string video_id);
 
 			/**
 			* @brief  update stream info request handler
 			*/
-			void writeStreamInfo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string body, int64_t ts_milli);
+			void writeStreamInfo(control_connection &connection, std::string body, int64_t ts_milli);
 
 			/**
 			* @brief  update broadcasting status request handler
 			*/
-			void writeOuterStreamInfo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string body);
+			void writeOuterStreamInfo(control_connection &connection, std::string body);
 
 			/**
 			* @brief  obtaining next port number for http server\device
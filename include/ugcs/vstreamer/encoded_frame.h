@@ -0,0 +1,120 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file encoded_frame.h
+*
+* Refcounted encoded frame shared by all frame consumers
+*/
+
+#ifndef VSTREAMER_ENCODED_FRAME_H_
+#define VSTREAMER_ENCODED_FRAME_H_
+
+#include "ugcs/vstreamer/ffmpeg_utils.h"
+
+#include <memory>
+#include <cinttypes>
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Encoded picture (jpeg or flv packet) with its capture info.
+        *
+        * Frame is filled by capture and then published as encoded_frame::Ptr
+        * (pointer to const), so it never changes after publishing. Streaming
+        * clients, recorder and broadcasters hold references to the same data
+        * instead of copying it. Data is kept in AVBufferRef where libav supports
+        * refcounted buffers, so packets of encoder or demuxer are taken without copying.
+        */
+        class encoded_frame {
+        public:
+
+            /** published (immutable) frame */
+            typedef std::shared_ptr<const encoded_frame> Ptr;
+
+            /** @brief Allocate frame with writable buffer of given size */
+            static std::shared_ptr<encoded_frame> create(int size, int codec_type);
+
+            /** @brief Take packet data. Refcounted packet data is referenced, other data is copied */
+            static std::shared_ptr<encoded_frame> create_from_packet(AVPacket *packet, int codec_type);
+
+            ~encoded_frame();
+
+            /** @brief Buffer to fill before frame is published */
+            uint8_t* get_writable_data();
+
+            const uint8_t* get_data() const;
+
+            int get_size() const;
+
+            /** @brief Codec of frame (VSTR_CODEC_MJPEG, VSTR_CODEC_FLV) */
+            int get_codec() const;
+
+            /** @brief Sequence number of frame among published frames of this codec */
+            int64_t get_seq() const;
+
+            /** @brief Presentation timestamp of source picture (source time base) */
+            int64_t get_pts() const;
+
+            /** @brief Capture time in milliseconds */
+            int64_t get_ts() const;
+
+            int get_width() const;
+
+            int get_height() const;
+
+            bool is_key() const;
+
+            /** @brief Point packet to frame data (with new buffer reference if supported).
+            *
+            * Packet must be freed with av_free_packet.
+            */
+            void fill_packet(AVPacket *packet) const;
+
+            void set_seq(int64_t seq);
+
+            void set_pts(int64_t pts);
+
+            void set_ts(int64_t ts);
+
+            void set_geometry(int width, int height);
+
+            void set_key(bool key);
+
+        private:
+
+            encoded_frame(int codec_type);
+
+            encoded_frame(const encoded_frame&) = delete;
+
+            encoded_frame& operator=(const encoded_frame&) = delete;
+
+            /** refcounted data (libavcodec 55+) */
+            AVBufferRef *buffer;
+
+            /** data allocated by frame itself on older libav */
+            uint8_t *owned_data;
+
+            uint8_t *data;
+
+            int size;
+
+            int codec_type;
+
+            int64_t seq;
+
+            int64_t pts;
+
+            int64_t ts;
+
+            int width;
+
+            int height;
+
+            bool key;
+        };
+    }
+}
+
+#endif
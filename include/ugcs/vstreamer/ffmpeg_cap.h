@@ -16,9 +16,13 @@
 #include "ugcs/vstreamer/base_cap.h"
 #include <ugcs/vstreamer/video_device.h>
 #include "ugcs/vstreamer/ffmpeg_utils.h"
+#include "ugcs/vstreamer/ffmpeg_encoder_cache.h"
+#include "ugcs/vstreamer/ffmpeg_converter.h"
+#include "ugcs/vstreamer/jpeg_encoder.h"
 
 #include <vector>
 #include <string>
+#include <atomic>
 
 
 #ifndef AVPixelFormat
@@ -41,6 +45,14 @@
 #define DEFAULT_FRAMERATE_BIT_TOLERANCE 400000000
 // maximum number of errors while trying to get frame
 #define MAX_ERROR_NUMBER_GET_FRAME 10
+// pictures up to this size are decoded by one thread by default (no added latency)
+#define DECODER_SINGLE_THREAD_MAX_PIXELS (1280 * 720)
+// pictures up to this size use slice threading by default, larger ones use frame threading too
+#define DECODER_SLICE_THREADS_MAX_PIXELS (1920 * 1080)
+// maximum number of decoder threads
+#define DECODER_MAX_THREADS 16
+// period of decoder fps and latency measurement
+#define DECODER_STATS_PERIOD_MS 1000
 
 
 
@@ -76,16 +88,46 @@ namespace ugcs{
             /** @brief Get current frame from given device with ffmpeg.
             *
             * @param video_device_ - video device to grab from.
-            * @param encoded_buffer - returned frame data.
-            * @param encoded_buffer_size - returned frame size.
+            * @param frames - captured frames by codec (out).
+            * @param codec_type - requested codecs.
             */
-            bool get_frame(video_device* video_device_, std::map<int, video_frame*> &frames, int codec_type);
+            bool get_frame(video_device* video_device_, std::map<int, std::shared_ptr<encoded_frame>> &frames, int codec_type);
 
             /** @brief Close capturing process, free device. Free ffmpeg resources
             */
             void close();
 
-            int encode(AVCodecContext *encode_codec_context, AVFrame *encode_frame, AVPacket &encode_packet, std::map<int, video_frame*> &frames, int codec_type);
+            /** @brief Encode picture with opened encoder.
+            * @return encoded frame or NULL on error.
+            */
+            std::shared_ptr<encoded_frame> encode(AVCodecContext *encode_codec_context, AVFrame *encode_frame, int codec_type);
+
+            /** @brief ffmpeg capture can run as staged pipeline */
+            bool is_staged() { return true; }
+
+            /** @brief Break blocking av_read_frame */
+            void interrupt();
+
+            /** @brief Reader stage: read next packet of video stream */
+            bool read_packet(video_device* video_device_, AVPacket *packet);
+
+            /** @brief Decoder stage: copy jpeg picture from source into MJPEG frame without re-encoding */
+            std::shared_ptr<encoded_frame> forward_packet(AVPacket *packet, int codec_type);
+
+            /** @brief Decoder stage: decode packet and convert it into encoders format */
+            bool decode_packet(video_device* video_device_, AVPacket *packet, AVFrame **picture);
+
+            /** @brief Encoder stage: encode picture with MJPEG or FLV encoder */
+            std::shared_ptr<encoded_frame> encode_picture(video_device* video_device_, AVFrame *picture, int codec_type);
+
+            /** @brief Encoder stage: encode picture with MJPEG encoder session of given parallel worker */
+            std::shared_ptr<encoded_frame> encode_mjpeg(video_device* video_device_, AVFrame *picture, int worker);
+
+            /** @brief Encoder stage: scale picture down and encode it with MJPEG encoder of rendition */
+            std::shared_ptr<encoded_frame> encode_rendition(video_device* video_device_, AVFrame *picture, int scale);
+
+            /** @brief Fill capture statistics (encoder sessions opens/reuses) */
+            void get_stats(Json::Value &stats);
 
         private:
 
@@ -103,21 +145,35 @@ namespace ugcs{
             //* output codec (MJPEG) /
             AVCodec *mjpeg_codec;
             AVCodec *flv_codec;
-            //* output codec context (MJPEG) */
-            AVCodecContext *mjpeg_codec_context;
-            AVCodecContext *flv_codec_context;
+            //* opened output encoders (MJPEG, FLV), reused between frames */
+            ffmpeg_encoder_cache encoders;
+            //* JPEG encoder backend of MJPEG encoder thread, NULL for libavcodec encoder */
+            std::unique_ptr<jpeg_encoder> jpeg;
             //* decoded frame /
             AVFrame *frame;
-            //* encoded (mjpeg) frame /
-            AVFrame *frame_encoded;
+            //* conversion of decoded frame into encoders format, kept between frames */
+            ffmpeg_converter converter;
+
+            //* scaler and encoder of smaller MJPEG rendition, used by its encoder thread only */
+            struct rendition_encoder {
+                ffmpeg_converter scaler;
+                ffmpeg_encoder_cache encoders;
+                std::unique_ptr<jpeg_encoder> jpeg;
+            };
+            //* renditions being encoded. key - scale divisor */
+            std::map<int, std::shared_ptr<rendition_encoder>> renditions;
+            std::mutex renditions_mutex;
+
+            //* encoder sessions of parallel MJPEG workers, worker 0 uses encoders and jpeg above */
+            struct mjpeg_worker {
+                ffmpeg_encoder_cache encoders;
+                std::unique_ptr<jpeg_encoder> jpeg;
+            };
+            //* key - worker index */
+            std::map<int, std::shared_ptr<mjpeg_worker>> mjpeg_workers;
+            std::mutex workers_mutex;
             //* input packet /
             AVPacket packet;
-            //* output (mjpeg) packet /
-            AVPacket mjpeg_packet;
-            AVPacket flv_packet;
-
-            //* buffer for encoded frame /
-            uint8_t *buffer;
 
             //* output pixel format (AV_PIX_FMT_YUV420P or AV_PIX_FMT_YUVJ420P depends on libav versions) /
             AVPixelFormat  pEncodedFormat;
@@ -127,7 +183,62 @@ namespace ugcs{
             //* result of ffmpeg operations /
             int res;
 
-            void fill_codec_context(AVCodecContext *ctx);
+            void fill_codec_context(AVCodecContext *ctx, int width, int height);
+
+            /** @brief Set decoder thread count and type from device settings or by picture size */
+            void configure_decoder_threads(video_device* video_device_);
+
+            /** @brief Account decoded picture for decoder fps and latency
+            * @param submit_us - time when packet of the picture was passed to decoder.
+            */
+            void decoder_frame_done(int64_t submit_us);
+
+            /** @brief Encode picture with given encoder sessions, account MJPEG frame in quality control */
+            std::shared_ptr<encoded_frame> encode_output(video_device* video_device_, AVFrame *picture, int codec_type,
+                                                         ffmpeg_encoder_cache &cache, std::unique_ptr<jpeg_encoder> &backend);
+
+            /** @brief Encode MJPEG frame with JPEG encoder backend chosen for device
+            * @param backend - backend instance of calling encoder thread, created on first use.
+            * @param cache - libavcodec encoders of calling encoder thread, used by default.
+            */
+            std::shared_ptr<encoded_frame> encode_jpeg(video_device* video_device_, std::unique_ptr<jpeg_encoder> &backend,
+                                                       ffmpeg_encoder_cache &cache, AVFrame *picture, int qscale);
+
+            /** @brief Encoder parameters for given picture geometry */
+            encoder_key make_encoder_key(AVCodec *encoder, int width, int height, int qmin, int qmax);
+
+            /** @brief Get opened encoder of given codec type for given picture geometry
+            * @param qscale - quality of MJPEG encoder (1 - the best), FLV uses rate control.
+            */
+            AVCodecContext* open_encoder(ffmpeg_encoder_cache &cache, int codec_type, int width, int height, int qscale);
+
+            /** @brief ffmpeg interrupt callback, aborts blocking io when capture is interrupted */
+            static int interrupt_callback(void *opaque);
+
+            //* set by interrupt() to abort blocking reads */
+            std::atomic<bool> read_interrupted;
+
+
+            //* source delivers MJPEG, its packets are forwarded as is */
+            bool mjpeg_input;
+            //* number of forwarded jpeg pictures and pictures completed with huffman tables */
+            int64_t forwarded_count;
+            int64_t dht_inserted_count;
+
+            //* decoder threading set at open */
+            int decoder_threads;
+            int decoder_thread_type;
+
+            //* decoder measurements of current period */
+            std::mutex decoder_stats_mutex;
+            int64_t decoder_period_start;
+            int64_t decoder_period_frames;
+            int64_t decoder_period_latency_us;
+            int64_t decoder_period_latency_max_us;
+            //* decoder measurements of last period */
+            double decoder_fps;
+            double decoder_latency_ms;
+            double decoder_latency_max_ms;
 
             std::mutex open_cap_mutex;
 
@@ -136,9 +247,15 @@ namespace ugcs{
             int64_t prev_dts;
             int64_t start_time;
 
+            /** units of timestamps of played file: stream time base, or milliseconds for
+            *   MPEG-PS recordings of older versions which stored them without conversion
+            */
+            AVRational playback_time_base;
+
             bool format_context_initialized;
 
-            bool is_closing;
+            /** set by close(), checked by pipeline stages */
+            std::atomic<bool> is_closing;
 
         };
     }
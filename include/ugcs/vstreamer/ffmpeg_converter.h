@@ -0,0 +1,111 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file ffmpeg_converter.h
+*
+* Colour conversion stage between decoder and encoders
+*/
+
+#ifndef VSTREAMER_FFMPEG_CONVERTER_H_
+#define VSTREAMER_FFMPEG_CONVERTER_H_
+
+#include "ugcs/vstreamer/common.h"
+#include "ugcs/vstreamer/ffmpeg_utils.h"
+
+#ifndef AVPixelFormat
+#define AVPixelFormat PixelFormat
+#endif
+
+#ifndef AV_PIX_FMT_YUV420P
+#define AV_PIX_FMT_YUV420P PIX_FMT_YUV420P
+#endif
+
+#ifndef AV_PIX_FMT_YUVJ420P
+#define AV_PIX_FMT_YUVJ420P PIX_FMT_YUVJ420P
+#endif
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Converts decoded frames into encoder pixel format.
+        *
+        * Scaler context and destination buffer are kept between frames and
+        * rebuilt only when input geometry or format changes. Frames which are
+        * already in JPEG-range YUV 4:2:0 are passed through without conversion.
+        */
+        class ffmpeg_converter {
+        public:
+
+            /**
+            * @brief  Constructor
+            */
+            ffmpeg_converter();
+
+            ~ffmpeg_converter();
+
+            /** @brief Set pixel format expected by encoders */
+            void set_target_format(AVPixelFormat format);
+
+            /** @brief Convert decoded frame.
+            *
+            * @param src - decoded frame.
+            * @param width - frame width.
+            * @param height - frame height.
+            * @param src_format - pixel format of decoded frame.
+            * @param src_range - colour range of decoded frame.
+            * @return src itself if no conversion is needed, converted frame
+            *         (valid until next call) or NULL on error.
+            */
+            AVFrame* convert(AVFrame *src, int width, int height, AVPixelFormat src_format, AVColorRange src_range);
+
+            /** @brief Resize picture, result is in target format.
+            *
+            * @param src - picture with width, height and format set.
+            * @param dst_width - width of result.
+            * @param dst_height - height of result.
+            * @return scaled frame (valid until next call) or NULL on error.
+            */
+            AVFrame* scale(AVFrame *src, int dst_width, int dst_height);
+
+            /** @brief Free scaler and buffers */
+            void close();
+
+            /** @brief Number of frames converted with sws_scale */
+            int64_t get_scaled_count();
+
+            /** @brief Number of frames passed to encoders as is */
+            int64_t get_passthrough_count();
+
+        private:
+
+            /** @brief (Re)allocate scaler and destination frame for given input and output geometry */
+            bool prepare(int width, int height, AVPixelFormat src_format, int dst_width, int dst_height);
+
+            /** target pixel format */
+            AVPixelFormat target_format;
+
+            /** cached scaler context */
+            struct SwsContext *sws_context;
+
+            /** converted frame */
+            AVFrame *frame_converted;
+
+            /** buffer of converted frame */
+            uint8_t *buffer;
+
+            /** geometry and format the scaler was built for */
+            int width;
+            int height;
+            AVPixelFormat src_format;
+            int dst_width;
+            int dst_height;
+
+            int64_t scaled_count;
+            int64_t passthrough_count;
+        };
+    }
+}
+
+#endif
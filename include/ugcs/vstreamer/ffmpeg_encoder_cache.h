@@ -0,0 +1,97 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file ffmpeg_encoder_cache.h
+*
+* Cache of opened ffmpeg encoder sessions
+*/
+
+#ifndef VSTREAMER_FFMPEG_ENCODER_CACHE_H_
+#define VSTREAMER_FFMPEG_ENCODER_CACHE_H_
+
+#include "ugcs/vstreamer/common.h"
+#include "ugcs/vstreamer/ffmpeg_utils.h"
+
+#include <map>
+#include <mutex>
+#include <functional>
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** Parameters of an opened encoder. Session is reopened when any of them changes. */
+        typedef struct encoder_key {
+            /** encoder codec id (AV_CODEC_ID_MJPEG, AV_CODEC_ID_FLV1, ...) */
+            int codec_id;
+            /** encoded picture width */
+            int width;
+            /** encoded picture height */
+            int height;
+            /** input pixel format of encoder */
+            int pix_fmt;
+            /** quality range */
+            int qmin;
+            int qmax;
+
+            bool operator==(const encoder_key &other) const;
+            bool operator!=(const encoder_key &other) const;
+        } encoder_key;
+
+
+        /** @brief Keeps one opened encoder context per codec.
+        *
+        * Encoder is opened on first request and then reused for every frame
+        * until its key (geometry, pixel format or quality) changes.
+        */
+        class ffmpeg_encoder_cache {
+        public:
+
+            /** Function which fills codec context before opening */
+            typedef std::function<void(AVCodecContext*)> configure_function;
+
+            ffmpeg_encoder_cache();
+
+            ~ffmpeg_encoder_cache();
+
+            /** @brief Get opened encoder context for the given key.
+            *
+            * @param codec - encoder.
+            * @param key - encoder parameters.
+            * @param configure - called for new context before avcodec_open2.
+            * @return opened codec context or NULL on error.
+            */
+            AVCodecContext* get(AVCodec *codec, const encoder_key &key, configure_function configure);
+
+            /** @brief Close and free all sessions. */
+            void close_all();
+
+            /** @brief Number of avcodec_open2 calls made by the cache */
+            int64_t get_open_count();
+
+            /** @brief Number of frames which were encoded by already opened session */
+            int64_t get_reuse_count();
+
+        private:
+
+            typedef struct {
+                encoder_key key;
+                AVCodecContext *context;
+            } encoder_session;
+
+            void free_session(encoder_session &session);
+
+            /** opened sessions. key - codec id */
+            std::map<int, encoder_session> sessions;
+
+            std::mutex sessions_mutex;
+
+            int64_t open_count;
+
+            int64_t reuse_count;
+        };
+    }
+}
+
+#endif
@@ -73,10 +73,8 @@ namespace ugcs{
         private:
             /** stop requested flag. When true - server begins stopping sequence*/
             bool stop_requested;
-            /** with image data to stream */
-            unsigned char *encoded_buffer;
-            /** size of buffer with image data to stream */
-            int encoded_buffer_size;
+            /** position of video thread in device MJPEG frame ring */
+            frame_ring::cursor video_cursor;
             /** condition for video stream */
             std::condition_variable video_condition_;
             /** video stream mutex */
@@ -17,6 +17,9 @@
 #include <iostream>
 #include <fstream>
 #include "ugcs/vstreamer/ffmpeg_utils.h"
+#include "ugcs/vstreamer/recording_manifest.h"
+#include "ugcs/vstreamer/recording_writer.h"
+#include "ugcs/vstreamer/recording_metadata.h"
 //#define __STDC_CONSTANT_MACROS
 //
 //extern "C" {
@@ -44,6 +47,8 @@
 #endif
 
 #define DUMMY_FRAME_MAXIMUM_LAG_TIME 100
+// default period of fragment flushing
+#define RECORDING_DEFAULT_FLUSH_MS 1000
 
 namespace ugcs{
     namespace vstreamer {
@@ -67,8 +72,12 @@ namespace ugcs{
             */
             bool init(std::string folder, std::string session_name, int width, int height, int type, int64_t request_ts);
 
+            /** @brief Open metadata and start writing frames on recording writer thread */
             void run();
 
+            /** @brief Queue frame for recording writer, returns at once */
+            void add_frame(const encoded_frame::Ptr &frame);
+
             /** @brief Get current frame from given device with ffmpeg.
             *
             * @param encoded_buffer - saved frame data.
@@ -77,6 +86,11 @@ namespace ugcs{
             */
             bool save_frame();
 
+            /** @brief Write frame, called on recording writer thread */
+            bool save_frame(const encoded_frame::Ptr &current_frame);
+
+            struct block_output;
+
 
             bool set_filename(std::string folder, std::string filename, int type);
 
@@ -94,11 +108,45 @@ namespace ugcs{
 
             int64_t get_recording_duration();
 
+            /** @brief Queue depth, dropped frames and write latency of recording */
+            void get_stats(Json::Value &stats);
+
         private:
 
             /** @brief Create synthetic black frame of given height and width. */
             void create_synth_black_frame(AVFrame *frame, int height, int width);
 
+            /** @brief Write frame with timestamp relative to the first frame of recording.
+            *   Starts next segment before the frame when current one is full.
+            */
+            void write_frame(const encoded_frame::Ptr &frame);
+
+            /** @brief Write packet with given time from recording start, in stream time base */
+            void write_packet(AVPacket *packet, int64_t ms);
+
+            /** @brief Finish current fragment and write it to file */
+            void flush_fragment();
+
+            /** @brief Finish current segment and continue the muxer output in the next file,
+            *   frame at ts starts it
+            */
+            void rotate_segment(int64_t ts);
+
+            /** @brief Write trailer and free output of current file */
+            void close_output();
+
+            /** @brief Open file of output context, muxer writes it in blocks of recording writer */
+            bool open_output(const std::string &filename);
+
+            /** @brief Flush and close file of output context */
+            void close_file();
+
+            /** @brief Store time range and size of current segment in manifest */
+            void update_manifest(int64_t end_ms);
+
+            /** capture time of the last written frame */
+            int64_t last_saved_ts;
+
             //* output mjpeg format context */
             AVFormatContext* mjpeg_format_context;
 
@@ -116,12 +164,50 @@ namespace ugcs{
             //* output pixel format (AV_PIX_FMT_YUV420P or AV_PIX_FMT_YUVJ420P depends on libav versions) /
             AVPixelFormat  pEncodedFormat;
 
-            //* metadata file pointer /
-            std::fstream metadata_file;
+            //* duration, frame count and picture of recording, saved to metadata file /
+            recording_metadata metadata;
 
             int64_t first_frame_ts;
 
-            bool init_mjpeg(std::string session_name, int width, int height);
+            bool init_mjpeg(std::string session_name, std::string filename, int width, int height);
+
+            std::string folder;
+
+            std::string session_name;
+
+            int width;
+
+            int height;
+
+            /** segment limits, 0 - no limit. Both 0 - session is written to a single file */
+            int64_t segment_max_ms;
+            int64_t segment_max_bytes;
+
+            /** segments of session, used when recording is segmented */
+            recording_manifest manifest;
+
+            std::string manifest_filename;
+
+            /** frames written to current segment */
+            int segment_frames;
+
+            /** position of current segment in muxer output of the session */
+            int64_t segment_offset;
+
+            /** period of fragment flushing */
+            int64_t flush_ms;
+
+            /** capture time of the last frame of flushed fragment */
+            int64_t last_flush_ts;
+
+            /** the last written timestamp, stream time base */
+            int64_t last_pts;
+
+            /** queue of this recording in recording writer (accessed with std::atomic_load/atomic_store) */
+            std::shared_ptr<recording_writer::session> writer_session;
+
+            /** file of current output */
+            block_output *output;
 
             //* timestamp of real request to start recording /
             int64_t request_ts;
@@ -20,6 +20,7 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include <vector>
 
 namespace ugcs {
     namespace vstreamer {
@@ -39,6 +40,19 @@ namespace ugcs {
             * @brief createing AVPacket from data  various ffmpeg versions
             */
             int packet_from_data(AVPacket *pkt, uint8_t *data, int size);
+
+            /**
+            * @brief Find where default huffman tables should be inserted into jpeg picture.
+            *        Many usb cameras send MJPEG frames without DHT segment, such frames
+            *        cannot be shown by browsers as standalone jpeg.
+            * @return offset of SOS marker if picture has no DHT segment, -1 otherwise
+            */
+            int jpeg_dht_insert_position(const uint8_t *data, int size);
+
+            /**
+            * @brief Standard huffman tables (ITU T.81, K.3) as complete DHT segment
+            */
+            const std::vector<uint8_t>& jpeg_default_dht_segment();
         }
     }
 }
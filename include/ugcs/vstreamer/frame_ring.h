@@ -0,0 +1,141 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file frame_ring.h
+*
+* Ring of last published frames with per-consumer cursors
+*/
+
+#ifndef VSTREAMER_FRAME_RING_H_
+#define VSTREAMER_FRAME_RING_H_
+
+#include "ugcs/vstreamer/encoded_frame.h"
+
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+// default number of frames kept in ring of every codec
+#define FRAME_RING_DEFAULT_SIZE 8
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Ring of the last published frames of one codec.
+        *
+        * Frame with sequence number seq is kept in slot seq % capacity until it is
+        * overwritten by frame seq + capacity. Slots are read and written with
+        * std::atomic_load/atomic_store, so producer never waits for consumers
+        * and consumer always gets a whole frame. Every consumer keeps its own
+        * cursor and counts frames it has skipped.
+        */
+        class frame_ring {
+        public:
+
+            /** @brief Position of consumer in ring */
+            struct cursor {
+                cursor() : next_seq(0), skipped(0) {}
+                /** sequence number of the next frame to read */
+                int64_t next_seq;
+                /** frames which were published but not read by consumer */
+                int64_t skipped;
+            };
+
+            /**
+            * @brief  Constructor
+            * @param capacity - number of kept frames.
+            */
+            explicit frame_ring(int capacity);
+
+            /** @brief Store frame and wake up waiting consumers.
+            *
+            * Frames must be published from one thread at a time with sequence
+            * numbers given by get_published_count().
+            */
+            void publish(const encoded_frame::Ptr &frame);
+
+            /** @brief Cursor positioned at the next frame to be published */
+            cursor make_cursor();
+
+            /** @brief Read frame at cursor. If it is already overwritten, cursor
+            * jumps to the oldest kept frame.
+            * @return false if there is no frame after cursor yet.
+            */
+            bool read_next(cursor &position, encoded_frame::Ptr &frame);
+
+            /** @brief Read the latest frame, frames between cursor and it are skipped.
+            * @return false if there is no frame after cursor yet.
+            */
+            bool read_latest(cursor &position, encoded_frame::Ptr &frame);
+
+            /** @brief Latest published frame (empty if nothing published) */
+            encoded_frame::Ptr get_latest();
+
+            /** @brief Call listener after every published frame.
+            *
+            * Listener is called on producer thread, so it must be short and must not block.
+            */
+            void add_listener(const std::function<void()> &listener);
+
+            /** @brief Wait until a frame after cursor is published.
+            * @return false on timeout.
+            */
+            bool wait(const cursor &position, int timeout_ms);
+
+            int get_capacity();
+
+            /** @brief Number of published frames, also sequence number of the next one */
+            int64_t get_published_count();
+
+            /** @brief Register consumer which waits for new frames (viewer) */
+            void add_subscriber();
+
+            void remove_subscriber();
+
+            /** @brief Number of registered consumers, producer may skip encoding while there are none */
+            int get_subscriber_count();
+
+            /** @brief Count frames sent to subscribers and dropped because they couldn't keep up */
+            void count_delivery(int64_t delivered, int64_t dropped);
+
+            int64_t get_delivered_count();
+
+            int64_t get_dropped_count();
+
+        private:
+
+            frame_ring(const frame_ring&) = delete;
+
+            frame_ring& operator=(const frame_ring&) = delete;
+
+            std::vector<encoded_frame::Ptr> slots;
+
+            /** sequence number of the next frame to be published */
+            std::atomic<int64_t> head;
+
+            std::atomic<int> subscribers;
+
+            /** frames sent to and dropped for all subscribers */
+            std::atomic<int64_t> delivered;
+            std::atomic<int64_t> dropped;
+
+            /** used only to sleep while there are no new frames */
+            std::mutex wait_mutex;
+
+            std::condition_variable wait_condition;
+
+            typedef std::vector<std::function<void()>> listener_list;
+
+            /** replaced as a whole on change, so producer reads it without locking */
+            std::shared_ptr<const listener_list> listeners;
+
+            std::mutex listeners_mutex;
+        };
+    }
+}
+
+#endif
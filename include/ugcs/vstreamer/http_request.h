@@ -0,0 +1,162 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file http_request.h
+*
+* Incremental HTTP/1.1 request parser over per-connection buffer
+*/
+
+#ifndef VSTREAMER_HTTP_REQUEST_H_
+#define VSTREAMER_HTTP_REQUEST_H_
+
+#include "ugcs/vstreamer/sockets.h"
+
+#include <string>
+#include <vector>
+#include <cinttypes>
+
+// initial size of connection buffer, enough for usual request in one read
+#define HTTP_REQUEST_BUFFER_SIZE 4096
+// maximum size of request line and headers
+#define HTTP_MAX_HEADER_SIZE 16384
+// maximum size of request body
+#define HTTP_MAX_BODY_SIZE (1024 * 1024)
+// maximum number of request headers
+#define HTTP_MAX_HEADERS 64
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** State of request parsing */
+        typedef enum {
+            /** more data is needed */
+            VSTR_HTTP_INCOMPLETE,
+            /** request line, headers and body are parsed */
+            VSTR_HTTP_COMPLETE,
+            /** request is malformed */
+            VSTR_HTTP_BAD_REQUEST,
+            /** headers or body exceed limits */
+            VSTR_HTTP_TOO_LARGE,
+            /** connection closed, failed or timed out before request was complete */
+            VSTR_HTTP_CLOSED
+        } http_parse_result;
+
+
+        /** @brief HTTP request read from connection.
+        *
+        * Data is received into one buffer in large chunks and parsed in place:
+        * method, path, query, headers and body are kept as offsets into the
+        * buffer and copied only when asked for. Parsing is incremental, scan for
+        * the end of headers continues where previous call stopped. Bytes
+        * received after the parsed request stay in buffer for the next one.
+        */
+        class http_request {
+        public:
+
+            http_request();
+
+            /** @brief Receive data until request is complete.
+            * @param fd - connected socket.
+            * @param timeout_ms - maximum time to wait for the whole request.
+            */
+            http_parse_result read(sockets::Socket_handle fd, int timeout_ms);
+
+            /** @brief Parse data which is already in buffer */
+            http_parse_result parse();
+
+            /** @brief Forget parsed request, keep data received after it */
+            void consume();
+
+            /** @brief True if there is unparsed data in buffer */
+            bool has_pending_data() const;
+
+            bool method_is(const char *method) const;
+
+            std::string get_method() const;
+
+            /** @brief Request target without query */
+            std::string get_path() const;
+
+            /** @brief True if path equals given one */
+            bool path_is(const char *path) const;
+
+            /** @brief True if path starts with given prefix */
+            bool path_starts_with(const char *prefix) const;
+
+            /** @brief Part of request target after '?', empty if there is no query */
+            std::string get_query() const;
+
+            std::string get_version() const;
+
+            /** @brief Value of header (name is case insensitive), empty if not present */
+            std::string get_header(const char *name) const;
+
+            bool has_header(const char *name) const;
+
+            /** @brief True if client wants to keep connection open after response
+            *   (HTTP/1.1 without "Connection: close" or HTTP/1.0 with "Connection: keep-alive")
+            */
+            bool is_keep_alive() const;
+
+            /** @brief Body of request, get_body_length() bytes (none if length is 0) */
+            const char* get_body() const;
+
+            size_t get_body_length() const;
+
+            std::string get_body_string() const;
+
+        private:
+
+            /** part of buffer */
+            struct token {
+                token() : offset(0), length(0) {}
+                size_t offset;
+                size_t length;
+            };
+
+            struct header_field {
+                token name;
+                token value;
+            };
+
+            /** @brief Parse request line and headers, header_size is known */
+            http_parse_result parse_head();
+
+            /** @brief Header with given name, NULL if not present */
+            const header_field* find_header(const char *name) const;
+
+            std::string get_string(const token &part) const;
+
+            bool token_equals(const token &part, const char *value, bool ignore_case) const;
+
+            std::vector<char> buffer;
+
+            /** end of received data */
+            size_t data_size;
+
+            /** position from which the end of headers is looked for */
+            size_t scan_position;
+
+            /** size of request line and headers with final empty line, 0 if not received yet */
+            size_t header_size;
+
+            size_t content_length;
+
+            bool complete;
+
+            token method;
+
+            token path;
+
+            token query;
+
+            token version;
+
+            std::vector<header_field> headers;
+        };
+    }
+}
+
+#endif
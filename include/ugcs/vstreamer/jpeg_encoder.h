@@ -0,0 +1,60 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file jpeg_encoder.h
+*
+* Interface of JPEG encoder backends used for MJPEG frames
+*/
+
+#ifndef VSTREAMER_JPEG_ENCODER_H_
+#define VSTREAMER_JPEG_ENCODER_H_
+
+#include "ugcs/vstreamer/ffmpeg_utils.h"
+#include "ugcs/vstreamer/encoded_frame.h"
+
+#include <string>
+#include <memory>
+
+// JPEG encoder of libavcodec, always available
+#define JPEG_ENCODER_FFMPEG "ffmpeg"
+// libjpeg-turbo (SIMD) encoder, available when built with TURBOJPEG_ENCODER
+#define JPEG_ENCODER_TURBOJPEG "turbojpeg"
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief JPEG encoder which takes planar YUV 4:2:0 picture prepared by decoder stage.
+        *
+        * Instance is used by one encoder thread, so it may keep its buffers between frames.
+        * libavcodec encoder is not wrapped here, it stays in ffmpeg_cap with its encoder cache
+        * and is used when no other backend is chosen.
+        */
+        class jpeg_encoder {
+        public:
+
+            virtual ~jpeg_encoder() {}
+
+            /** @brief Encode picture.
+            * @param picture - YUV 4:2:0 picture.
+            * @param qscale - quantizer scale as for libavcodec MJPEG encoder, 1 is the best quality.
+            * @return MJPEG frame or NULL on error.
+            */
+            virtual std::shared_ptr<encoded_frame> encode(AVFrame *picture, int qscale) = 0;
+
+            /** @brief Backend name as in config */
+            virtual const char* get_name() = 0;
+
+            /** @brief True if backend with given name is built in */
+            static bool is_available(const std::string &name);
+
+            /** @brief Create encoder of given backend.
+            * @return NULL for JPEG_ENCODER_FFMPEG and unavailable backends.
+            */
+            static std::unique_ptr<jpeg_encoder> create(const std::string &name);
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file jpeg_quality_control.h
+*
+* Rate control of MJPEG encoding of one device
+*/
+
+#ifndef VSTREAMER_JPEG_QUALITY_CONTROL_H_
+#define VSTREAMER_JPEG_QUALITY_CONTROL_H_
+
+#include "ugcs/vstreamer/frame_ring.h"
+#include "ugcs/vstreamer/jpeg_encoder.h"
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cinttypes>
+
+#include <json/json.h>
+
+// best and worst JPEG quantizer scale
+#define JPEG_QSCALE_BEST 1
+#define JPEG_QSCALE_WORST 31
+// period of quality adjustment
+#define JPEG_QUALITY_ADJUST_MS 1000
+// share of frames dropped for viewers after which quality is lowered
+#define JPEG_QUALITY_MAX_DROP_PERCENT 10
+// share of time spent in encoder after which quality is lowered
+#define JPEG_QUALITY_MAX_ENCODER_LOAD_PERCENT 90
+// bitrate deviation from target which is tolerated
+#define JPEG_QUALITY_BITRATE_TOLERANCE_PERCENT 10
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Chooses JPEG quantizer scale (qscale) of device MJPEG encoder.
+        *
+        * Once a period encoded bitrate is compared with target bitrate of device:
+        * jpeg size is roughly inverse to qscale, so qscale moves halfway to
+        * the value which would give target bitrate. Quality is also lowered
+        * when viewers drop frames (network can't take the stream) or when
+        * encoder is busy almost all the time, and is raised back when these
+        * conditions are gone. Qscale stays within configured range.
+        */
+        class jpeg_quality_control {
+        public:
+
+            jpeg_quality_control();
+
+            /** @brief Read qscale range and target bitrate of device from config.
+            * @param device_name - name used for per device settings.
+            */
+            void init(const std::string &device_name);
+
+            /** @brief Number of threads encoding MJPEG of device, encoder load is their average load */
+            void set_encoder_threads(int threads);
+
+            /** @brief Qscale for the next frame, 1 is the best quality */
+            int get_qscale();
+
+            /** @brief JPEG encoder backend of device (JPEG_ENCODER_FFMPEG, JPEG_ENCODER_TURBOJPEG) */
+            std::string get_encoder_name();
+
+            /** @brief Account encoded frame, adjust qscale when period is over.
+            * @param size - size of encoded frame.
+            * @param encode_us - time spent in encoder.
+            * @param ring - ring the frame is published to, its delivery counters show viewer throughput.
+            */
+            void frame_encoded(int size, int64_t encode_us, const std::shared_ptr<frame_ring> &ring);
+
+            /** @brief Fill current qscale, settings and measurements of last period */
+            void get_stats(Json::Value &stats);
+
+        private:
+
+            /** @brief Choose qscale for next period. Must be called under control_mutex */
+            void adjust(int64_t period_ms, const std::shared_ptr<frame_ring> &ring);
+
+            std::mutex control_mutex;
+
+            std::atomic<int> qscale;
+
+            int qmin;
+
+            int qmax;
+
+            /** 0 - no target, quality is lowered only for slow viewers and encoder */
+            int target_kbps;
+
+            std::string encoder_name;
+
+            int encoder_threads;
+
+            /** measurements of current period */
+            int64_t period_start;
+            int64_t period_bytes;
+            int64_t period_frames;
+            int64_t period_encode_us;
+
+            /** delivery counters of ring at period start */
+            int64_t delivered_mark;
+            int64_t dropped_mark;
+
+            /** results of last period */
+            double kbps;
+            double encode_ms;
+            int encoder_load_percent;
+            int drop_percent;
+        };
+    }
+}
+
+#endif
@@ -20,6 +20,7 @@
 #include <chrono>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 #include <ugcs/vsm/vsm.h>
 
@@ -28,8 +29,12 @@
 #include "ugcs/vstreamer/common.h"
 #include "ugcs/vstreamer/http_generic_server.h"
 #include "ugcs/vstreamer/video.h"
+#include "ugcs/vstreamer/stream_engine.h"
 
+// time to keep idle device open after the last connection (nothing is encoded meanwhile)
 #define TIME_TO_CONTINUE_CAPTURING_MS 10000
+// time to open idle device and capture one frame for snapshot
+#define SNAPSHOT_CAPTURE_TIMEOUT_MS 5000
 
 namespace ugcs{
 	namespace vstreamer {
@@ -43,9 +48,12 @@ namespace ugcs{
 		public:
 			/**
 			 * @brief  Constructor
-			 * @return
+			 * @param port - http port of server
+			 * @param vd - device to stream
+			 * @param listen - accept connections on port. If false, clients come
+			 *                 only through client() called by control server.
 			 */
-			MjpegServer(int port, video_device* vd);
+			MjpegServer(int port, video_device* vd, bool listen = true);
 
 			/**
 			 * @brief  Destructor - Cleans up
@@ -78,14 +86,28 @@ namespace ugcs{
 			void cleanUp();
 
 			/**
-			 * @brief  Client thread function
-			 *         Serve a connected TCP-client. This thread function is called
-			 *         for each connect of a HTTP client. It determines
-			 *         if it is a valid HTTP request and dispatches between the different
-			 *         response options.
+			 * @brief  Serve a connected TCP-client. Stream is handed over to
+			 *         stream engine, so this function doesn't block.
 			 */
 			void client(sockets::Socket_handle& fd);
 
+			/**
+			 * @brief  Serve a connected TCP-client with decimated stream.
+			 * @param limits - frame rate and bitrate requested by client.
+			 * @param scale - MJPEG rendition (1 - full size, 2 - 1/2, ...).
+			 */
+			void client(sockets::Socket_handle& fd, const stream_limits &limits, int scale);
+
+			/**
+			 * @brief  Call client() on accepting thread, no thread per client.
+			 */
+			void dispatchClient(sockets::Socket_handle fd);
+
+            /** @brief Capture one frame if device is idle. Frame is published to
+            *   device frame ring, capturing stops after it unless there are viewers.
+            */
+            void requestSnapshot();
+
             /** @brief Check if timeout ocurred for current device */
             bool isTimeout();
 
@@ -99,18 +121,32 @@ namespace ugcs{
 
 		private:
 
+            /** server accepts connections on its own port */
+			bool listening;
+
             /** @brief number of connections to server. When connection number equal to zero
             * image processing stops
             */
-			int connections_number;
-            /** buffer with image data to stream */
-			unsigned char *encoded_buffer;
-            /** size of buffer with image data to stream */
-			int encoded_buffer_size;
+			std::atomic<int> connections_number;
+            /** position of video thread in device MJPEG frame ring */
+			frame_ring::cursor video_cursor;
             /** condition for video stream */
 			std::condition_variable video_condition_;
             /** video stream mutex */
 			std::mutex video_mutex_;
+            /** capture for snapshot until this time (milliseconds), 0 if not requested */
+			std::atomic<int64_t> snapshot_deadline;
+            /** wakes up idle video thread on snapshot request */
+			std::condition_variable capture_condition_;
+			std::mutex capture_mutex_;
+            /** @brief true while snapshot frame is not captured yet */
+			bool isSnapshotRequested();
+            /** ring published count at snapshot request */
+			std::atomic<int64_t> snapshot_seq;
+            /** snapshot is counted as MJPEG subscriber */
+			std::atomic<bool> snapshot_subscribed;
+            /** @brief Drop snapshot subscription when frame is captured or request timed out */
+			void checkSnapshot();
             /** timestamp when last frame was recieved (for timeout detection) */
             int64_t last_frame_time;
 			/** timestamp when last client connection was taken place */
@@ -119,12 +155,6 @@ namespace ugcs{
             /** @brief loop for video capturing */
 			void video();
 
-			/**
-			 * @brief Send a complete HTTP response and a stream of JPG-frames.
-			 * @param fildescriptor fd to send the answer to
-			 */
-			void sendStream(sockets::Socket_handle& fd);
-
 		};
 
 	}
@@ -82,12 +82,15 @@ class video_device;
             */
            // bool get_frame(video_device* video_device_,  unsigned char **encoded_buffer, int& encoded_buffer_size);
 
-            bool get_frame(video_device* video_device_, std::map<int, video_frame*> &frames, int codec_type);
+            bool get_frame(video_device* video_device_, std::map<int, std::shared_ptr<encoded_frame>> &frames, int codec_type);
 
             /** @brief Close OpenCV capturing process, free device.
             */
             void close();
 
+            /** @brief Fill capture statistics (encoder sessions opens/reuses) */
+            void get_stats(Json::Value &stats);
+
         private:
             /** OpenCV capturer */
             cv::VideoCapture cap;
@@ -97,16 +100,14 @@ class video_device;
             ffmpeg_cap* fcap;
             /** input format context (dshow, video4linux or avfoundation) */
             AVCodec *flv_codec;
-            //* output codec context (MJPEG) */
-            AVCodecContext *flv_codec_context;
+            //* opened output encoder (FLV), reused between frames */
+            ffmpeg_encoder_cache encoders;
             //* decoded frame /
             //AVFrame *frame;
             //* encoded (mjpeg) frame /
             AVFrame *frame_encoded;
             //* input packet /
             //AVPacket packet;
-            //* output (mjpeg) packet /
-            AVPacket flv_packet;
 
             //* buffer for encoded frame /
             uint8_t *buffer;
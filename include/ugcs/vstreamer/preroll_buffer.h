@@ -0,0 +1,75 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file preroll_buffer.h
+*
+* Encoded frames of the last seconds kept for recordings
+*/
+
+#ifndef VSTREAMER_PREROLL_BUFFER_H_
+#define VSTREAMER_PREROLL_BUFFER_H_
+
+#include "ugcs/vstreamer/encoded_frame.h"
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <cinttypes>
+
+#include <json/json.h>
+
+// default memory limit of pre-roll of one device
+#define PREROLL_DEFAULT_MAX_MB 32
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief MJPEG frames of the last seconds of device.
+        *
+        * Frames are referenced, not copied. The oldest frames are dropped when
+        * buffer covers more than given duration or holds more than given bytes.
+        * New recording writes these frames before live ones.
+        */
+        class preroll_buffer {
+        public:
+
+            /**
+            * @brief  Constructor
+            * @param duration_ms - time covered by kept frames.
+            * @param max_bytes - memory limit of kept frames.
+            */
+            preroll_buffer(int64_t duration_ms, int64_t max_bytes);
+
+            /** @brief Keep published frame, drop frames which are out of limits */
+            void add(const encoded_frame::Ptr &frame);
+
+            /** @brief Frames captured within duration before given time, the oldest first */
+            std::vector<encoded_frame::Ptr> get_frames(int64_t now_ts);
+
+            int64_t get_duration_ms();
+
+            /** @brief Fill limits and current size */
+            void get_stats(Json::Value &stats);
+
+        private:
+
+            std::mutex buffer_mutex;
+
+            std::deque<encoded_frame::Ptr> frames;
+
+            int64_t duration_ms;
+
+            int64_t max_bytes;
+
+            /** size of kept frames */
+            int64_t bytes;
+
+            /** frames dropped to keep memory limit before they got old */
+            int64_t dropped_count;
+        };
+    }
+}
+
+#endif
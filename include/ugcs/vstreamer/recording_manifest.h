@@ -0,0 +1,77 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file recording_manifest.h
+*
+* List of files of segmented recording
+*/
+
+#ifndef VSTREAMER_RECORDING_MANIFEST_H_
+#define VSTREAMER_RECORDING_MANIFEST_H_
+
+#include <string>
+#include <vector>
+#include <cinttypes>
+
+#define VSTR_RECORDING_MANIFEST_EXTENSION "segments"
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Segments of recording session, the oldest first.
+        *
+        * Session <video id> recorded in segments is kept as files <video id>.001.mp4,
+        * <video id>.002.mp4, ... and manifest <video id>.mp4.segments (JSON). Segments
+        * are consecutive parts of one fragmented MP4 written by a single muxer: the
+        * first one has the header, the last one has the index and the others only
+        * fragments. So only segments joined byte by byte give a valid video, a single
+        * segment after the first one is not playable by itself. Session without
+        * manifest is a single file <video id>.mp4. Sessions of older versions have
+        * .mkv names (MPEG-PS, which may be joined as well).
+        */
+        class recording_manifest {
+        public:
+
+            /** File of session */
+            struct segment {
+                /** file name without folder */
+                std::string file;
+                /** time of the first and the last frame from session start, end_ms is -1 while segment is written */
+                int64_t start_ms;
+                int64_t end_ms;
+                int64_t bytes;
+            };
+
+            /** @brief Full name of session video file (<video id>.mp4), names of manifest and
+            *   metadata are made from it. Gives .mkv name for sessions recorded by older versions.
+            */
+            static std::string get_session_filename(const std::string &folder, const std::string &video_id);
+
+            /** @brief Full name of manifest of session */
+            static std::string get_filename(const std::string &folder, const std::string &video_id);
+
+            /** @brief File name (without folder) of segment with given number, starting from 1 */
+            static std::string get_segment_file(const std::string &video_id, int number);
+
+            /** @brief Full name of file of session folder */
+            static std::string get_path(const std::string &folder, const std::string &file);
+
+            /** @brief Full names of video files of session in playing order.
+            * @return segments, single file of session or empty list if session is not found.
+            */
+            static std::vector<std::string> get_video_files(const std::string &folder, const std::string &video_id);
+
+            /** @brief Read manifest, false if it doesn't exist or is broken */
+            bool load(const std::string &filename);
+
+            /** @brief Replace manifest file with current list */
+            bool save(const std::string &filename);
+
+            std::vector<segment> segments;
+        };
+    }
+}
+
+#endif
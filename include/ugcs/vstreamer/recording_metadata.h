@@ -0,0 +1,110 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file recording_metadata.h
+*
+* Metadata file of recording (<video id>.mp4.md)
+*/
+
+#ifndef VSTREAMER_RECORDING_METADATA_H_
+#define VSTREAMER_RECORDING_METADATA_H_
+
+#include <string>
+#include <cstdio>
+#include <cinttypes>
+
+#include <json/json.h>
+
+// first bytes of binary metadata, older files contain duration as text
+#define RECORDING_METADATA_MAGIC "VSMD"
+#define RECORDING_METADATA_VERSION 1
+// size of binary metadata
+#define RECORDING_METADATA_SIZE 64
+// size of codec name field
+#define RECORDING_METADATA_CODEC_SIZE 16
+// period of metadata update while recording
+#define RECORDING_METADATA_SAVE_PERIOD_MS 1000
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Duration, frame count, picture and codec of recording.
+        *
+        * Values are kept in memory while recording and written to metadata file
+        * once a period and on close. The file is a fixed size little-endian header,
+        * each update overwrites it in place:
+        *
+        * offset | size | field
+        * 0      | 4    | "VSMD"
+        * 4      | 4    | version
+        * 8      | 8    | duration, ms
+        * 16     | 8    | frame count
+        * 24     | 4    | width
+        * 28     | 4    | height
+        * 32     | 16   | codec name, zero padded
+        * 48     | 8    | offset of index in video file (joined segments), 0 - no index
+        * 56     | 4    | flags, 1 - recording is finished
+        * 60     | 4    | pre-roll length, ms
+        */
+        class recording_metadata {
+        public:
+
+            recording_metadata();
+
+            ~recording_metadata();
+
+            /** @brief Create metadata file and write initial header */
+            bool open(const std::string &filename);
+
+            /** @brief Account written frame, header is rewritten when period is over.
+            * @param duration_ms - time of the frame from recording start.
+            */
+            void frame_written(int64_t duration_ms);
+
+            /** @brief Write header now */
+            bool save();
+
+            /** @brief Write final header and close file */
+            void close();
+
+            /** @brief Read metadata file of either format.
+            *   Text file of older versions gives only duration.
+            */
+            bool load(const std::string &filename);
+
+            /** @brief Fill fields for /video response */
+            void get_json(Json::Value &value);
+
+            int64_t duration_ms;
+
+            int64_t frame_count;
+
+            int width;
+
+            int height;
+
+            std::string codec;
+
+            int64_t index_offset;
+
+            /** frames recorded before request, request is at this time of recording */
+            int64_t preroll_ms;
+
+            bool finished;
+
+            /** false for text metadata of older versions */
+            bool is_binary;
+
+        private:
+
+            FILE *file;
+
+            /** time of the last write of header */
+            int64_t saved_at;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,154 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file recording_writer.h
+*
+* Writer threads shared by all recordings
+*/
+
+#ifndef VSTREAMER_RECORDING_WRITER_H_
+#define VSTREAMER_RECORDING_WRITER_H_
+
+#include "ugcs/vstreamer/encoded_frame.h"
+#include "ugcs/vstreamer/bounded_queue.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <cinttypes>
+
+#include <json/json.h>
+
+// default number of writer threads serving all recordings
+#define RECORDING_DEFAULT_WRITER_THREADS 1
+// default number of frames queued for one recording
+#define RECORDING_DEFAULT_QUEUE_SIZE 300
+// default size of file block written at once
+#define RECORDING_DEFAULT_WRITE_BLOCK_KB 1024
+// file blocks are multiples of this size
+#define RECORDING_WRITE_BLOCK_ALIGN 4096
+// longest sleep of writer thread when there are no frames
+#define RECORDING_WRITER_POLL_MS 1000
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Writes frames of all recordings on a few dedicated threads.
+        *
+        * Recorder pushes references to frames into queue of its session and returns
+        * at once, so device never waits for disk. Writer thread takes all frames
+        * queued for a session and passes them to session write function (muxer).
+        * Muxer output is buffered in blocks of write_block_kb and reaches the file
+        * in whole blocks, see get_write_block_size(); only a flushed fragment of
+        * recording ends with a partial block.
+        * When disk stalls, frames wait in the queue; the oldest ones are dropped
+        * and counted when queue is full.
+        */
+        class recording_writer {
+            struct writer_thread;
+
+        public:
+
+            /** writes frame of session, called on writer thread */
+            typedef std::function<void(const encoded_frame::Ptr &frame)> write_handler;
+
+            /** @brief Queue and counters of one recording */
+            class session {
+            public:
+
+                /** @brief Queue frame for writing, never blocks */
+                void push(const encoded_frame::Ptr &frame);
+
+                /** @brief Account write of file block (called by muxer output) */
+                void block_written(int64_t bytes, int64_t write_us);
+
+                /** @brief Fill queue depth, dropped frames and write latency */
+                void get_stats(Json::Value &stats);
+
+            private:
+                friend class recording_writer;
+
+                session(const std::string &name, const write_handler &write, size_t queue_size);
+
+                struct queued_frame {
+                    encoded_frame::Ptr frame;
+                    int64_t queued_us;
+                };
+
+                std::string name;
+
+                write_handler write;
+
+                bounded_queue<queued_frame> queue;
+
+                /** held while writer thread writes frames of session */
+                std::mutex write_mutex;
+
+                /** thread which serves session */
+                writer_thread *thread;
+
+                std::mutex stats_mutex;
+                int64_t written_count;
+                /** time from push to the end of write */
+                int64_t latency_total_us;
+                int64_t latency_max_us;
+                int64_t block_count;
+                int64_t block_bytes;
+                int64_t block_total_us;
+                int64_t block_max_us;
+            };
+
+            /** @brief Writer shared by all recordings */
+            static std::shared_ptr<recording_writer> get_instance();
+
+            ~recording_writer();
+
+            /** @brief Register recording.
+            * @param name - session name for logs and stats.
+            * @param write - writes frame, called on writer thread in queue order.
+            */
+            std::shared_ptr<session> open_session(const std::string &name, const write_handler &write);
+
+            /** @brief Write frames queued for session and unregister it.
+            *   Write function is not called after return.
+            */
+            void close_session(const std::shared_ptr<session> &recording);
+
+            /** @brief Size of file block written at once, multiple of RECORDING_WRITE_BLOCK_ALIGN */
+            int get_write_block_size();
+
+        private:
+
+            recording_writer(int thread_count, int queue_size, int write_block_size);
+
+            recording_writer(const recording_writer&) = delete;
+
+            recording_writer& operator=(const recording_writer&) = delete;
+
+            /** @brief Loop of one writer thread */
+            void write_loop(std::shared_ptr<writer_thread> thread);
+
+            /** @brief Write all frames queued for session */
+            void drain(session *recording);
+
+            std::vector<std::shared_ptr<writer_thread>> threads;
+
+            /** round-robin distribution of sessions */
+            std::atomic<unsigned> next_thread;
+
+            std::atomic<bool> stop_requested;
+
+            size_t queue_size;
+
+            int write_block_size;
+        };
+    }
+}
+
+#endif
@@ -41,11 +41,50 @@ Close_socket(Socket_handle);
 /**
          * @brief Send an http response message.
          * @param fildescriptor fd to send the answer to
-         * @param http response code. Codes 200, 400 and 500 are accepted.
+         * @param http response code. Codes 200, 400, 500 and 503 are accepted.
          * @param error message
          * @param http content type
+         * @param keep_alive - leave connection open after response, otherwise socket is closed
          */
-int Send_code(sockets::Socket_handle& fd, int response_code, const char *message, std::string content_type = "text/html");
+int Send_code(sockets::Socket_handle& fd, int response_code, const char *message, std::string content_type = "text/html", bool keep_alive = false);
+
+/**
+ * @brief Send an http response with binary body.
+ * @param fd - socket to send the answer to
+ * @param response_code - codes 200, 304, 400, 500 and 503 are accepted.
+ * @param content_type - http content type of body
+ * @param headers - additional header lines, each ends with CRLF
+ * @param body - response body, not sent with code 304
+ * @param body_size - size of body
+ * @param keep_alive - leave connection open after response, otherwise socket is closed
+ * @return number of bytes sent or -1 on error.
+ */
+int Send_response(sockets::Socket_handle& fd, int response_code, const std::string &content_type,
+                  const std::string &headers, const void *body, size_t body_size, bool keep_alive);
+
+/** Buffers passed to one system call by Send_vector, longer lists are sent in chunks */
+#define SEND_VECTOR_CHUNK 16
+
+/** Part of data sent with Send_vector */
+struct Send_buffer {
+    const void *data;
+    size_t size;
+};
+
+/**
+ * @brief Send several buffers with one call (writev).
+ * @return number of bytes sent or -1 on error.
+ */
+int
+Send_vector(Socket_handle s, const Send_buffer *buffers, int count);
+
+/** @brief Put socket into non-blocking mode */
+int
+Set_nonblocking(Socket_handle s);
+
+/** @brief true if last socket call failed because it would block */
+bool
+Is_would_block();
 
 
 int get_error();
@@ -0,0 +1,171 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file stream_engine.h
+*
+* Non-blocking connection engine serving MJPEG streams of all devices
+*/
+
+#ifndef VSTREAMER_STREAM_ENGINE_H_
+#define VSTREAMER_STREAM_ENGINE_H_
+
+#include "ugcs/vstreamer/sockets.h"
+#include "ugcs/vstreamer/frame_ring.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+#include <json/json.h>
+
+// default number of I/O threads serving all stream connections
+#define STREAM_ENGINE_DEFAULT_IO_THREADS 2
+// longest sleep of I/O thread when there are no events
+#define STREAM_ENGINE_POLL_MS 1000
+// default number of frames queued for one client
+#define STREAM_DEFAULT_CLIENT_QUEUE_SIZE 4
+// default lag in seconds after which client is disconnected (disconnect policy)
+#define STREAM_DEFAULT_MAX_CLIENT_LAG_SEC 5
+// longest wait for client stats of I/O threads
+#define STREAM_ENGINE_STATS_TIMEOUT_MS 500
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** What to do with frames of client which can't keep up */
+        typedef enum {
+            /** only the latest frame waits for sending, older ones are dropped */
+            VSTR_SLOW_CLIENT_LATEST,
+            /** on queue overflow drop queued frames and wait for the next key frame */
+            VSTR_SLOW_CLIENT_KEYFRAME,
+            /** drop the oldest queued frame, disconnect client which lags too long */
+            VSTR_SLOW_CLIENT_DISCONNECT
+        } slow_client_policy;
+
+
+        /** Limits requested by client for its stream, 0 means no limit */
+        struct stream_limits {
+            stream_limits() : max_fps(0), max_kbps(0) {}
+            /** frames per second */
+            int max_fps;
+            /** average bitrate, kilobits per second */
+            int max_kbps;
+        };
+
+
+        /** @brief Sends multipart MJPEG streams to connected clients.
+        *
+        * Sockets are non-blocking and served by a small fixed set of I/O threads
+        * (epoll on linux). Every connection keeps its own write state and cursor in
+        * device frame ring; header, jpeg and boundary of a part are sent with one
+        * writev. I/O threads are woken up by frame rings when frames are published.
+        *
+        * New frames are moved from ring to bounded queue of every connection, so
+        * slow client doesn't delay others; its frames are dropped according to
+        * slow client policy.
+        *
+        * Client may ask for lower frame rate or bitrate than device produces.
+        * Such stream is decimated when frames are taken from ring: frames are
+        * skipped by capture time (fps) and by byte budget refilled at max_kbps,
+        * the same encoded frames are shared by all clients of device.
+        */
+        class stream_engine {
+        public:
+
+            /** called on I/O thread after connection is closed */
+            typedef std::function<void(const frame_ring::cursor &position)> close_handler;
+
+            /** @brief Engine shared by all streaming servers */
+            static std::shared_ptr<stream_engine> get_instance();
+
+            ~stream_engine();
+
+            /** @brief Start streaming to connected client.
+            * @param fd - connected socket, engine closes it when streaming ends.
+            * @param ring - frames to stream.
+            * @param preamble - data to send before the first frame (http response header).
+            * @param owner - server which accepted connection, see close_streams().
+            * @param on_close - called after connection is closed.
+            * @param limits - frame rate and bitrate requested by client.
+            */
+            void add_stream(sockets::Socket_handle fd, const std::shared_ptr<frame_ring> &ring,
+                            const std::string &preamble, const void *owner, const close_handler &on_close,
+                            const stream_limits &limits = stream_limits());
+
+            /** @brief Close all connections of given owner. Returns when they are closed. */
+            void close_streams(const void *owner);
+
+            /** @brief Fill lag, queue and drop counters of clients streaming given ring.
+            * @param ring - frames of device.
+            * @param clients - json array (out), null if stats are unavailable.
+            * @return false if some I/O thread didn't answer in STREAM_ENGINE_STATS_TIMEOUT_MS
+            *   (e.g. engine is shutting down).
+            */
+            bool get_client_stats(const std::shared_ptr<frame_ring> &ring, Json::Value &clients);
+
+        private:
+
+            explicit stream_engine(int thread_count);
+
+            stream_engine(const stream_engine&) = delete;
+
+            stream_engine& operator=(const stream_engine&) = delete;
+
+            struct stream_connection;
+
+            struct io_thread;
+
+            /** @brief Event loop of one I/O thread */
+            void io_loop(std::shared_ptr<io_thread> thread);
+
+            /** @brief Run function on I/O thread */
+            void post(const std::shared_ptr<io_thread> &thread, const std::function<void()> &command);
+
+            /** @brief Register connection on its I/O thread */
+            void attach(const std::shared_ptr<io_thread> &thread, stream_connection *connection);
+
+            /** @brief Move new frames from ring to connection queue */
+            void fill_queue(stream_connection *connection);
+
+            /** @brief Check frame against frame rate and bitrate limits of client.
+            * @return false if frame must be skipped.
+            */
+            bool pass_limits(stream_connection *connection, const encoded_frame::Ptr &frame);
+
+            /** @brief Time in milliseconds since capture of the oldest frame not sent yet */
+            int64_t get_lag(stream_connection *connection, int64_t now);
+
+            /** @brief Send as much as socket accepts.
+            * @return false if connection failed.
+            */
+            bool flush(io_thread *thread, stream_connection *connection);
+
+            /** @brief Read and discard client data.
+            * @return false if client closed connection.
+            */
+            bool drain(stream_connection *connection);
+
+            /** @brief Close and delete connections marked as closed */
+            void sweep(io_thread *thread);
+
+            std::vector<std::shared_ptr<io_thread>> threads;
+
+            /** round-robin distribution of new connections */
+            std::atomic<unsigned> next_thread;
+
+            std::atomic<bool> stop_requested;
+
+            slow_client_policy policy;
+
+            size_t client_queue_size;
+
+            int64_t max_client_lag_ms;
+        };
+    }
+}
+
+#endif
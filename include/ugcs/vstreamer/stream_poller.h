@@ -0,0 +1,79 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file stream_poller.h
+*
+* Readiness notification for non-blocking sockets. Platform specific:
+* epoll (edge-triggered) on linux, poll on mac, WSAPoll on windows.
+*/
+
+#ifndef VSTREAMER_STREAM_POLLER_H_
+#define VSTREAMER_STREAM_POLLER_H_
+
+#include "ugcs/vstreamer/sockets.h"
+
+#include <vector>
+#include <memory>
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Socket event reported by poller */
+        typedef struct {
+            /** context given to stream_poller::add */
+            void *context;
+            bool readable;
+            bool writable;
+            /** peer closed connection or socket error */
+            bool closed;
+        } poll_event;
+
+
+        /** @brief Waits for events of many sockets on one thread.
+        *
+        * Sockets are added, changed and removed only by the thread which calls
+        * wait(). wake() can be called from any thread.
+        */
+        class stream_poller {
+        public:
+            stream_poller();
+
+            ~stream_poller();
+
+            /** @brief Start watching socket for read, write and close events */
+            bool add(sockets::Socket_handle fd, void *context);
+
+            /** @brief Request write events only while there is data to send.
+            * Edge-triggered implementations report writability once per change and ignore this.
+            */
+            void set_write_interest(sockets::Socket_handle fd, bool enabled);
+
+            /** @brief Stop watching socket */
+            void remove(sockets::Socket_handle fd);
+
+            /** @brief Wait for events.
+            * @param events - ready sockets (out).
+            * @param timeout_ms - maximum time to wait.
+            * @return number of events, 0 on timeout or wake(), -1 on error.
+            */
+            int wait(std::vector<poll_event> &events, int timeout_ms);
+
+            /** @brief Interrupt wait() */
+            void wake();
+
+        private:
+            stream_poller(const stream_poller&) = delete;
+
+            stream_poller& operator=(const stream_poller&) = delete;
+
+            /** platform specific state */
+            struct poller_state;
+
+            std::unique_ptr<poller_state> state;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,74 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file turbo_jpeg_encoder.h
+*
+* JPEG encoder backend on libjpeg-turbo
+*/
+
+#ifndef VSTREAMER_TURBO_JPEG_ENCODER_H_
+#define VSTREAMER_TURBO_JPEG_ENCODER_H_
+
+#ifdef TURBOJPEG_ENCODER
+
+#include "ugcs/vstreamer/jpeg_encoder.h"
+
+#include <turbojpeg.h>
+
+#include <vector>
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** @brief Encodes YUV planes of picture with TurboJPEG API (SIMD DCT and huffman coding).
+        *
+        * Full range (YUVJ420P) planes are compressed directly, without copying.
+        * Limited range YUV420P planes are expanded to full range first, as JPEG
+        * samples are always full range. Output goes to buffer of the worst case
+        * size which is kept between frames, so only the encoded bytes are copied
+        * into MJPEG frame.
+        */
+        class turbo_jpeg_encoder : public jpeg_encoder {
+        public:
+
+            turbo_jpeg_encoder();
+
+            ~turbo_jpeg_encoder();
+
+            /** @brief False if TurboJPEG compressor could not be created */
+            bool is_initialized();
+
+            std::shared_ptr<encoded_frame> encode(AVFrame *picture, int qscale);
+
+            const char* get_name() { return JPEG_ENCODER_TURBOJPEG; }
+
+            /** @brief libjpeg quality (1..100) which gives quantization of libavcodec qscale */
+            static int get_quality(int qscale);
+
+        private:
+
+            /** @brief Expand limited range picture into full_range, planes and strides point to result */
+            void expand_range(AVFrame *picture, const unsigned char *planes[3], int strides[3]);
+
+            tjhandle handle;
+
+            /** full range copy of limited range picture */
+            std::vector<unsigned char> full_range;
+
+            /** output buffer, allocated with tjAlloc for current geometry */
+            unsigned char *buffer;
+
+            unsigned long buffer_size;
+
+            int width;
+
+            int height;
+        };
+    }
+}
+
+#endif
+
+#endif
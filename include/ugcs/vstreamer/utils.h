@@ -71,6 +71,28 @@ namespace utils {
   */
     std::string long_to_hex_string(long value);
 
+    /**
+    * @brief Get positive integer setting from config
+    * @param name - setting name
+    * @param default_value - value used if setting is absent or not positive
+    * @return setting value
+    */
+    int getPositiveIntProperty(std::string name, int default_value);
+
+    /**
+    * @brief Decode percent-encoded URI component
+    * @param str - encoded string
+    * @return decoded string
+    */
+    std::string urlDecode(std::string str);
+
+    /**
+    * @brief Percent-encode string to use it as URI component
+    * @param str - string to encode
+    * @return encoded string
+    */
+    std::string urlEncode(std::string str);
+
 
 }
 } 
@@ -25,6 +25,10 @@
 #include "ugcs/vstreamer/utils.h"
 
 #include "ugcs/vstreamer/base_cap.h"
+#include "ugcs/vstreamer/capture_pipeline.h"
+#include "ugcs/vstreamer/frame_ring.h"
+#include "ugcs/vstreamer/jpeg_quality_control.h"
+#include "ugcs/vstreamer/preroll_buffer.h"
 
 #ifdef FFMPEG_CAP
 #include "ugcs/vstreamer/ffmpeg_cap.h"
@@ -39,6 +43,9 @@
 
 #define VS_WAIT(ms) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 
+// smallest MJPEG rendition is 1/VSTR_MAX_RENDITION_SCALE of device picture
+#define VSTR_MAX_RENDITION_SCALE 16
+
 namespace ugcs{
     namespace vstreamer {
 
@@ -86,16 +93,65 @@ namespace ugcs{
             void init_outer_streams();
 
             /** @brief Open video cap for device. If video cap is not initialised yet - it will be
-            * @return true if video cap opens successfully
+            * @return true if video cap opens successfully or is already opened
             */
             bool open();
 
-            /** @brief Get current frame data from device
-            * @param buffer with data (out)
-            * @param size of buffer with data (out)
+            /** @brief Capture next frame of requested codecs (see get_requested_codecs()).
+            * Without pipeline frame is captured by this call, with pipeline it waits
+            * until pipeline publishes a frame of any output.
+            * @param position - cursor of caller in MJPEG frame ring, moved to the returned frame.
+            * @param frame - latest MJPEG frame, empty if MJPEG is not requested (out)
             * @return true if success
             */
-            bool get_frame(unsigned char **encoded_buffer, int& encoded_buffer_size);
+            bool get_frame(frame_ring::cursor &position, encoded_frame::Ptr &frame);
+
+            /** @brief Codecs which have subscribers now (viewers, recorder, broadcasters, snapshot).
+            *   Only these codecs are encoded.
+            */
+            int get_requested_codecs();
+
+            /** @brief Some output (codec or rendition) has subscribers, otherwise nothing is decoded */
+            bool has_subscribers();
+
+            /** @brief Ring of published frames of given codec */
+            std::shared_ptr<frame_ring> get_frame_ring(int codec_type);
+
+            /** @brief Read MJPEG renditions of device from config
+            *   (vstreamer.stream.renditions.<device name> or vstreamer.stream.renditions)
+            */
+            void init_renditions();
+
+            /** @brief Scale divisors of smaller MJPEG renditions (2 for 1/2), full size is not included */
+            std::vector<int> get_rendition_scales();
+
+            /** @brief Ring of MJPEG rendition, scale 1 is full size.
+            * @return ring or NULL if rendition is not configured for device.
+            */
+            std::shared_ptr<frame_ring> get_rendition_ring(int scale);
+
+            /** @brief Read MJPEG quality range and target bitrate of device from config */
+            void init_quality_control();
+
+            /** @brief Rate control of MJPEG encoding */
+            std::shared_ptr<jpeg_quality_control> get_quality_control();
+
+            /** @brief Read pre-roll length and memory limit of device from config.
+            *   Device with pre-roll is captured and MJPEG encoded all the time.
+            */
+            void init_preroll();
+
+            /** @brief True if frames of the last seconds are kept for recordings */
+            bool has_preroll();
+
+            /** @brief Publish frame of smaller rendition to its streaming clients */
+            void publish_rendition(int scale, const std::shared_ptr<encoded_frame> &frame);
+
+            /** @brief Scale divisor of rendition name ("full", "1/2", "1/4"), 0 if name is invalid */
+            static int parse_rendition(const std::string &name);
+
+            /** @brief Name of rendition with given scale divisor */
+            static std::string get_rendition_name(int scale);
 
             /** @brief Init recording session.
             *
@@ -115,9 +171,19 @@ namespace ugcs{
             bool set_outer_stream(outer_stream_type_enum type, std::string url, bool is_active, std::string &result_msg);
 
 
+            /** @brief Publish encoded frame to recorder, broadcasters and streaming clients.
+            *
+            * Frame gets its sequence number and must not be changed after this call.
+            * @param frame - encoded frame.
+            */
+            void publish_frame(const std::shared_ptr<encoded_frame> &frame);
+
             /** @brief Close video cap and free device */
             void close();
 
+            /** @brief Fill device statistics for monitoring (/streams) */
+            void get_stats(Json::Value &stats);
+
             /** device name */
             std::string name;
             /** device type (camera or stream) */
@@ -130,7 +196,7 @@ namespace ugcs{
             int port;
             /** http srever state */
             bool server_started;
-            /** video cap state */
+            /** video cap state, changed by open() and close() */
             bool video_cap_opened;
             /** device timeout setting (from config) */
             int64_t timeout;
@@ -173,7 +239,36 @@ namespace ugcs{
             /** video rec implementation */
             std::shared_ptr<base_save> file_save_impl;
 
-            std::map<int, video_frame*> frames;
+            /** last published frames. key - codec */
+            std::map<int, std::shared_ptr<frame_ring>> frame_rings;
+
+            /** last published frames of smaller MJPEG renditions. key - scale divisor */
+            std::map<int, std::shared_ptr<frame_ring>> rendition_rings;
+
+            /** chooses MJPEG quality (shared by copies of device) */
+            std::shared_ptr<jpeg_quality_control> quality_control;
+
+            /** MJPEG frames of the last seconds, NULL if pre-roll is disabled */
+            std::shared_ptr<preroll_buffer> preroll;
+
+            /** staged capturing, running while cap is opened (if cap supports it);
+            *   replaced on capture thread, read by stats with std::atomic_load */
+            std::shared_ptr<capture_pipeline> pipeline;
+
+            /** serializes open() and close() (pointer to keep device copyable) */
+            std::shared_ptr<std::mutex> open_mutex;
+
+            /** serializes producers of frames (pointer to keep device copyable) */
+            std::shared_ptr<std::mutex> publish_mutex;
+
+            /** signalled with publish_mutex after every published frame */
+            std::shared_ptr<std::condition_variable> publish_condition;
+
+            /** frames of all outputs published, guarded by publish_mutex */
+            int64_t published_count;
+
+            /** @brief Give frame to recorder and broadcasters */
+            void dispatch_frame(const encoded_frame::Ptr &frame);
 
             void add_outer_stream(outer_stream_type_enum type, outer_stream_state_enum state);
 
@@ -0,0 +1,134 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file worker_pool.h
+*
+* Fixed set of threads running queued tasks of two priority classes
+*/
+
+#ifndef VSTREAMER_WORKER_POOL_H_
+#define VSTREAMER_WORKER_POOL_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include <cinttypes>
+
+#include <json/json.h>
+
+// default number of threads serving control requests
+#define WORKER_POOL_DEFAULT_WORKERS 4
+// default number of heavy requests served at the same time
+#define WORKER_POOL_DEFAULT_HEAVY_LIMIT 2
+// default number of requests waiting for a worker
+#define WORKER_POOL_DEFAULT_QUEUE_SIZE 64
+
+namespace ugcs{
+    namespace vstreamer {
+
+        /** Priority class of task */
+        typedef enum {
+            /** short request (info, parameters), always taken first */
+            VSTR_TASK_LIGHT,
+            /** slow request (device or file open, download), limited in number */
+            VSTR_TASK_HEAVY
+        } task_class;
+
+
+        /** @brief Runs tasks on a fixed number of threads.
+        *
+        * Light tasks are always taken before heavy ones. Heavy tasks occupy at
+        * most heavy_limit workers (less than total number of workers), so
+        * there is always a worker free for light tasks. Queue of every class is
+        * bounded, task which doesn't fit is rejected. Queue depth, waiting and
+        * service time of every class are kept for monitoring.
+        */
+        class worker_pool {
+        public:
+
+            /**
+            * @brief  Constructor, starts worker threads
+            * @param name - name used in log.
+            * @param worker_count - number of threads.
+            * @param heavy_limit - maximum number of heavy tasks running at the same time.
+            * @param queue_size - maximum number of waiting tasks of every class.
+            */
+            worker_pool(const std::string &name, int worker_count, int heavy_limit, int queue_size);
+
+            /** @brief  Destructor, stops worker threads */
+            ~worker_pool();
+
+            /** @brief Queue task.
+            * @return false if queue of this class is full or pool is stopped.
+            */
+            bool submit(task_class type, const std::function<void()> &task);
+
+            /** @brief Drop waiting tasks and wait for running ones to finish */
+            void stop();
+
+            /** @brief Fill counters of pool.
+            * @param stats - json object (out).
+            */
+            void get_stats(Json::Value &stats);
+
+        private:
+
+            worker_pool(const worker_pool&) = delete;
+
+            worker_pool& operator=(const worker_pool&) = delete;
+
+            struct queued_task {
+                std::function<void()> run;
+                /** time of submit, microseconds */
+                int64_t queued_ts;
+            };
+
+            struct class_counters {
+                class_counters() : running(0), completed(0), rejected(0), failed(0),
+                                   wait_total_us(0), service_total_us(0), service_max_us(0) {}
+                int running;
+                int64_t completed;
+                int64_t rejected;
+                /** tasks finished with exception */
+                int64_t failed;
+                int64_t wait_total_us;
+                int64_t service_total_us;
+                int64_t service_max_us;
+            };
+
+            /** @brief Thread function of worker */
+            void work();
+
+            /** @brief Class of the next task to run, -1 if there is nothing to run now.
+            *   Must be called under pool_mutex.
+            */
+            int next_class();
+
+            std::string name;
+
+            std::vector<std::thread> workers;
+
+            int heavy_limit;
+
+            size_t queue_size;
+
+            bool stopping;
+
+            std::deque<queued_task> queues[2];
+
+            class_counters counters[2];
+
+            std::mutex pool_mutex;
+
+            std::condition_variable pool_condition;
+        };
+    }
+}
+
+#endif
@@ -18,19 +18,19 @@ namespace vstreamer {
     }
 
 
-    void base_save::add_frame(std::map<int, video_frame*> *frames, int frame_type) {
-        if (frames->count(frame_type) > 0 ) {
-
-                video_frame *vf = frames->at(frame_type);
-
-                this->frame->encoded_buffer_size = vf->encoded_buffer_size;
-                this->frame->encoded_buffer = (unsigned char *) realloc(this->frame->encoded_buffer,
-                                                                      (size_t) this->frame->encoded_buffer_size);
-                memcpy(this->frame->encoded_buffer, vf->encoded_buffer,
-                       (size_t) this->frame->encoded_buffer_size);
-                this->frame->ts = vf->ts;
-                this->frame->video_condition_.notify_all();
-            }
+    void base_save::add_frame(const encoded_frame::Ptr &frame) {
+        std::atomic_store(&this->frame, frame);
+        this->frame_condition_.notify_all();
+    }
+
+
+    void base_save::set_preroll(const std::vector<encoded_frame::Ptr> &frames) {
+        this->preroll_frames = frames;
+    }
+
+
+    encoded_frame::Ptr base_save::get_current_frame() {
+        return std::atomic_load(&this->frame);
     }
 
 }
@@ -0,0 +1,401 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file capture_pipeline.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/capture_pipeline.h"
+#include "ugcs/vstreamer/video_device.h"
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        capture_pipeline::capture_pipeline(video_device *video_device_, base_cap *cap) {
+            this->video_device_ = video_device_;
+            this->cap = cap;
+            this->stop_requested = false;
+            this->running = false;
+            this->wait_keyframe = false;
+            this->packets_read = 0;
+            this->packets_skipped = 0;
+            this->packets_idle = 0;
+            this->frames_decoded = 0;
+            this->frames_forwarded = 0;
+            this->decode_errors = 0;
+            this->frames_reordered = 0;
+
+            int packet_queue_size = utils::getPositiveIntProperty("vstreamer.pipeline.packet_queue_size",
+                                                                  PIPELINE_DEFAULT_PACKET_QUEUE_SIZE);
+            int picture_queue_size = utils::getPositiveIntProperty("vstreamer.pipeline.picture_queue_size",
+                                                                   PIPELINE_DEFAULT_PICTURE_QUEUE_SIZE);
+
+            this->mjpeg_workers = utils::getPositiveIntProperty("vstreamer.pipeline.mjpeg_encoders." + video_device_->name,
+                utils::getPositiveIntProperty("vstreamer.pipeline.mjpeg_encoders", 1));
+            if (this->mjpeg_workers > PIPELINE_MAX_MJPEG_ENCODERS) {
+                this->mjpeg_workers = PIPELINE_MAX_MJPEG_ENCODERS;
+            }
+            video_device_->get_quality_control()->set_encoder_threads(this->mjpeg_workers);
+
+            this->packets = std::make_shared<packet_queue>(packet_queue_size);
+            int codecs[] = { VSTR_CODEC_MJPEG, VSTR_CODEC_FLV };
+            for (int codec_type : codecs) {
+                this->pictures[codec_type] = std::make_shared<picture_queue>(picture_queue_size);
+                this->frames_encoded[codec_type] = 0;
+                this->encode_errors[codec_type] = 0;
+            }
+            std::vector<int> scales = video_device_->get_rendition_scales();
+            for (int scale : scales) {
+                this->rendition_pictures[scale] = std::make_shared<picture_queue>(picture_queue_size);
+                this->renditions_encoded[scale] = 0;
+                this->rendition_errors[scale] = 0;
+            }
+        }
+
+
+        capture_pipeline::~capture_pipeline() {
+            stop();
+        }
+
+
+        void capture_pipeline::start() {
+            if (!threads.empty()) {
+                return;
+            }
+            stop_requested = false;
+            wait_keyframe = false;
+            running = true;
+
+            packets->reopen();
+            for (auto iter = pictures.begin(); iter != pictures.end(); ++iter) {
+                iter->second->reopen();
+            }
+            for (auto iter = rendition_pictures.begin(); iter != rendition_pictures.end(); ++iter) {
+                iter->second->reopen();
+            }
+            mjpeg_in_flight.clear();
+
+            threads.push_back(std::thread(&capture_pipeline::reader, this));
+            threads.push_back(std::thread(&capture_pipeline::decoder, this));
+            for (auto iter = pictures.begin(); iter != pictures.end(); ++iter) {
+                if (iter->first == VSTR_CODEC_MJPEG) {
+                    for (int worker = 0; worker < mjpeg_workers; worker++) {
+                        threads.push_back(std::thread(&capture_pipeline::mjpeg_encoder, this, worker));
+                    }
+                } else {
+                    threads.push_back(std::thread(&capture_pipeline::encoder, this, iter->first));
+                }
+            }
+            for (auto iter = rendition_pictures.begin(); iter != rendition_pictures.end(); ++iter) {
+                threads.push_back(std::thread(&capture_pipeline::rendition_encoder, this, iter->first));
+            }
+            LOG_DEBUG("Video device %s: capture pipeline started.", video_device_->name.c_str());
+        }
+
+
+        void capture_pipeline::stop() {
+            if (threads.empty()) {
+                return;
+            }
+            stop_requested = true;
+            packets->close();
+            for (auto iter = pictures.begin(); iter != pictures.end(); ++iter) {
+                iter->second->close();
+            }
+            for (auto iter = rendition_pictures.begin(); iter != rendition_pictures.end(); ++iter) {
+                iter->second->close();
+            }
+            // reader may be inside blocking read
+            cap->interrupt();
+            for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+                if (iter->joinable()) {
+                    iter->join();
+                }
+            }
+            threads.clear();
+            running = false;
+
+            std::vector<picture_ptr> tmp;
+            picture_pool.swap(tmp);
+            LOG_DEBUG("Video device %s: capture pipeline stopped.", video_device_->name.c_str());
+        }
+
+
+        bool capture_pipeline::is_running() {
+            return running;
+        }
+
+
+        int capture_pipeline::get_requested_codecs() {
+            return video_device_->get_requested_codecs();
+        }
+
+
+        bool capture_pipeline::is_rendition_requested(int scale) {
+            return video_device_->get_rendition_ring(scale)->get_subscriber_count() > 0;
+        }
+
+
+        void capture_pipeline::reader() {
+            while (!stop_requested) {
+                packet_ptr packet(new AVPacket, [](AVPacket *p) {
+                    av_free_packet(p);
+                    delete p;
+                });
+                av_init_packet(packet.get());
+                packet->data = NULL;
+                packet->size = 0;
+
+                if (!cap->read_packet(video_device_, packet.get())) {
+                    if (!stop_requested) {
+                        LOG_ERR("Video device %s: capture pipeline reader failed.", video_device_->name.c_str());
+                    }
+                    break;
+                }
+                packets_read++;
+
+                if (!packets->push(packet)) {
+                    // decoder is too slow, pictures which depend on dropped packets can't be decoded
+                    wait_keyframe = true;
+                }
+            }
+            running = false;
+        }
+
+
+        void capture_pipeline::decoder() {
+            packet_ptr packet;
+            while (!stop_requested) {
+                if (!packets->pop(packet, PIPELINE_QUEUE_WAIT_MS)) {
+                    continue;
+                }
+
+                int codecs = get_requested_codecs();
+                bool renditions_requested = false;
+                for (auto iter = rendition_pictures.begin(); iter != rendition_pictures.end(); ++iter) {
+                    if (is_rendition_requested(iter->first)) {
+                        renditions_requested = true;
+                        break;
+                    }
+                }
+                if (codecs == 0 && !renditions_requested) {
+                    // nobody takes frames, decoding restarts from the next key frame
+                    packets_idle++;
+                    wait_keyframe = true;
+                    continue;
+                }
+
+                if (wait_keyframe) {
+                    if (!(packet->flags & AV_PKT_FLAG_KEY)) {
+                        packets_skipped++;
+                        continue;
+                    }
+                    wait_keyframe = false;
+                }
+
+                // source packet may be already encoded with output codec
+                if (codecs & VSTR_CODEC_MJPEG) {
+                    std::shared_ptr<encoded_frame> forwarded = cap->forward_packet(packet.get(), VSTR_CODEC_MJPEG);
+                    if (forwarded) {
+                        video_device_->publish_frame(forwarded);
+                        frames_forwarded++;
+                        codecs &= ~VSTR_CODEC_MJPEG;
+                    }
+                }
+                if (codecs == 0 && !renditions_requested) {
+                    continue;
+                }
+
+                AVFrame *decoded = NULL;
+                if (!cap->decode_packet(video_device_, packet.get(), &decoded)) {
+                    decode_errors++;
+                    continue;
+                }
+                packet.reset();
+                if (decoded == NULL) {
+                    // decoder needs more data
+                    continue;
+                }
+                frames_decoded++;
+
+                picture_ptr picture = copy_picture(decoded);
+                if (!picture) {
+                    decode_errors++;
+                    continue;
+                }
+                picture->seq = frames_decoded;
+                // encoders finish out of order, frames must not be stamped with encoding time
+                picture->capture_ms = utils::getMilliseconds();
+                for (auto iter = pictures.begin(); iter != pictures.end(); ++iter) {
+                    if (codecs & iter->first) {
+                        iter->second->push(picture);
+                    }
+                }
+                // all renditions are scaled from the same decoded picture
+                for (auto iter = rendition_pictures.begin(); iter != rendition_pictures.end(); ++iter) {
+                    if (is_rendition_requested(iter->first)) {
+                        iter->second->push(picture);
+                    }
+                }
+            }
+        }
+
+
+        void capture_pipeline::encoder(int codec_type) {
+            std::shared_ptr<picture_queue> queue = pictures.at(codec_type);
+            picture_ptr picture;
+            while (!stop_requested) {
+                if (!queue->pop(picture, PIPELINE_QUEUE_WAIT_MS)) {
+                    continue;
+                }
+                std::shared_ptr<encoded_frame> encoded = cap->encode_picture(video_device_, picture->frame, codec_type);
+                if (encoded) {
+                    encoded->set_ts(picture->capture_ms);
+                    video_device_->publish_frame(encoded);
+                    frames_encoded.at(codec_type)++;
+                } else {
+                    encode_errors.at(codec_type)++;
+                }
+                // give picture back to pool
+                picture.reset();
+            }
+        }
+
+
+        void capture_pipeline::mjpeg_encoder(int worker) {
+            std::shared_ptr<picture_queue> queue = pictures.at(VSTR_CODEC_MJPEG);
+            picture_ptr picture;
+            while (!stop_requested) {
+                {
+                    std::lock_guard<std::mutex> lock(dispatch_mutex);
+                    if (!queue->pop(picture, PIPELINE_QUEUE_WAIT_MS)) {
+                        continue;
+                    }
+                    std::lock_guard<std::mutex> reorder_lock(reorder_mutex);
+                    mjpeg_in_flight[picture->seq].done = false;
+                }
+                std::shared_ptr<encoded_frame> encoded = cap->encode_mjpeg(video_device_, picture->frame, worker);
+                if (encoded) {
+                    // published frames keep picture order in time as well
+                    encoded->set_ts(picture->capture_ms);
+                }
+                int64_t seq = picture->seq;
+                // give picture back to pool
+                picture.reset();
+                publish_mjpeg(seq, encoded);
+            }
+        }
+
+
+        void capture_pipeline::publish_mjpeg(int64_t seq, const std::shared_ptr<encoded_frame> &encoded) {
+            std::lock_guard<std::mutex> lock(reorder_mutex);
+            mjpeg_slot &slot = mjpeg_in_flight[seq];
+            slot.done = true;
+            slot.frame = encoded;
+            if (encoded) {
+                frames_encoded.at(VSTR_CODEC_MJPEG)++;
+            } else {
+                encode_errors.at(VSTR_CODEC_MJPEG)++;
+            }
+            // frame waits only for pictures taken earlier by other encoders
+            while (!mjpeg_in_flight.empty() && mjpeg_in_flight.begin()->second.done) {
+                auto first = mjpeg_in_flight.begin();
+                if (first->second.frame) {
+                    video_device_->publish_frame(first->second.frame);
+                    if (first->first != seq) {
+                        frames_reordered++;
+                    }
+                }
+                mjpeg_in_flight.erase(first);
+            }
+        }
+
+
+        void capture_pipeline::rendition_encoder(int scale) {
+            std::shared_ptr<picture_queue> queue = rendition_pictures.at(scale);
+            picture_ptr picture;
+            while (!stop_requested) {
+                if (!queue->pop(picture, PIPELINE_QUEUE_WAIT_MS)) {
+                    continue;
+                }
+                std::shared_ptr<encoded_frame> encoded = cap->encode_rendition(video_device_, picture->frame, scale);
+                if (encoded) {
+                    encoded->set_ts(picture->capture_ms);
+                    video_device_->publish_rendition(scale, encoded);
+                    renditions_encoded.at(scale)++;
+                } else {
+                    rendition_errors.at(scale)++;
+                }
+                // give picture back to pool
+                picture.reset();
+            }
+        }
+
+
+        capture_pipeline::picture_ptr capture_pipeline::copy_picture(AVFrame *src) {
+            // pool is used by decoder thread only. Picture referenced only by pool
+            // is not queued and not encoded now, so it's free.
+            picture_ptr picture;
+            for (auto iter = picture_pool.begin(); iter != picture_pool.end(); ++iter) {
+                if (iter->use_count() == 1) {
+                    picture = *iter;
+                    break;
+                }
+            }
+            if (!picture) {
+                picture = std::make_shared<pipeline_picture>();
+                picture_pool.push_back(picture);
+                LOG_DEBUG("Video device %s: capture pipeline picture pool size %d.",
+                          video_device_->name.c_str(), (int)picture_pool.size());
+            }
+            if (!picture->copy_from(src)) {
+                return picture_ptr();
+            }
+            return picture;
+        }
+
+
+        void capture_pipeline::get_stats(Json::Value &stats) {
+            stats["running"] = (bool)running;
+            stats["packets_read"] = (Json::Int)packets_read;
+            stats["packets_skipped"] = (Json::Int)packets_skipped;
+            stats["packets_idle"] = (Json::Int)packets_idle;
+            stats["frames_decoded"] = (Json::Int)frames_decoded;
+            stats["frames_forwarded"] = (Json::Int)frames_forwarded;
+            stats["decode_errors"] = (Json::Int)decode_errors;
+
+            Json::Value packet_stats;
+            packet_stats["capacity"] = (Json::Int)packets->get_capacity();
+            packet_stats["depth"] = (Json::Int)packets->get_depth();
+            packet_stats["dropped"] = (Json::Int)packets->get_dropped_count();
+            stats["packet_queue"] = packet_stats;
+
+            for (auto iter = pictures.begin(); iter != pictures.end(); ++iter) {
+                Json::Value encoder_stats;
+                encoder_stats["capacity"] = (Json::Int)iter->second->get_capacity();
+                encoder_stats["depth"] = (Json::Int)iter->second->get_depth();
+                encoder_stats["dropped"] = (Json::Int)iter->second->get_dropped_count();
+                encoder_stats["encoded"] = (Json::Int)frames_encoded.at(iter->first);
+                encoder_stats["errors"] = (Json::Int)encode_errors.at(iter->first);
+                if (iter->first == VSTR_CODEC_MJPEG) {
+                    encoder_stats["workers"] = mjpeg_workers;
+                    encoder_stats["reordered"] = (Json::Int)frames_reordered;
+                }
+                stats[iter->first == VSTR_CODEC_MJPEG ? "mjpeg_encoder" : "flv_encoder"] = encoder_stats;
+            }
+            for (auto iter = rendition_pictures.begin(); iter != rendition_pictures.end(); ++iter) {
+                Json::Value encoder_stats;
+                encoder_stats["capacity"] = (Json::Int)iter->second->get_capacity();
+                encoder_stats["depth"] = (Json::Int)iter->second->get_depth();
+                encoder_stats["dropped"] = (Json::Int)iter->second->get_dropped_count();
+                encoder_stats["encoded"] = (Json::Int)renditions_encoded.at(iter->first);
+                encoder_stats["errors"] = (Json::Int)rendition_errors.at(iter->first);
+                stats["rendition_encoders"][video_device::get_rendition_name(iter->first)] = encoder_stats;
+            }
+        }
+
+    }
+}
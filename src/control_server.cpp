@@ -10,10 +10,43 @@
 
 namespace ugcs {
 namespace vstreamer {
+
+	namespace {
+		/** control API route, path is matched exactly or as prefix */
+		struct control_route {
+			const char *method;
+			const char *path;
+			bool prefix;
+			answer_t type;
+		};
+
+		const control_route CONTROL_ROUTES[] = {
+			{"GET", "/streams", false, A_GETINFO},
+			{"GET", "/stream/", true, A_STREAM},
+			{"GET", "/snapshot/", true, A_SNAPSHOT},
+			{"PUT", "/stream", false, A_SETSTREAM},
+			{"GET", "/parameters", false, A_GETPARAMS},
+			{"PUT", "/parameters", false, A_SETPARAMS},
+			{"POST", "/outerstream", false, A_SETOUTERSTREAM},
+			{"GET", "/playback", false, A_PLAYBACK},
+			{"GET", "/video/", true, A_GETVIDEOINFO},
+			{"DELETE", "/video/", true, A_DELETEVIDEO},
+			{"GET", "/download/", true, A_DOWNLOADVIDEO},
+			{"GET", "/stats", false, A_GETSTATS}
+		};
+	}
  
   
   
 	ControlServer::ControlServer(int port) : HttpGenericServer(port), max_port_(port) {
+		idle_poller.reset(new stream_poller());
+		idle_count = 0;
+		idle_timeout_ms = utils::getPositiveIntProperty("vstreamer.control.idle_timeout_sec", CONTROL_DEFAULT_IDLE_TIMEOUT_SEC) * 1000;
+		snapshot_max_age_ms = utils::getPositiveIntProperty("vstreamer.snapshot.max_age_ms", SNAPSHOT_DEFAULT_MAX_AGE_MS);
+		request_pool.reset(new worker_pool("Command Server",
+				utils::getPositiveIntProperty("vstreamer.control.workers", WORKER_POOL_DEFAULT_WORKERS),
+				utils::getPositiveIntProperty("vstreamer.control.max_heavy_requests", WORKER_POOL_DEFAULT_HEAVY_LIMIT),
+				utils::getPositiveIntProperty("vstreamer.control.queue_size", WORKER_POOL_DEFAULT_QUEUE_SIZE)));
 	}
 
 	ControlServer::~ControlServer() {
@@ -26,6 +59,9 @@ namespace vstreamer {
 
 		std::thread t(&ControlServer::execute, this);
 		t.detach();
+
+		std::thread idle_thread(&ControlServer::watchIdleConnections, this);
+		idle_thread.detach();
 	}
   
 
@@ -92,6 +128,10 @@ namespace vstreamer {
         // get folder for saved video
         server_parameters.saved_video_folder = props->Get("vstreamer.saved_video.folder");
 
+        // streaming servers on own ports (devices are always available at /stream/ of control server)
+        server_parameters.per_device_ports = !props->Exists("vstreamer.stream.per_device_ports") ||
+                                             props->Get_int("vstreamer.stream.per_device_ports") != 0;
+
 
 		while (!stop_requested_) {
 
@@ -117,9 +157,12 @@ namespace vstreamer {
                     bool res = found_devices[i].init_video_cap();
                     if (res) {
 
-                        found_devices[i].port = this->find_next_port();
+                        found_devices[i].port = server_parameters.per_device_ports ? this->find_next_port() : port_;
                         device_list[device_name] = found_devices[i];
                         device_list[device_name].init_outer_streams();
+                        device_list[device_name].init_renditions();
+                        device_list[device_name].init_quality_control();
+                        device_list[device_name].init_preroll();
 
                         VS_WAIT(500);
 
@@ -132,7 +175,8 @@ namespace vstreamer {
                                 mjpeg_server->init(&device_list[device_name]);
                             } else {
                                 mjpeg_server = new ugcs::vstreamer::MjpegServer(device_list[device_name].port,
-                                                                                &device_list[device_name]);
+                                                                                &device_list[device_name],
+                                                                                server_parameters.per_device_ports);
                                 http_servers[device_name] = mjpeg_server;
                             }
                             mjpeg_server->start();
@@ -166,189 +210,315 @@ namespace vstreamer {
 	}
 		
 
+	void ControlServer::dispatchClient(sockets::Socket_handle fd) {
+		std::shared_ptr<control_connection> connection = std::make_shared<control_connection>();
+		connection->fd = fd;
+		// wait for request without holding a worker
+		parkConnection(connection);
+	}
+
+
 	void ControlServer::client(sockets::Socket_handle& fd) {
+		std::shared_ptr<control_connection> connection = std::make_shared<control_connection>();
+		connection->fd = fd;
+		serveConnection(connection);
+	}
 
-		int64_t request_ts_milli = utils::getMilliseconds();
-        int64_t request_ts_micro = utils::getMicroseconds();
 
-        int cnt;
-		char buffer[BUFFER_SIZE] = { 0 };
-        //, *pb = buffer;
-		iobuffer iobuf;
-		request req;
+	void ControlServer::serveConnection(std::shared_ptr<control_connection> connection) {
 
-        LOG_DEBUG("Command Server: client is started, fd=%d", fd);
-		
-		/* initializes the structures */
-		initIOBuffer(&iobuf);
-		initRequest(&req);
-
-		/* What does the client want to receive? Read the request. */
-		memset(buffer, 0, sizeof(buffer));
-		if ((cnt = readLineWithTimeout(fd, &iobuf, buffer, sizeof(buffer) - 1, 500))
-				== -1) {
-			LOG_ERROR("Command Server: Error while reading request, cnt=%d, sizeof(buffer) =%zu ", cnt, sizeof(buffer));
-			ugcs::vstreamer::sockets::Close_socket(fd);
-			return;
+        LOG_DEBUG("Command Server: serving client, fd=%d", connection->fd);
+
+		do {
+			/* What does the client want to receive? Read the request. */
+			http_parse_result result = connection->request.read(connection->fd, CONTROL_REQUEST_TIMEOUT_MS);
+			if (result == VSTR_HTTP_CLOSED) {
+				if (connection->served == 0 || connection->request.has_pending_data()) {
+					LOG_ERROR("Command Server: Error while reading request");
+				}
+				releaseConnection(*connection);
+				return;
+			}
+			if (result != VSTR_HTTP_COMPLETE) {
+				LOG_ERROR("Command Server: Malformed request");
+				connection->keep_alive = false;
+				sendResponse(*connection, 400, result == VSTR_HTTP_TOO_LARGE ? "Request is too large" : "Bad request");
+				return;
+			}
+
+			int64_t request_ts_milli = utils::getMilliseconds();
+			int64_t request_ts_micro = utils::getMicroseconds();
+			const http_request &request = connection->request;
+			connection->keep_alive = request.is_keep_alive();
+			LOG_DEBUG("Command Server: %s %s", request.get_method().c_str(), request.get_path().c_str());
+
+			/* determine what to deliver */
+			answer_t type = A_HELP;
+			for (size_t i = 0; i < sizeof(CONTROL_ROUTES) / sizeof(CONTROL_ROUTES[0]); i++) {
+				const control_route &route = CONTROL_ROUTES[i];
+				if (request.method_is(route.method) &&
+					(route.prefix ? request.path_starts_with(route.path) : request.path_is(route.path))) {
+					type = route.type;
+					break;
+				}
+			}
+
+			switch (type) {
+			case A_PLAYBACK: {
+				// playback streams until the end of file, it doesn't hold a worker
+				connection->keep_alive = false;
+				std::thread t([this, connection, request_ts_milli, request_ts_micro]() {
+					answer(*connection, A_PLAYBACK, request_ts_milli, request_ts_micro);
+				});
+				t.detach();
+				return;
+			}
+			case A_SNAPSHOT:
+				if (getCachedSnapshot(findDeviceName(request.get_path().substr(strlen("/snapshot/"))))) {
+					// fresh frame is in device frame ring, answer at once
+					answer(*connection, type, request_ts_milli, request_ts_micro);
+					break;
+				}
+				// idle device has to be opened, it may be slow, serve it as heavy request
+				// fall through
+			case A_SETSTREAM:
+			case A_SETOUTERSTREAM:
+			case A_DELETEVIDEO:
+			case A_DOWNLOADVIDEO: {
+				// device, file or network operations may be slow, they wait for a heavy worker
+				bool queued = request_pool->submit(VSTR_TASK_HEAVY,
+						[this, connection, type, request_ts_milli, request_ts_micro]() {
+					answer(*connection, type, request_ts_milli, request_ts_micro);
+					if (finishRequest(connection)) {
+						queueConnection(connection);
+					}
+				});
+				if (!queued) {
+					LOG_ERROR("Command Server: heavy request queue is full, rejecting request");
+					connection->keep_alive = false;
+					sendResponse(*connection, 503, "Server is busy");
+				}
+				return;
+			}
+			default:
+				answer(*connection, type, request_ts_milli, request_ts_micro);
+			}
+		} while (finishRequest(connection));
+	}
+
+
+	bool ControlServer::finishRequest(const std::shared_ptr<control_connection> &connection) {
+		if (connection->released) {
+			return false;
 		}
-    LOG_DEBUG("%s", buffer);
-		/* determine what to deliver */
-		if (strstr(buffer, "GET /streams") != NULL) {
-			req.type = A_GETINFO;
-			LOG_DEBUG("Command Server: Requested streams info");
+		connection->served++;
+		connection->request.consume();
+		if (connection->request.has_pending_data()) {
+			// pipelined request is already received
+			return true;
 		}
-        else if(strstr(buffer, "PUT /stream") != NULL) {
-            req.type = A_SETSTREAM;
-            LOG_DEBUG("Command Server: Requested stream update");
-        }
-        else if(strstr(buffer, "GET /parameters") != NULL) {
-            req.type = A_GETPARAMS;
-            LOG_DEBUG("Command Server: Requested parameters info");
-        }
-        else if(strstr(buffer, "PUT /parameters") != NULL) {
-            req.type = A_SETPARAMS;
-            LOG_DEBUG("Command Server: Requested parameters update");
+		parkConnection(connection);
+		return false;
+	}
 
-        }
-        else if(strstr(buffer, "POST /outerstream") != NULL) {
-            req.type = A_SETOUTERSTREAM;
-            LOG_DEBUG("Command Server: Requested outer stream update");
 
-        }
-        else if(strstr(buffer, "GET /playback") != NULL) {
-            req.type = A_PLAYBACK;
-            LOG_DEBUG("Command Server: Requested playback");
+	void ControlServer::queueConnection(const std::shared_ptr<control_connection> &connection) {
+		bool queued = request_pool->submit(VSTR_TASK_LIGHT, [this, connection]() {
+			serveConnection(connection);
+		});
+		if (!queued) {
+			LOG_ERROR("Command Server: request queue is full, rejecting client");
+			connection->keep_alive = false;
+			sendResponse(*connection, 503, "Server is busy");
+		}
+	}
 
-        }
-        else if(strstr(buffer, "GET /video/") != NULL) {
-            req.type = A_GETVIDEOINFO;
-            LOG_DEBUG("Command Server: Requested video info");
 
-        }
-        else if(strstr(buffer, "DELETE /video/") != NULL) {
-            req.type = A_DELETEVIDEO;
-            LOG_DEBUG("Command Server: Requested video delete");
+	void ControlServer::parkConnection(const std::shared_ptr<control_connection> &connection) {
+		connection->idle_since = utils::getMilliseconds();
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			parked_connections.push_back(connection);
+		}
+		idle_poller->wake();
+	}
 
-        }
-        else if(strstr(buffer, "GET /download/") != NULL) {
-            req.type = A_DOWNLOADVIDEO;
-            LOG_DEBUG("Command Server: Requested video download");
 
-        }
-        else { // Display help
-			req.type = A_HELP;
-			LOG_DEBUG("Command Server: Requested help screen");
+	void ControlServer::watchIdleConnections() {
+		std::map<control_connection*, std::shared_ptr<control_connection>> idle;
+		std::vector<poll_event> events;
+
+		while (!stop_requested_) {
+			idle_poller->wait(events, CONTROL_IDLE_POLL_MS);
+
+			std::vector<std::shared_ptr<control_connection>> parked;
+			{
+				std::lock_guard<std::mutex> lock(idle_mutex);
+				parked.swap(parked_connections);
+			}
+			for (auto iter = parked.begin(); iter != parked.end(); ++iter) {
+				if (idle_poller->add((*iter)->fd, iter->get())) {
+					idle_poller->set_write_interest((*iter)->fd, false);
+					idle[iter->get()] = *iter;
+				} else {
+					releaseConnection(**iter);
+				}
+			}
+
+			// next request (or close) arrived, serve it on worker
+			for (auto event = events.begin(); event != events.end(); ++event) {
+				auto iter = idle.find((control_connection*)event->context);
+				if (iter == idle.end() || (!event->readable && !event->closed)) {
+					continue;
+				}
+				std::shared_ptr<control_connection> connection = iter->second;
+				idle_poller->remove(connection->fd);
+				idle.erase(iter);
+				queueConnection(connection);
+			}
+
+			// close connections which are idle too long
+			int64_t now = utils::getMilliseconds();
+			for (auto iter = idle.begin(); iter != idle.end();) {
+				if (now - iter->second->idle_since > idle_timeout_ms) {
+					idle_poller->remove(iter->second->fd);
+					releaseConnection(*iter->second);
+					iter = idle.erase(iter);
+				} else {
+					++iter;
+				}
+			}
+			idle_count = (int)idle.size();
+		}
+
+		for (auto iter = idle.begin(); iter != idle.end(); ++iter) {
+			idle_poller->remove(iter->second->fd);
+			releaseConnection(*iter->second);
+		}
+	}
+
+
+	void ControlServer::releaseConnection(control_connection &connection) {
+		if (!connection.released) {
+			connection.released = true;
+			sockets::Close_socket(connection.fd);
+		}
+	}
+
+
+	void ControlServer::sendResponse(control_connection &connection, int response_code, const char *message, std::string content_type) {
+		sendResponse(connection, response_code, response_code == 200 ? content_type : "text/plain", "", message, strlen(message));
+	}
+
+
+	void ControlServer::sendResponse(control_connection &connection, int response_code, const std::string &content_type,
+	                                 const std::string &headers, const void *body, size_t body_size) {
+		if (connection.released) {
+			return;
 		}
+		int ret = sockets::Send_response(connection.fd, response_code, content_type, headers, body, body_size, connection.keep_alive);
+		if (!connection.keep_alive) {
+			// socket is closed after response
+			connection.released = true;
+		}
+		if (ret < 0) {
+			LOG_ERROR("Command Server: write failed, error code: %d", ret);
+			releaseConnection(connection);
+		}
+	}
 
 
+	void ControlServer::answer(control_connection &connection, answer_t type,
+	                           int64_t request_ts_milli, int64_t request_ts_micro) {
+		const http_request &request = connection.request;
+
 		/* now it's time to answer */
-		switch (req.type) {
+		switch (type) {
 		case A_GETINFO: {
 			LOG_DEBUG("Command Server: Request for streams info");
-			sendStreamsInfo(fd);
+			sendStreamsInfo(connection);
 			break;
 		}
         case A_GETPARAMS: {
             LOG_DEBUG("Command Server: Request for params info");
-            sendParamsInfo(fd);
+            sendParamsInfo(connection);
+            break;
+        }
+        case A_STREAM: {
+            std::string device_id = request.get_path().substr(strlen("/stream/"));
+            LOG_DEBUG("Command Server: Request for stream of %s.", device_id.c_str());
+            startStream(connection, device_id);
+            break;
+        }
+        case A_SNAPSHOT: {
+            std::string device_id = request.get_path().substr(strlen("/snapshot/"));
+            LOG_DEBUG("Command Server: Request for snapshot of %s.", device_id.c_str());
+            sendSnapshot(connection, device_id);
             break;
         }
         case A_PLAYBACK: {
-            std::string header(buffer);
-            std::string query = utils::getURIQueryString(header, "playback?");
+            std::string query = request.get_query();
             LOG_DEBUG("Command Server: Request for playback with query %s.", query.c_str());
-            startPlayback(fd, query, request_ts_micro);
+            startPlayback(connection, query, request_ts_micro);
             break;
         }
         case A_GETVIDEOINFO:
         case A_DELETEVIDEO:
         {
-            std::string header(buffer);
-            std::string video_id_param = utils::getURIQueryString(header, "video/");
+            std::string video_id_param = request.get_path().substr(strlen("/video/"));
             LOG_DEBUG("Command Server: Request for video %s.", video_id_param.c_str());
-            if (req.type == A_GETVIDEOINFO) {
-                getVideoMetadata(fd, video_id_param);
-            } else if (req.type == A_DELETEVIDEO) {
-                deleteVideo(fd, video_id_param);
+            if (type == A_GETVIDEOINFO) {
+                getVideoMetadata(connection, video_id_param);
+            } else if (type == A_DELETEVIDEO) {
+                deleteVideo(connection, video_id_param);
             }
             break;
         }
-            case A_DOWNLOADVIDEO:
-            {
-                std::string header(buffer);
-                std::string video_id_param = utils::getURIQueryString(header, "download/");
-                LOG_DEBUG("Command Server: Request for video download %s.", video_id_param.c_str());
-                downloadVideo(fd, video_id_param);
-                break;
-            }
+        case A_DOWNLOADVIDEO:
+        {
+            std::string video_id_param = request.get_path().substr(strlen("/download/"));
+            LOG_DEBUG("Command Server: Request for video download %s.", video_id_param.c_str());
+            downloadVideo(connection, video_id_param);
+            break;
+        }
         case A_SETSTREAM:
         case A_SETPARAMS:
         case A_SETOUTERSTREAM:
         {
             LOG_DEBUG("Command Server: Request for params set");
-            // need to parse body
-            // skip headers except Content Length
-            int content_length = 0;
-            do {
-                memset(buffer, 0, sizeof(buffer));
-
-                if ((cnt = readLineWithTimeout(fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-                    freeRequest(&req);
-                    ugcs::vstreamer::sockets::Close_socket(fd);
-                    return;
-                }
-                if (strstr(buffer, "Content-Length: ") != NULL) {
-                    char *val_str = strdup(buffer + strlen("Content-Length: "));
-                    std::string val(val_str);
-                    free(val_str);
-                    content_length = std::stoi(val);
-                }
-            } while (cnt > 2 && !(buffer[0] == '\r' && buffer[1] == '\n'));
-            // read body
-            LOG_DEBUG("Content length=%d", content_length);
+            LOG_DEBUG("Content length=%d", (int)request.get_body_length());
 
-            if (content_length<1) {
-                LOG_ERROR("Command Server: Incorrect content Length^ %d  ", content_length);
-                ugcs::vstreamer::sockets::Close_socket(fd);
+            if (request.get_body_length() < 1) {
+                LOG_ERROR("Command Server: Request body is empty");
+                sendResponse(connection, 400, "Request body is empty");
                 return;
             }
-            char *body_buffer = new char[content_length+1];
 
-            if (readWithTimeout(fd, &iobuf, body_buffer, (size_t)content_length, 5) == -1) {
-                freeRequest(&req);
-                ugcs::vstreamer::sockets::Close_socket(fd);
-                return;
-            }
-
-            // end of string
-            body_buffer[content_length] = '\0';
-
-            std::string body(body_buffer);
+            std::string body = request.get_body_string();
             LOG_DEBUG("Body=%s", body.c_str());
 
-            delete [] body_buffer;
-
-            if (req.type == A_SETPARAMS) {
-                writeParamsInfo(fd, body);
+            if (type == A_SETPARAMS) {
+                writeParamsInfo(connection, body);
             }
-            else if (req.type == A_SETSTREAM) {
-                writeStreamInfo(fd, body, request_ts_milli);
+            else if (type == A_SETSTREAM) {
+                writeStreamInfo(connection, body, request_ts_milli);
             }
-            else if (req.type == A_SETOUTERSTREAM) {
-                writeOuterStreamInfo(fd, body);
+            else if (type == A_SETOUTERSTREAM) {
+                writeOuterStreamInfo(connection, body);
             }
 
+            break;
+        }
+        case A_GETSTATS: {
+            LOG_DEBUG("Command Server: Request for server stats");
+            sendServerStats(connection);
             break;
         }
 		default:
 			LOG_DEBUG("Command Server: Unknown or help request, Sending help message");
-			sendHelpMessage(fd);
+			sendHelpMessage(connection);
 		}
-		
-		freeRequest(&req);
 
-		LOG("Command Server: Disconnecting HTTP client");
-		return;
 	}
 
 	void ControlServer::cleanUp() {
@@ -361,11 +531,13 @@ namespace vstreamer {
 
         stopSSDPListener();
 
+        request_pool->stop();
+
         sockets::Done_sockets();
 
     }
 	
-	void ControlServer::sendStreamsInfo(ugcs::vstreamer::sockets::Socket_handle& fd) {
+	void ControlServer::sendStreamsInfo(control_connection &connection) {
 		/* message looks like
 		[
 			{"port": 8082, "name": "camera 0", "type": 0},
@@ -388,12 +560,43 @@ namespace vstreamer {
 				msg += "{\"port\":" + std::to_string(dv->port) + ", ";
 				msg += "\"name\":\"" + dv->name + "\", ";
 				msg += "\"index\":\"" + std::to_string(dv->index) + "\", ";
+				msg += "\"stream_path\":\"/stream/" + utils::urlEncode(dv->name) + "\", ";
+                msg += "\"sizes\":[\"full\"";
+                std::vector<int> scales = dv->get_rendition_scales();
+                for (int scale : scales) {
+                    msg += ", \"" + video_device::get_rendition_name(scale) + "\"";
+                }
+                msg += "], ";
                 msg += "\"is_recording_active\":" + (std::string)(dv->is_recording_active ? "true" : "false") + ", ";
                 msg += "\"video_id\":\"" + dv->recording_video_id + "\", ";
                 msg += "\"recording_duration_sec\":" + std::to_string((int)(dv->get_recording_duration()/1000)) + ", ";
                 msg += "\"last_recording_error_code\":\"" + dv->last_recording_error_code + "\", ";
 				msg += "\"type\":" + std::to_string(dv->type) + ", ";
 
+                Json::Value stats(Json::objectValue);
+                dv->get_stats(stats);
+                // lag and drop counters of every viewer
+                bool clients_available = stream_engine::get_instance()->get_client_stats(
+                    dv->get_frame_ring(VSTR_CODEC_MJPEG), stats["clients"]);
+                for (int scale : scales) {
+                    if (!clients_available) {
+                        break;
+                    }
+                    Json::Value rendition_clients;
+                    clients_available = stream_engine::get_instance()->get_client_stats(
+                        dv->get_rendition_ring(scale), rendition_clients);
+                    for (Json::UInt i = 0; i < rendition_clients.size(); i++) {
+                        rendition_clients[i]["size"] = video_device::get_rendition_name(scale);
+                        stats["clients"].append(rendition_clients[i]);
+                    }
+                }
+                if (!clients_available) {
+                    stats["clients"] = Json::Value();
+                }
+                stats["clients_available"] = clients_available;
+                Json::FastWriter stats_writer;
+                msg += "\"stats\":" + stats_writer.write(stats) + ", ";
+
                 msg += "\"outer_streams\":[";
                 bool is_first_outer = true;
                 for (auto os_iter = dv->outer_streams.begin(); os_iter != dv->outer_streams.end(); ++os_iter ) {
@@ -425,12 +628,12 @@ namespace vstreamer {
 		msg += "]\r\n";
 		
 		if (msg.length()>0) {
-			sendCode(fd, 200, msg.c_str(), "application/json");
+			sendResponse(connection, 200, msg.c_str(), "application/json");
 			LOG_DEBUG("Command Server: REST GET Streaminfo response");
 		}
 	}
 
-    void ControlServer::writeOuterStreamInfo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string body) {
+    void ControlServer::writeOuterStreamInfo(control_connection &connection, std::string body) {
         // parse body
         // {"port": 8082, "streams":[{"type"="ustream", "url":"url", "is_active": true},
         //                           {"type"="twitch", "url":"url", "is_active": false}]
@@ -447,7 +650,7 @@ namespace vstreamer {
 
         if (!streams.isArray()) {
             response = "No outer streams send for " + std::to_string(req_port);
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             LOG_ERROR("Error while opening broadcastfor port %d. No outer streams in request.", req_port);
             return;
         }
@@ -466,7 +669,7 @@ namespace vstreamer {
         }
         if (device_is_found) {
             // send http response
-            sendCode(fd, 200, "", "application/json");
+            sendResponse(connection, 200, "", "application/json");
             // iterate through streams
             for(Json::Value::iterator iter=streams.begin(); iter!=streams.end(); iter++) {
                 Json::UInt ui  = iter.index();
@@ -499,14 +702,14 @@ namespace vstreamer {
         }
         else {
             response = "Error while opening broadcast. No devices with port " + std::to_string(req_port) + "were found.";
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             LOG_ERROR("%s", response.c_str());
             return;
         }
         return;
     }
 
-    void ControlServer::writeStreamInfo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string body, int64_t ts_milli) {
+    void ControlServer::writeStreamInfo(control_connection &connection, std::string body, int64_t ts_milli) {
         // parse body
         // {"port": 8082, "is_recording_active": true, "video_id": "test"}
         std::string response = "";
@@ -533,7 +736,7 @@ namespace vstreamer {
                 // if device is already started
                 if (dv->is_recording_active) {
                     response = std::to_string(VSTR_REC_ERR_RECORDING_IS_ALREADY_IN_PROCESS);
-                    sendCode(fd, 400, response.c_str(), "application/json");
+                    sendResponse(connection, 400, response.c_str(), "application/json");
                     return;
                 }
                 else {
@@ -541,14 +744,14 @@ namespace vstreamer {
                     if (req_recording_filename.length()<1) {
                         //No filename provided for records session
                         response = std::to_string(VSTR_REC_ERR_VIDEO_NOT_FOUND);
-                        sendCode(fd, 400, response.c_str(), "application/json");
+                        sendResponse(connection, 400, response.c_str(), "application/json");
                         return;
                     }
                     // check if file already exists
-                    std::string filename = utils::createFullFilename(server_parameters.saved_video_folder, req_recording_filename, VSTR_RECORDING_VIDEO_EXTENSION);
-                    if (utils::checkFileExists(filename)) {
+                    if (!recording_manifest::get_video_files(server_parameters.saved_video_folder, req_recording_filename).empty() ||
+                        utils::checkFileExists(recording_manifest::get_filename(server_parameters.saved_video_folder, req_recording_filename))) {
                         response = std::to_string(VSTR_REC_ERR_VIDEO_ALREADY_EXISTS);
-                        sendCode(fd, 400, response.c_str(), "application/json");
+                        sendResponse(connection, 400, response.c_str(), "application/json");
                         return;
                     }
                     else {
@@ -556,7 +759,7 @@ namespace vstreamer {
                         bool res = dv->init_recording(server_parameters.saved_video_folder,
                                                       req_recording_filename, response, ts_milli);
                         if (!res) {
-                            sendCode(fd, 400, response.c_str(), "application/json");
+                            sendResponse(connection, 400, response.c_str(), "application/json");
                             return;
                         }
                         dv->is_recording_active = true;
@@ -572,26 +775,40 @@ namespace vstreamer {
         else {
             // http response with error
             response = std::to_string(VSTR_REC_ERR_DEVICE_NOT_FOUND);
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             return;
         }
 
         // http response
 
-        sendCode(fd, 200, "", "application/json");
+        sendResponse(connection, 200, "", "application/json");
         return;
 
     }
 
-	void ControlServer::sendHelpMessage(ugcs::vstreamer::sockets::Socket_handle& fd) {
+	void ControlServer::sendHelpMessage(control_connection &connection) {
 		char buffer[BUFFER_SIZE] = { 0 };
 
 		sprintf(buffer, CONTROL_HELP_MESSAGE);
 		
-		sendCode(fd, 200, buffer);
+		sendResponse(connection, 200, buffer);
 	}
 
-    void ControlServer::sendParamsInfo(ugcs::vstreamer::sockets::Socket_handle& fd) {
+    void ControlServer::sendServerStats(control_connection &connection) {
+        /* message looks like
+            {"request_pool": {"workers": 4, "heavy_limit": 2, "light": {"queued": 0, ...}, "heavy": {...}}, "idle_connections": 1}
+        */
+        Json::Value stats(Json::objectValue);
+        request_pool->get_stats(stats["request_pool"]);
+        stats["idle_connections"] = (int)idle_count;
+        Json::FastWriter stats_writer;
+        std::string msg = stats_writer.write(stats);
+
+        sendResponse(connection, 200, msg.c_str(), "application/json");
+        LOG_DEBUG("Command Server: REST GET ServerStats response %s", msg.c_str());
+    }
+
+    void ControlServer::sendParamsInfo(control_connection &connection) {
         /* message looks like
             {"autodetect": true}
         */
@@ -599,11 +816,11 @@ namespace vstreamer {
         msg += (server_parameters.autodetect ? "true" : "false");
         msg += "}";
 
-        sendCode(fd, 200, msg.c_str(), "application/json");
+        sendResponse(connection, 200, msg.c_str(), "application/json");
         LOG_DEBUG("Command Server: REST GET ParametersInfo response %s", msg.c_str());
     }
 
-    void ControlServer::writeParamsInfo(ugcs::vstreamer::sockets::Socket_handle& fd, std::string body) {
+    void ControlServer::writeParamsInfo(control_connection &connection, std::string body) {
 
         // parse body
         // {"autodetect": true}
@@ -619,12 +836,128 @@ namespace vstreamer {
 
         // http response
         std::string msg = "";
-        sendCode(fd, 200, msg.c_str(), "application/json");
+        sendResponse(connection, 200, msg.c_str(), "application/json");
         return;
 
     }
 
-    void ControlServer::startPlayback(ugcs::vstreamer::sockets::Socket_handle& fd, std::string query, int64_t ts_micro) {
+    std::string ControlServer::findDeviceName(std::string device_id) {
+        // ignore query string
+        std::size_t query_pos = device_id.find('?');
+        if (query_pos != std::string::npos) {
+            device_id = device_id.substr(0, query_pos);
+        }
+        device_id = utils::urlDecode(device_id);
+
+        // device is found by name or by index
+        std::string device_name = "";
+        if (device_list.count(device_id) > 0) {
+            device_name = device_id;
+        } else if (utils::isNumeric(device_id)) {
+            int index = std::atoi(device_id.c_str());
+            for (auto iter = device_list.begin(); iter != device_list.end(); ++iter) {
+                if (iter->second.index == index) {
+                    device_name = iter->first;
+                    break;
+                }
+            }
+        }
+
+        if (device_name.length() == 0 || http_servers.count(device_name) == 0 || !http_servers[device_name]->started) {
+            return "";
+        }
+        return device_name;
+    }
+
+    void ControlServer::startStream(control_connection &connection, std::string device_id) {
+        std::string device_name = findDeviceName(device_id);
+        if (device_name.length() == 0) {
+            std::string response = "Device " + utils::urlDecode(device_id) + " not found.";
+            sendResponse(connection, 400, response.c_str());
+            return;
+        }
+        // optional rendition and decimation of stream: ?size=1/2&fps=N&max_kbps=N
+        stream_limits limits;
+        int scale = 1;
+        std::stringstream stream_query(connection.request.get_query());
+        std::string item;
+        while (std::getline(stream_query, item, '&')) {
+            std::size_t found = item.find("=");
+            if (found == std::string::npos) {
+                continue;
+            }
+            std::string key = item.substr(0, found);
+            int value = std::atoi(item.substr(found + 1).c_str());
+            if (key == "fps") {
+                limits.max_fps = value > 0 ? value : 0;
+            } else if (key == "max_kbps") {
+                limits.max_kbps = value > 0 ? value : 0;
+            } else if (key == "size") {
+                std::string size = utils::urlDecode(item.substr(found + 1));
+                scale = video_device::parse_rendition(size);
+                if (scale == 0 || !device_list[device_name].get_rendition_ring(scale)) {
+                    std::string response = "Size " + size + " is not available for device " + device_name + ".";
+                    sendResponse(connection, 400, response.c_str());
+                    return;
+                }
+            }
+        }
+        // server counts connection (to start capturing) and hands it to stream engine
+        connection.released = true;
+        http_servers[device_name]->client(connection.fd, limits, scale);
+    }
+
+    encoded_frame::Ptr ControlServer::getCachedSnapshot(const std::string &device_name) {
+        if (device_name.length() == 0) {
+            return encoded_frame::Ptr();
+        }
+        encoded_frame::Ptr frame = http_servers[device_name]->video_device_->get_frame_ring(VSTR_CODEC_MJPEG)->get_latest();
+        if (frame && utils::getMilliseconds() - frame->get_ts() <= snapshot_max_age_ms) {
+            return frame;
+        }
+        return encoded_frame::Ptr();
+    }
+
+    void ControlServer::sendSnapshot(control_connection &connection, std::string device_id) {
+        std::string device_name = findDeviceName(device_id);
+        if (device_name.length() == 0) {
+            std::string response = "Device " + utils::urlDecode(device_id) + " not found.";
+            sendResponse(connection, 400, response.c_str());
+            return;
+        }
+
+        encoded_frame::Ptr frame = getCachedSnapshot(device_name);
+        if (!frame) {
+            // device is idle or its last frame is too old, capture one frame
+            MjpegServer *server = http_servers[device_name];
+            std::shared_ptr<frame_ring> ring = server->video_device_->get_frame_ring(VSTR_CODEC_MJPEG);
+            frame_ring::cursor position = ring->make_cursor();
+            server->requestSnapshot();
+            if (ring->wait(position, SNAPSHOT_CAPTURE_TIMEOUT_MS)) {
+                ring->read_latest(position, frame);
+            } else {
+                // better old frame than nothing
+                frame = ring->get_latest();
+            }
+        }
+        if (!frame) {
+            LOG_ERROR("Command Server: No frame captured for snapshot of %s", device_name.c_str());
+            sendResponse(connection, 503, "No frame captured");
+            return;
+        }
+
+        // frame sequence number and capture time identify frame of device
+        std::string etag = "\"" + std::to_string(frame->get_seq()) + "-" + std::to_string(frame->get_ts()) + "\"";
+        std::string headers = "ETag: " + etag + "\r\n";
+        std::string client_etags = connection.request.get_header("If-None-Match");
+        if (client_etags.find(etag) != std::string::npos || client_etags == "*") {
+            sendResponse(connection, 304, "", headers, NULL, 0);
+            return;
+        }
+        sendResponse(connection, 200, "image/jpeg", headers, frame->get_data(), frame->get_size());
+    }
+
+    void ControlServer::startPlayback(control_connection &connection, std::string query, int64_t ts_micro) {
 
         //parse query string
         //video_id=XXXX&speed=XX&pos=XXXXX
@@ -647,21 +980,27 @@ namespace vstreamer {
 
         if (video_id.length() == 0) {
             std::string response = "Bad query parameters";
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             return;
         }
 
         // create fiilename
-        std::string filename = utils::createFullFilename(server_parameters.saved_video_folder, video_id, VSTR_RECORDING_VIDEO_EXTENSION);
-
-
+        std::string filename = recording_manifest::get_session_filename(server_parameters.saved_video_folder, video_id);
+        std::vector<std::string> files = recording_manifest::get_video_files(server_parameters.saved_video_folder, video_id);
 
         // check if file exists
-        if (!utils::checkFileExists(filename)) {
+        if (files.empty()) {
             std::string response = "File " + filename + " not found.";
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             return;
         }
+        if (files.size() > 1) {
+            // segments are consecutive parts of one file
+            filename = "concat:" + files[0];
+            for (size_t i = 1; i < files.size(); i++) {
+                filename += "|" + files[i];
+            }
+        }
 
         // video device for plaback (file)
         video_device *vd = new video_device(DEV_FILE);
@@ -675,11 +1014,12 @@ namespace vstreamer {
 
         ffmpeg_playback *fp;
         fp = new ffmpeg_playback(vd);
-        // start playback
-        fp->start(fd);
+        // start playback, it closes connection at the end of file
+        connection.released = true;
+        fp->start(connection.fd);
     }
 
-    void ControlServer::getVideoMetadata(ugcs::vstreamer::sockets::Socket_handle &fd, std::string video_id) {
+    void ControlServer::getVideoMetadata(control_connection &connection, std::string video_id) {
         // first, search for devices with video_id recording active.
         // if found - return null for duration
         video_device *dv;
@@ -687,156 +1027,146 @@ namespace vstreamer {
             dv = &(iter->second);
             if (dv->recording_video_id == video_id && dv->is_recording_active) {
                 std::string msg = "{ \"duration\": null } \r\n";
-                sendCode(fd, 200, msg.c_str(), "application/json");
+                sendResponse(connection, 200, msg.c_str(), "application/json");
                 LOG_DEBUG("Command Server: REST GET VideoInfo response %s", msg.c_str());
                 return;
             }
         }
 
-        // else search for video and metadata files.
-        std::string filename = utils::createFullFilename(server_parameters.saved_video_folder, video_id, VSTR_RECORDING_VIDEO_EXTENSION);
-        // check if file exists
-        if (!utils::checkFileExists(filename)) {
-            std::string response = std::to_string(VSTR_REC_ERR_VIDEO_NOT_FOUND);
-            sendCode(fd, 400, response.c_str(), "application/json");
-            LOG_ERROR("Command Server: Cannot find video file %s", filename.c_str());
-            return;
-        }
-        // check metadata
-        filename = filename + "." + VSTR_RECORDING_VIDEO_METADATA_EXTENSION;
-        if (!utils::checkFileExists(filename)) {
+        // else read metadata, video file is looked for only when metadata is missing
+        std::string filename = recording_manifest::get_session_filename(server_parameters.saved_video_folder, video_id);
+        std::string metadata_filename = filename + "." + VSTR_RECORDING_VIDEO_METADATA_EXTENSION;
+        recording_metadata metadata;
+        if (!metadata.load(metadata_filename)) {
+            if (recording_manifest::get_video_files(server_parameters.saved_video_folder, video_id).empty()) {
+                std::string response = std::to_string(VSTR_REC_ERR_VIDEO_NOT_FOUND);
+                sendResponse(connection, 400, response.c_str(), "application/json");
+                LOG_ERROR("Command Server: Cannot find video file %s", filename.c_str());
+                return;
+            }
             std::string response = std::to_string(VSTR_REC_ERR_METADATA_NOT_FOUND);
-            sendCode(fd, 400, response.c_str(), "application/json");
-            LOG_ERROR("Command Server: Cannot find metadata file %s", filename.c_str());
+            sendResponse(connection, 400, response.c_str(), "application/json");
+            LOG_ERROR("Command Server: Cannot find metadata file %s", metadata_filename.c_str());
             return;
         }
-        // open metadata
-        std::fstream md_file;
-        md_file.open(filename, std::ios::in);
-        std::string duration;
-        std::getline(md_file, duration);
-        md_file.close();
 
-        std::string msg = "{ \"duration\":" + duration + " } \r\n";
+        Json::Value info;
+        metadata.get_json(info);
+        Json::FastWriter writer;
+        std::string msg = writer.write(info);
 
-        sendCode(fd, 200, msg.c_str(), "application/json");
+        sendResponse(connection, 200, msg.c_str(), "application/json");
         LOG_DEBUG("Command Server: REST GET VideoInfo response %s", msg.c_str());
 
     }
 
-    void ControlServer::deleteVideo(ugcs::vstreamer::sockets::Socket_handle &fd, std::string video_id) {
+    void ControlServer::deleteVideo(control_connection &connection, std::string video_id) {
         // search for video and metadata files.
-        std::string filename = utils::createFullFilename(server_parameters.saved_video_folder, video_id, VSTR_RECORDING_VIDEO_EXTENSION);
+        std::string filename = recording_manifest::get_session_filename(server_parameters.saved_video_folder, video_id);
+        std::vector<std::string> files = recording_manifest::get_video_files(server_parameters.saved_video_folder, video_id);
         // check if file exists
-        if (!utils::checkFileExists(filename)) {
+        if (files.empty()) {
             std::string response = std::to_string(VSTR_REC_ERR_VIDEO_NOT_FOUND);
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             LOG_ERROR("Command Server: Cannot find video file %s", filename.c_str());
             return;
         }
-        int res = std::remove(filename.c_str());
-
-        if (res!=0) {
-            std::string response = std::to_string(VSTR_REC_ERR_UNKNOWN);
-            sendCode(fd, 400, response.c_str(), "application/json");
-            LOG_ERROR("Command Server: Cannot delete video file %s, error code: %d", filename.c_str(), errno);
-            return;
+        int res;
+        for (auto iter = files.begin(); iter != files.end(); ++iter) {
+            res = std::remove(iter->c_str());
+            if (res!=0) {
+                std::string response = std::to_string(VSTR_REC_ERR_UNKNOWN);
+                sendResponse(connection, 400, response.c_str(), "application/json");
+                LOG_ERROR("Command Server: Cannot delete video file %s, error code: %d", iter->c_str(), errno);
+                return;
+            }
+        }
+        // segments are gone, manifest of segmented session is not needed
+        std::string manifest_filename = recording_manifest::get_filename(server_parameters.saved_video_folder, video_id);
+        if (utils::checkFileExists(manifest_filename)) {
+            std::remove(manifest_filename.c_str());
         }
 
         // check metadata
         filename = filename + "." + VSTR_RECORDING_VIDEO_METADATA_EXTENSION;
         if (!utils::checkFileExists(filename)) {
             std::string response = std::to_string(VSTR_REC_ERR_METADATA_NOT_FOUND);
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             LOG_ERROR("Command Server: Cannot find metadata file %s", filename.c_str());
             return;
         }
         res = std::remove(filename.c_str());
         if (res!=0) {
             std::string response = std::to_string(VSTR_REC_ERR_UNKNOWN);
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             LOG_ERROR("Command Server: Cannot delete metadata file %s, error code: %d", filename.c_str(), errno);
             return;
         }
 
-        sendCode(fd, 200, "", "application/json");
+        sendResponse(connection, 200, "", "application/json");
         LOG_DEBUG("files %s are deleted.", filename.c_str());
 
     }
 
-    void ControlServer::downloadVideo(ugcs::vstreamer::sockets::Socket_handle &fd, std::string video_id) {
+    void ControlServer::downloadVideo(control_connection &connection, std::string video_id) {
         // search for video
-        std::string filename = utils::createFullFilename(server_parameters.saved_video_folder, video_id, VSTR_RECORDING_VIDEO_EXTENSION);
+        std::string filename = recording_manifest::get_session_filename(server_parameters.saved_video_folder, video_id);
+        std::vector<std::string> files = recording_manifest::get_video_files(server_parameters.saved_video_folder, video_id);
         // check if file exists
-        if (!utils::checkFileExists(filename)) {
+        if (files.empty()) {
             std::string response = std::to_string(VSTR_REC_ERR_VIDEO_NOT_FOUND);
-            sendCode(fd, 400, response.c_str(), "application/json");
+            sendResponse(connection, 400, response.c_str(), "application/json");
             LOG_ERROR("Command Server: Cannot find video file %s", filename.c_str());
             return;
         }
         LOG_DEBUG("Start to send %s.", filename.c_str());
-        //get file size
-        std::ifstream video_file;
-        video_file.open(filename, std::ios::ate | std::ios::binary | std::ios::in);
-        int64_t filesize = video_file.tellg();
-        video_file.seekg(0, std::ios::beg);
+        //get file size, segments are sent one after another as a single file
+        std::vector<int64_t> sizes;
+        int64_t filesize = 0;
+        for (auto iter = files.begin(); iter != files.end(); ++iter) {
+            std::ifstream video_file;
+            video_file.open(*iter, std::ios::ate | std::ios::binary | std::ios::in);
+            int64_t size = video_file.is_open() ? (int64_t)video_file.tellg() : 0;
+            sizes.push_back(size);
+            filesize += size;
+        }
         //send header
         char buffer_to_send_header[1000] = { 0 };
-        std::string short_name = video_id + "." + VSTR_RECORDING_VIDEO_EXTENSION;
+        std::string short_name = filename.substr(filename.find_last_of("/\\") + 1);
         sprintf(buffer_to_send_header, "HTTP/1.1 200 OK\r\n"
                 "Server: vstreamer_server\r\n"
-                "Transfer-Encoding: chunked\r\n"
+                "Connection: %s\r\n"
                 "Content-Type: binary/octet-stream \r\n"
                 "Content-Disposition: attachment; filename=\"%s\"\r\n"
                 "Content-Length: %" PRId64 "\r\n"
-                "\r\n", short_name.c_str(), filesize);
-        if (send(fd, buffer_to_send_header, strlen(buffer_to_send_header), 0) < 0) {
+                "\r\n", connection.keep_alive ? "keep-alive" : "close", short_name.c_str(), filesize);
+        if (send(connection.fd, buffer_to_send_header, strlen(buffer_to_send_header), 0) < 0) {
             LOG_ERROR("Error while downloading video (message header) %s.", filename.c_str());
+            releaseConnection(connection);
             return;
         }
-        // send chunks
-        const char crlf[]       = { '\r', '\n' };
-        const char last_chunk[] = { '0', '\r', '\n' };
-
-        while (filesize>0) {
-            long bytes_to_read = CHUNK_SIZE;
-            if (bytes_to_read>filesize) {bytes_to_read = (int)filesize;}
-            char buffer[CHUNK_SIZE+1000] = { 0 };
-            char chunk_header_buffer[1000] = { 0 };
-            video_file.read(buffer, bytes_to_read);
-            // send chunk header
-            sprintf(chunk_header_buffer, "%s\r\n", utils::long_to_hex_string(bytes_to_read).c_str());
-            if (send(fd, chunk_header_buffer, strlen(chunk_header_buffer), 0) < 0) {
-                LOG_ERROR("Error while downloading video (chunk header) %s.", filename.c_str());
-                sockets::Close_socket(fd);
-                return;
-            }
-            // send chunk with crlf
-            if (send(fd, buffer, bytes_to_read, 0) < 0) {
-                LOG_ERROR("Error while downloading video (chunk) %s.", filename.c_str());
-                sockets::Close_socket(fd);
-                return;
-            }
-            if (send(fd, crlf, 2, 0) < 0) {
-                LOG_ERROR("Error while downloading video (chunk tail) %s.", filename.c_str());
-                sockets::Close_socket(fd);
-                return;
+        // send files by parts, size is given by Content-Length
+        char buffer[CHUNK_SIZE];
+        for (size_t i = 0; i < files.size(); i++) {
+            std::ifstream video_file;
+            video_file.open(files[i], std::ios::binary | std::ios::in);
+            filesize = sizes[i];
+            while (filesize>0) {
+                long bytes_to_read = CHUNK_SIZE;
+                if (bytes_to_read>filesize) {bytes_to_read = (int)filesize;}
+                video_file.read(buffer, bytes_to_read);
+                if (send(connection.fd, buffer, bytes_to_read, 0) < 0) {
+                    LOG_ERROR("Error while downloading video (chunk) %s.", files[i].c_str());
+                    releaseConnection(connection);
+                    return;
+                }
+                // remaining filesize to send
+                filesize -= bytes_to_read;
             }
-            // remaining filesize to send
-            filesize -= bytes_to_read;
         }
-        // send final chunk
-        if (send(fd, last_chunk, 3, 0) < 0) {
-            LOG_ERROR("Error while downloading video (last chunk) %s.", filename.c_str());
-            sockets::Close_socket(fd);
-            return;
-        }
-        if (send(fd, crlf, 2, 0) < 0) {
-            LOG_ERROR("Error while downloading video (tail) %s.", filename.c_str());
-            sockets::Close_socket(fd);
-            return;
+        if (!connection.keep_alive) {
+            releaseConnection(connection);
         }
-        sockets::Close_socket(fd);
         LOG_DEBUG("Finish to send %s.", filename.c_str());
     }
 
@@ -0,0 +1,188 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file encoded_frame.cpp
+*/
+
+#include "ugcs/vstreamer/encoded_frame.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <cstring>
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+
+        encoded_frame::encoded_frame(int codec_type) {
+            this->buffer = NULL;
+            this->owned_data = NULL;
+            this->data = NULL;
+            this->size = 0;
+            this->codec_type = codec_type;
+            this->seq = -1;
+            this->pts = AV_NOPTS_VALUE;
+            this->ts = utils::getMilliseconds();
+            this->width = 0;
+            this->height = 0;
+            this->key = true;
+        }
+
+
+        encoded_frame::~encoded_frame() {
+#if (LIBAVCODEC_VERSION_MAJOR >= 55)
+            if (buffer) {
+                av_buffer_unref(&buffer);
+            }
+#endif
+            if (owned_data) {
+                av_free(owned_data);
+            }
+        }
+
+
+        std::shared_ptr<encoded_frame> encoded_frame::create(int size, int codec_type) {
+            if (size < 0 || size >= INT_MAX - FF_INPUT_BUFFER_PADDING_SIZE) {
+                return std::shared_ptr<encoded_frame>();
+            }
+            std::shared_ptr<encoded_frame> frame(new encoded_frame(codec_type));
+
+            // padding is required if frame data is given to decoder or muxer
+#if (LIBAVCODEC_VERSION_MAJOR >= 55)
+            frame->buffer = av_buffer_alloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+            if (frame->buffer == NULL) {
+                return std::shared_ptr<encoded_frame>();
+            }
+            frame->data = frame->buffer->data;
+#else
+            frame->owned_data = (uint8_t *) av_malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+            if (frame->owned_data == NULL) {
+                return std::shared_ptr<encoded_frame>();
+            }
+            frame->data = frame->owned_data;
+#endif
+            memset(frame->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+            frame->size = size;
+            return frame;
+        }
+
+
+        std::shared_ptr<encoded_frame> encoded_frame::create_from_packet(AVPacket *packet, int codec_type) {
+            std::shared_ptr<encoded_frame> frame;
+#if (LIBAVCODEC_VERSION_MAJOR >= 55)
+            if (packet->buf) {
+                // share packet buffer
+                frame.reset(new encoded_frame(codec_type));
+                frame->buffer = av_buffer_ref(packet->buf);
+                if (frame->buffer == NULL) {
+                    return std::shared_ptr<encoded_frame>();
+                }
+                frame->data = packet->data;
+                frame->size = packet->size;
+            }
+#endif
+            if (!frame) {
+                frame = create(packet->size, codec_type);
+                if (!frame) {
+                    return frame;
+                }
+                memcpy(frame->data, packet->data, (size_t) packet->size);
+            }
+            frame->pts = packet->pts;
+            frame->key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+            return frame;
+        }
+
+
+        uint8_t* encoded_frame::get_writable_data() {
+            return data;
+        }
+
+
+        const uint8_t* encoded_frame::get_data() const {
+            return data;
+        }
+
+
+        int encoded_frame::get_size() const {
+            return size;
+        }
+
+
+        int encoded_frame::get_codec() const {
+            return codec_type;
+        }
+
+
+        int64_t encoded_frame::get_seq() const {
+            return seq;
+        }
+
+
+        int64_t encoded_frame::get_pts() const {
+            return pts;
+        }
+
+
+        int64_t encoded_frame::get_ts() const {
+            return ts;
+        }
+
+
+        int encoded_frame::get_width() const {
+            return width;
+        }
+
+
+        int encoded_frame::get_height() const {
+            return height;
+        }
+
+
+        bool encoded_frame::is_key() const {
+            return key;
+        }
+
+
+        void encoded_frame::fill_packet(AVPacket *packet) const {
+            av_init_packet(packet);
+#if (LIBAVCODEC_VERSION_MAJOR >= 55)
+            packet->buf = buffer ? av_buffer_ref(buffer) : NULL;
+#endif
+            packet->data = data;
+            packet->size = size;
+            if (key) {
+                packet->flags |= AV_PKT_FLAG_KEY;
+            }
+        }
+
+
+        void encoded_frame::set_seq(int64_t seq) {
+            this->seq = seq;
+        }
+
+
+        void encoded_frame::set_pts(int64_t pts) {
+            this->pts = pts;
+        }
+
+
+        void encoded_frame::set_ts(int64_t ts) {
+            this->ts = ts;
+        }
+
+
+        void encoded_frame::set_geometry(int width, int height) {
+            this->width = width;
+            this->height = height;
+        }
+
+
+        void encoded_frame::set_key(bool key) {
+            this->key = key;
+        }
+
+    }
+}
@@ -8,21 +8,57 @@
 
 #include "ugcs/vstreamer/ffmpeg_cap.h"
 
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
 
 namespace ugcs {
 
     namespace vstreamer {
 
+        namespace {
+            /** per device setting if present, otherwise common one, empty if none */
+            std::string get_device_setting(const std::string &name, const std::string &device_name) {
+                auto props = ugcs::vsm::Properties::Get_instance();
+                if (props->Exists(name + "." + device_name)) {
+                    return props->Get(name + "." + device_name);
+                }
+                return props->Exists(name) ? props->Get(name) : std::string();
+            }
+
+            const char* get_thread_type_name(int thread_type) {
+                if (thread_type == (FF_THREAD_FRAME | FF_THREAD_SLICE)) {
+                    return "auto";
+                }
+                return thread_type == FF_THREAD_FRAME ? "frame" : "slice";
+            }
+        }
+
 
         ffmpeg_cap::ffmpeg_cap() {
             this->prev_dts = -1;
             this->first_frame_dts = -1;
             this->start_time = 0;
-            this->buffer = NULL;
+            this->playback_time_base.num = 1;
+            this->playback_time_base.den = 1000;
             this->videoStream = -1;
             this->res = -1;
             this->format_context_initialized = false;
             this->is_closing = false;
+            this->mjpeg_input = false;
+            this->read_interrupted = false;
+            this->forwarded_count = 0;
+            this->dht_inserted_count = 0;
+            this->decoder_threads = 1;
+            this->decoder_thread_type = FF_THREAD_SLICE;
+            this->decoder_period_start = 0;
+            this->decoder_period_frames = 0;
+            this->decoder_period_latency_us = 0;
+            this->decoder_period_latency_max_us = 0;
+            this->decoder_fps = 0;
+            this->decoder_latency_ms = 0;
+            this->decoder_latency_max_ms = 0;
 
 // on avlibcodec 54 and 53 (linux) we cannot create MJPEG encoder for pix_fmt=AV_PIX_FMT_YUV420P, so
 // we need to use AV_PIX_FMT_YUVJ420P. But in versions 55+ this format is deprecated. So on, in version
@@ -33,6 +69,7 @@ namespace ugcs {
             this->pEncodedFormat = AV_PIX_FMT_YUVJ420P; //AV_PIX_FMT_YUVJ420P;
 #endif
 
+            converter.set_target_format(pEncodedFormat);
         }
 
 
@@ -104,6 +141,11 @@ namespace ugcs {
             format_context = avformat_alloc_context();
             format_context_initialized = true;
 
+            // capture pipeline may interrupt blocking reads when device is closing
+            read_interrupted = false;
+            format_context->interrupt_callback.callback = &ffmpeg_cap::interrupt_callback;
+            format_context->interrupt_callback.opaque = this;
+
 
             fmt = NULL;
 
@@ -139,14 +181,6 @@ namespace ugcs {
                     return false;
                 }
 
-                // allocate mjpeg codec context (for output)
-                mjpeg_codec_context = avcodec_alloc_context3(mjpeg_codec);
-                if (!mjpeg_codec_context) {
-                    LOG_ERR("Video Device (%s): Could not allocate video MJPEG codec context!\n", video_device_->name.c_str());
-                    video_device_->video_cap_opened = false;
-                    return false;
-                }
-
                 // find the flv video encoder (for output)
 #if (LIBAVCODEC_VERSION_MAJOR < 54)
                 flv_codec = avcodec_find_encoder(CODEC_ID_FLV1);
@@ -158,14 +192,7 @@ namespace ugcs {
                     video_device_->video_cap_opened = false;
                     return false;
                 }
-
-                // allocate flv codec context (for output)
-                flv_codec_context = avcodec_alloc_context3(flv_codec);
-                if (!flv_codec_context) {
-                    LOG_ERR("Video Device (%s): Could not allocate video FLV codec context!\n", video_device_->name.c_str());
-                    video_device_->video_cap_opened = false;
-                    return false;
-                }
+                // encoder contexts are opened on first frame by encoder cache
 
                 // try to open input
                 int err = avformat_open_input(&format_context, filenameSrc.c_str(), fmt, NULL);
@@ -203,6 +230,13 @@ namespace ugcs {
 
                 codec_context = format_context->streams[videoStream]->codec;
 
+                if (video_device_->type == DEV_FILE) {
+                    playback_time_base = format_context->streams[videoStream]->time_base;
+                    if (format_context->iformat && strcmp(format_context->iformat->name, "mpeg") == 0) {
+                        playback_time_base = (AVRational){1, 1000};
+                    }
+                }
+
                 // set codec context width and height from video device data
                 if (video_device_->width > 0 && video_device_->height > 0) {
                     codec_context->width = video_device_->width;
@@ -229,20 +263,26 @@ namespace ugcs {
                     return false;
                 }
 
+                configure_decoder_threads(video_device_);
+
                 if (avcodec_open2(codec_context, codec, NULL) < 0) {
                     LOG_ERR("Video Device (%s):  Cannot open codec for input device or stream!\n", video_device_->name.c_str());
                     video_device_->video_cap_opened = false;
                     return false;
                 }
 
-                frame = ffmpeg_utils::frame_alloc();
-                frame_encoded = ffmpeg_utils::frame_alloc();
+#if (LIBAVCODEC_VERSION_MAJOR < 54)
+                mjpeg_input = (codec_context->codec_id == CODEC_ID_MJPEG);
+#else
+                mjpeg_input = (codec_context->codec_id == AV_CODEC_ID_MJPEG);
+#endif
+                if (mjpeg_input) {
+                    LOG_INFO("Video Device (%s): Source gives MJPEG, frames will be forwarded without re-encoding.",
+                             video_device_->name.c_str());
+                }
 
-                // init encoded frame
-                int numBytes;
-                numBytes = avpicture_get_size(pEncodedFormat, codec_context->width, codec_context->height);
-                buffer = (uint8_t *) av_malloc(numBytes * sizeof(uint8_t));
-                avpicture_fill((AVPicture *) frame_encoded, buffer, pEncodedFormat, codec_context->width, codec_context->height);
+                frame = ffmpeg_utils::frame_alloc();
+                // converted frame buffer is allocated by converter on first frame
 
                 av_init_packet(&packet);
 
@@ -256,7 +296,78 @@ namespace ugcs {
         }
 
 
-        void ffmpeg_cap::fill_codec_context(AVCodecContext *ctx) {
+        void ffmpeg_cap::configure_decoder_threads(video_device* video_device_) {
+            int pixels = codec_context->width * codec_context->height;
+            int cores = (int)std::thread::hardware_concurrency();
+            int auto_threads = std::min(std::max(cores, 1), DECODER_MAX_THREADS);
+
+            // small pictures decode fast on one core, frame threading adds a frame of delay per thread
+            std::string threads = get_device_setting("vstreamer.decoder.threads", video_device_->name);
+            if (threads.empty()) {
+                decoder_threads = pixels <= DECODER_SINGLE_THREAD_MAX_PIXELS ? 1 : auto_threads;
+            } else if (threads == "auto") {
+                decoder_threads = auto_threads;
+            } else if (utils::isNumeric(threads) && std::atoi(threads.c_str()) > 0) {
+                decoder_threads = std::min(std::atoi(threads.c_str()), DECODER_MAX_THREADS);
+            } else {
+                LOG_ERR("Video Device (%s): wrong decoder threads \"%s\", using 1.", video_device_->name.c_str(), threads.c_str());
+                decoder_threads = 1;
+            }
+
+            std::string thread_type = get_device_setting("vstreamer.decoder.thread_type", video_device_->name);
+            if (thread_type.empty()) {
+                decoder_thread_type = pixels <= DECODER_SLICE_THREADS_MAX_PIXELS ? FF_THREAD_SLICE : (FF_THREAD_FRAME | FF_THREAD_SLICE);
+            } else if (thread_type == "frame") {
+                decoder_thread_type = FF_THREAD_FRAME;
+            } else if (thread_type == "slice") {
+                decoder_thread_type = FF_THREAD_SLICE;
+            } else if (thread_type == "auto") {
+                decoder_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            } else {
+                LOG_ERR("Video Device (%s): wrong decoder thread type \"%s\", using slice.", video_device_->name.c_str(), thread_type.c_str());
+                decoder_thread_type = FF_THREAD_SLICE;
+            }
+
+            codec_context->thread_count = decoder_threads;
+            codec_context->thread_type = decoder_thread_type;
+            LOG_INFO("Video Device (%s): %dx%d decoded by %d thread(s), %s threading.", video_device_->name.c_str(),
+                     codec_context->width, codec_context->height, decoder_threads, get_thread_type_name(decoder_thread_type));
+
+            std::lock_guard<std::mutex> lock(decoder_stats_mutex);
+            decoder_period_start = 0;
+            decoder_fps = 0;
+            decoder_latency_ms = 0;
+            decoder_latency_max_ms = 0;
+        }
+
+
+        void ffmpeg_cap::decoder_frame_done(int64_t submit_us) {
+            int64_t now_us = utils::getMicroseconds();
+            int64_t latency_us = now_us - submit_us;
+            std::lock_guard<std::mutex> lock(decoder_stats_mutex);
+            if (decoder_period_start == 0) {
+                decoder_period_start = now_us;
+                decoder_period_frames = 0;
+                decoder_period_latency_us = 0;
+                decoder_period_latency_max_us = 0;
+            }
+            decoder_period_frames++;
+            decoder_period_latency_us += latency_us;
+            if (latency_us > decoder_period_latency_max_us) {
+                decoder_period_latency_max_us = latency_us;
+            }
+            int64_t period_us = now_us - decoder_period_start;
+            if (period_us < DECODER_STATS_PERIOD_MS * 1000) {
+                return;
+            }
+            decoder_fps = decoder_period_frames * 1000000.0 / period_us;
+            decoder_latency_ms = (double)decoder_period_latency_us / decoder_period_frames / 1000.0;
+            decoder_latency_max_ms = decoder_period_latency_max_us / 1000.0;
+            decoder_period_start = 0;
+        }
+
+
+        void ffmpeg_cap::fill_codec_context(AVCodecContext *ctx, int width, int height) {
             ctx->pix_fmt = pEncodedFormat;
 
             // on versions 55+ (win and mac) we use pEncodedFormat = AV_PIX_FMT_YUV420P and need
@@ -269,12 +380,8 @@ namespace ugcs {
             ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
 #endif
 
-            ctx->width = codec_context->width;
-            ctx->height = codec_context->height;
-
-            // set top quality
-            ctx->qmin=1;
-            ctx->qmax=1;
+            ctx->width = width;
+            ctx->height = height;
 
             // set fps and bitrate tolerance
             if (ctx->time_base.num == 0) {
@@ -303,49 +410,315 @@ namespace ugcs {
         }
 
 
-        int ffmpeg_cap::encode(AVCodecContext *encode_codec_context, AVFrame *encode_frame, AVPacket &encode_packet, std::map<int, video_frame*> &frames, int codec_type) {
+        encoder_key ffmpeg_cap::make_encoder_key(AVCodec *encoder, int width, int height, int qmin, int qmax) {
+            encoder_key key;
+            key.codec_id = encoder->id;
+            key.width = width;
+            key.height = height;
+            key.pix_fmt = pEncodedFormat;
+            key.qmin = qmin;
+            key.qmax = qmax;
+            return key;
+        }
+
+
+        AVCodecContext* ffmpeg_cap::open_encoder(ffmpeg_encoder_cache &cache, int codec_type, int width, int height, int qscale) {
+            if (codec_type == VSTR_CODEC_MJPEG) {
+                // fixed quality chosen by device quality control, reopened when it or geometry changes
+                return cache.get(mjpeg_codec,
+                        make_encoder_key(mjpeg_codec, width, height, qscale, qscale),
+                        [this, width, height, qscale](AVCodecContext *ctx) {
+                            fill_codec_context(ctx, width, height);
+                            ctx->qmin = qscale;
+                            ctx->qmax = qscale;
+                        });
+            } else if (codec_type == VSTR_CODEC_FLV) {
+                return cache.get(flv_codec,
+                        make_encoder_key(flv_codec, width, height, 2, 31),
+                        [this, width, height](AVCodecContext *ctx) {
+                            fill_codec_context(ctx, width, height);
+                            ctx->qmin = 2;
+                            ctx->qmax = 31;
+                        });
+            }
+            return NULL;
+        }
+
+
+        void ffmpeg_cap::get_stats(Json::Value &stats) {
+            stats["encoder_opens"] = (Json::Int)encoders.get_open_count();
+            stats["encoder_reuses"] = (Json::Int)encoders.get_reuse_count();
+            stats["frames_scaled"] = (Json::Int)converter.get_scaled_count();
+            stats["frames_passed_through"] = (Json::Int)converter.get_passthrough_count();
+            stats["jpeg_forwarded"] = (Json::Int)forwarded_count;
+            stats["jpeg_dht_inserted"] = (Json::Int)dht_inserted_count;
+
+            std::lock_guard<std::mutex> lock(decoder_stats_mutex);
+            Json::Value &decoder = stats["decoder"];
+            decoder["threads"] = decoder_threads;
+            decoder["thread_type"] = get_thread_type_name(decoder_thread_type);
+            decoder["fps"] = decoder_fps;
+            decoder["latency_ms"] = decoder_latency_ms;
+            decoder["latency_max_ms"] = decoder_latency_max_ms;
+        }
+
+
+        int ffmpeg_cap::interrupt_callback(void *opaque) {
+            return static_cast<ffmpeg_cap*>(opaque)->read_interrupted ? 1 : 0;
+        }
+
+
+        void ffmpeg_cap::interrupt() {
+            read_interrupted = true;
+        }
+
+
+        bool ffmpeg_cap::read_packet(video_device* video_device_, AVPacket *packet) {
+            while (!is_closing) {
+                int ret = av_read_frame(format_context, packet);
+                if (ret < 0) {
+                    LOG_ERR("Video Device (%s): Something wrong happened while reading. Error Code: %d.\n",
+                            video_device_->name.c_str(), ret);
+                    return false;
+                }
+                if (packet->stream_index == videoStream) {
+                    // packet data may belong to demuxer, make it own before passing to other thread
+                    if (av_dup_packet(packet) < 0) {
+                        av_free_packet(packet);
+                        return false;
+                    }
+                    return true;
+                }
+                av_free_packet(packet);
+            }
+            return false;
+        }
+
+
+        std::shared_ptr<encoded_frame> ffmpeg_cap::forward_packet(AVPacket *packet, int codec_type) {
+            std::shared_ptr<encoded_frame> forwarded;
+            if (!mjpeg_input || codec_type != VSTR_CODEC_MJPEG) {
+                return forwarded;
+            }
+
+            // usb cameras often omit huffman tables (they are implied by MJPEG),
+            // put standard ones in front of scan data to get valid jpeg picture
+            int dht_pos = ffmpeg_utils::jpeg_dht_insert_position(packet->data, packet->size);
+            if (dht_pos < 0) {
+                forwarded = encoded_frame::create_from_packet(packet, VSTR_CODEC_MJPEG);
+            } else {
+                const std::vector<uint8_t> &dht = ffmpeg_utils::jpeg_default_dht_segment();
+                forwarded = encoded_frame::create(packet->size + (int)dht.size(), VSTR_CODEC_MJPEG);
+                if (forwarded) {
+                    uint8_t *data = forwarded->get_writable_data();
+                    memcpy(data, packet->data, (size_t)dht_pos);
+                    memcpy(data + dht_pos, dht.data(), dht.size());
+                    memcpy(data + dht_pos + dht.size(), packet->data + dht_pos,
+                           (size_t)(packet->size - dht_pos));
+                    forwarded->set_pts(packet->pts);
+                    dht_inserted_count++;
+                }
+            }
+            if (forwarded) {
+                forwarded->set_geometry(codec_context->width, codec_context->height);
+                forwarded->set_key(true);
+                forwarded_count++;
+            }
+            return forwarded;
+        }
+
+
+        bool ffmpeg_cap::decode_packet(video_device* video_device_, AVPacket *packet, AVFrame **picture) {
+            *picture = NULL;
+
+            int frameFinished = 0;
+            // decoder returns it with the picture of this packet, which comes later with frame threading
+            codec_context->reordered_opaque = utils::getMicroseconds();
+            int ret = avcodec_decode_video2(codec_context, frame, &frameFinished, packet);
+            if (ret < 0) {
+                return false;
+            }
+            if (frameFinished <= 0) {
+                return true;
+            }
+            decoder_frame_done(frame->reordered_opaque);
+
+            // convert input frame into output frame (or use it as is)
+            AVFrame *frame_encoded = converter.convert(frame, codec_context->width,
+                                                       codec_context->height,
+                                                       codec_context->pix_fmt,
+                                                       codec_context->color_range);
+            if (frame_encoded == NULL) {
+                return false;
+            }
+            // encoders take geometry from picture
+            frame_encoded->width = codec_context->width;
+            frame_encoded->height = codec_context->height;
+            frame_encoded->format = pEncodedFormat;
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+            if (frame_encoded == frame) {
+                // passed through frames are full range, also YUVJ420P ones relabeled above
+                frame_encoded->color_range = AVCOL_RANGE_JPEG;
+            }
+#endif
+            *picture = frame_encoded;
+            return true;
+        }
+
+
+        std::shared_ptr<encoded_frame> ffmpeg_cap::encode_picture(video_device* video_device_, AVFrame *picture, int codec_type) {
+            return encode_output(video_device_, picture, codec_type, encoders, jpeg);
+        }
+
+
+        std::shared_ptr<encoded_frame> ffmpeg_cap::encode_mjpeg(video_device* video_device_, AVFrame *picture, int worker) {
+            if (worker == 0) {
+                return encode_picture(video_device_, picture, VSTR_CODEC_MJPEG);
+            }
+            std::shared_ptr<mjpeg_worker> state;
+            {
+                std::lock_guard<std::mutex> lock(workers_mutex);
+                std::shared_ptr<mjpeg_worker> &found = mjpeg_workers[worker];
+                if (!found) {
+                    found = std::make_shared<mjpeg_worker>();
+                }
+                state = found;
+            }
+            return encode_output(video_device_, picture, VSTR_CODEC_MJPEG, state->encoders, state->jpeg);
+        }
+
+
+        std::shared_ptr<encoded_frame> ffmpeg_cap::encode_output(video_device* video_device_, AVFrame *picture, int codec_type,
+                                                                 ffmpeg_encoder_cache &cache, std::unique_ptr<jpeg_encoder> &backend) {
+            std::shared_ptr<jpeg_quality_control> quality_control = video_device_->get_quality_control();
+            std::shared_ptr<encoded_frame> encoded;
+            int64_t encode_start = utils::getMicroseconds();
+            if (codec_type == VSTR_CODEC_MJPEG) {
+                encoded = encode_jpeg(video_device_, backend, cache, picture, quality_control->get_qscale());
+            } else {
+                AVCodecContext *encode_codec_context = open_encoder(cache, codec_type, picture->width, picture->height,
+                                                                    quality_control->get_qscale());
+                if (encode_codec_context == NULL) {
+                    LOG_ERR("Video Device (%s): Could not open FLV codec.\n", video_device_->name.c_str());
+                    return encoded;
+                }
+                encoded = encode(encode_codec_context, picture, codec_type);
+            }
+            if (!encoded) {
+                LOG_ERR("Video Device (%s): Error %s-encoding frame.\n", video_device_->name.c_str(),
+                        codec_type == VSTR_CODEC_MJPEG ? "MJPEG" : "FLV");
+                return encoded;
+            }
+            if (codec_type == VSTR_CODEC_MJPEG) {
+                quality_control->frame_encoded(encoded->get_size(), utils::getMicroseconds() - encode_start,
+                                               video_device_->get_frame_ring(VSTR_CODEC_MJPEG));
+            }
+            encoded->set_geometry(picture->width, picture->height);
+            encoded->set_pts(picture->pts);
+            return encoded;
+        }
 
-            video_frame* vf;
 
-            if (frames.count(codec_type) > 0) {
-                vf = frames.at(codec_type);
-            } else
+        std::shared_ptr<encoded_frame> ffmpeg_cap::encode_rendition(video_device* video_device_, AVFrame *picture, int scale) {
+            std::shared_ptr<rendition_encoder> rendition;
             {
-                vf = new video_frame();
-                frames[codec_type] = vf;
+                std::lock_guard<std::mutex> lock(renditions_mutex);
+                std::shared_ptr<rendition_encoder> &found = renditions[scale];
+                if (!found) {
+                    found = std::make_shared<rendition_encoder>();
+                    found->scaler.set_target_format(pEncodedFormat);
+                }
+                rendition = found;
+            }
+
+            // 4:2:0 picture must have even size
+            int width = std::max(2, (picture->width / scale) & ~1);
+            int height = std::max(2, (picture->height / scale) & ~1);
+            AVFrame *scaled = rendition->scaler.scale(picture, width, height);
+            if (scaled == NULL) {
+                return std::shared_ptr<encoded_frame>();
+            }
+            scaled->pts = picture->pts;
+
+            // renditions follow quality and encoder of full size stream
+            std::shared_ptr<encoded_frame> encoded = encode_jpeg(video_device_, rendition->jpeg, rendition->encoders, scaled,
+                                                                 video_device_->get_quality_control()->get_qscale());
+            if (!encoded) {
+                LOG_ERR("Video Device (%s): Error MJPEG-encoding 1/%d rendition.\n", video_device_->name.c_str(), scale);
+                return encoded;
             }
-            vf->ts = utils::getMilliseconds();
+            encoded->set_geometry(width, height);
+            encoded->set_pts(picture->pts);
+            return encoded;
+        }
+
+
+        std::shared_ptr<encoded_frame> ffmpeg_cap::encode_jpeg(video_device* video_device_, std::unique_ptr<jpeg_encoder> &backend,
+                                                               ffmpeg_encoder_cache &cache, AVFrame *picture, int qscale) {
+            std::string name = video_device_->get_quality_control()->get_encoder_name();
+            if (name != JPEG_ENCODER_FFMPEG) {
+                if (!backend || name != backend->get_name()) {
+                    backend = jpeg_encoder::create(name);
+                }
+                if (backend) {
+                    return backend->encode(picture, qscale);
+                }
+            }
+
+            AVCodecContext *encode_codec_context = open_encoder(cache, VSTR_CODEC_MJPEG, picture->width, picture->height, qscale);
+            if (encode_codec_context == NULL) {
+                LOG_ERR("Video Device (%s): Could not open MJPEG codec for %dx%d.\n", video_device_->name.c_str(),
+                        picture->width, picture->height);
+                return std::shared_ptr<encoded_frame>();
+            }
+            return encode(encode_codec_context, picture, VSTR_CODEC_MJPEG);
+        }
+
+
+        std::shared_ptr<encoded_frame> ffmpeg_cap::encode(AVCodecContext *encode_codec_context, AVFrame *encode_frame, int codec_type) {
+
+            std::shared_ptr<encoded_frame> encoded;
 
             // do the encoding
             // (slightly different for different ffmpeg versions)
 
 #if (LIBAVCODEC_VERSION_INT > ((53<<16)+(99<<8)+0))
-            int got_output;
+            AVPacket encode_packet;
+            av_init_packet(&encode_packet);
+            encode_packet.data = NULL;
+            encode_packet.size = 0;
+
+            int got_output = 0;
             int ret = avcodec_encode_video2(encode_codec_context, &encode_packet, encode_frame, &got_output);
-            if (ret < 0) {
-                return ret;
+            if (ret < 0 || !got_output) {
+                av_free_packet(&encode_packet);
+                return encoded;
             }
 
-            vf->encoded_buffer_size = encode_packet.size;
-            vf->encoded_buffer = (unsigned char*)realloc(vf->encoded_buffer, (size_t)vf->encoded_buffer_size);
-            memcpy(vf->encoded_buffer, encode_packet.data, (size_t)vf->encoded_buffer_size);
+            // encoder packet is refcounted on new versions, so it's taken without copying
+            encoded = encoded_frame::create_from_packet(&encode_packet, codec_type);
+            av_free_packet(&encode_packet);
 
 #else
             uint8_t *outbuf;
             uint32_t outbuf_size;
-            outbuf_size = codec_context->width * codec_context->height * 4;
+            outbuf_size = encode_codec_context->width * encode_codec_context->height * 4;
             outbuf = (uint8_t *)av_malloc(outbuf_size);
-            vf->encoded_buffer_size = avcodec_encode_video(encode_codec_context, outbuf, outbuf_size, encode_frame);
-            vf->encoded_buffer = (unsigned char*)realloc(vf->encoded_buffer, vf->encoded_buffer_size);
-            memcpy(vf->encoded_buffer, outbuf, vf->encoded_buffer_size);
+            int encoded_size = avcodec_encode_video(encode_codec_context, outbuf, outbuf_size, encode_frame);
+            if (encoded_size > 0) {
+                encoded = encoded_frame::create(encoded_size, codec_type);
+                if (encoded) {
+                    memcpy(encoded->get_writable_data(), outbuf, encoded_size);
+                }
+            }
             av_free(outbuf);
 #endif
 
-            return 0;
+            return encoded;
         }
 
 
-        bool ffmpeg_cap::get_frame(video_device* video_device_, std::map<int, video_frame*> &frames, int codec_type) {
+        bool ffmpeg_cap::get_frame(video_device* video_device_, std::map<int, std::shared_ptr<encoded_frame>> &frames, int codec_type) {
 
                 bool is_ok = true;
                 int err_count = 0;
@@ -376,7 +749,8 @@ namespace ugcs {
                         }
 
 
-                        int64_t ts_need = static_cast<int64_t>(((utils::getMicroseconds() - start_time) / 1000) * video_device_->playback_speed + first_frame_dts + video_device_->playback_starting_pos);
+                        int64_t position_ms = static_cast<int64_t>(((utils::getMicroseconds() - start_time) / 1000) * video_device_->playback_speed + video_device_->playback_starting_pos);
+                        int64_t ts_need = first_frame_dts + av_rescale_q(position_ms, (AVRational){1, 1000}, playback_time_base);
                         res = av_seek_frame(format_context, videoStream, ts_need, AVSEEK_FLAG_ANY);
                         res = av_read_frame(format_context, &packet);
 
@@ -395,125 +769,68 @@ namespace ugcs {
 
                         if (packet.stream_index == videoStream) {
                             if (video_device_->type == DEV_FILE) {
-                                // for file playback simply copy packet to buffer without encoding
-                                video_frame *vf;
+                                // for file playback simply take packet without encoding
                                 prev_dts = packet.convergence_duration;
-                                if (frames.count(VSTR_CODEC_MJPEG) > 0) {
-                                    vf = frames.at(VSTR_CODEC_MJPEG);
-                                } else {
-                                    vf = new video_frame();
-                                    frames[VSTR_CODEC_MJPEG] = vf;
-                                }
-                                vf->ts = utils::getMilliseconds();
-
-
-                                vf->encoded_buffer_size = packet.size;
-                                vf->encoded_buffer = (unsigned char *) realloc(vf->encoded_buffer, (size_t)vf->encoded_buffer_size);
-                                memcpy(vf->encoded_buffer, packet.data, (size_t)vf->encoded_buffer_size);
+                                std::shared_ptr<encoded_frame> file_frame = encoded_frame::create_from_packet(&packet, VSTR_CODEC_MJPEG);
                                 av_free_packet(&packet);
+                                if (!file_frame) {
+                                    err_count++;
+                                    continue;
+                                }
+                                frames[VSTR_CODEC_MJPEG] = file_frame;
                                 return true;
                             }
                             // for stream or camera do encoding
                             if (video_device_->type == DEV_STREAM || video_device_->type == DEV_CAMERA) {
-                                // decode packet into frame
+                                // codecs which need decoded picture
+                                int encode_codecs = codec_type;
 
-                                int frameFinished = 0;
-                                res = avcodec_decode_video2(codec_context, frame, &frameFinished, &packet);
+                                // source already gives jpeg pictures, send them as is
+                                std::shared_ptr<encoded_frame> forwarded;
+                                if (codec_type & VSTR_CODEC_MJPEG) {
+                                    forwarded = forward_packet(&packet, VSTR_CODEC_MJPEG);
+                                }
+                                if (forwarded) {
+                                    frames[VSTR_CODEC_MJPEG] = forwarded;
+                                    encode_codecs &= ~VSTR_CODEC_MJPEG;
+                                    if (encode_codecs == 0) {
+                                        av_free_packet(&packet);
+                                        return true;
+                                    }
+                                }
 
-                                if (res<0) {
+                                // decode packet into frame
+                                AVFrame *frame_encoded = NULL;
+                                if (!decode_packet(video_device_, &packet, &frame_encoded)) {
                                     av_free_packet(&packet);
                                     err_count++;
                                     continue;
                                 }
 
-                                if (frameFinished > 0) {
-                                    // convert input frame into output frame
-                                    struct SwsContext *img_convert_ctx;
-                                    img_convert_ctx = sws_getCachedContext(NULL, codec_context->width,
-                                                                           codec_context->height,
-                                                                           codec_context->pix_fmt, codec_context->width,
-                                                                           codec_context->height, pEncodedFormat, 1,
-                                                                           NULL, NULL, NULL);
-                                    sws_scale(img_convert_ctx, ((AVPicture *) frame)->data,
-                                              ((AVPicture *) frame)->linesize, 0, codec_context->height,
-                                              ((AVPicture *) frame_encoded)->data,
-                                              ((AVPicture *) frame_encoded)->linesize);
-
-
+                                if (frame_encoded != NULL) {
+                                    bool encoded = true;
                                     //* MJPEG Stuff */
-                                    if (codec_type & VSTR_CODEC_MJPEG) {
-                                        fill_codec_context(mjpeg_codec_context);
-                                        res = avcodec_open2(mjpeg_codec_context, mjpeg_codec, NULL);
-                                        // open codec for encoding
-                                        if (res < 0) {
-                                            LOG_ERR("Video Device (%s): Could not open MJPEG codec. Error code (%d)\n",
-                                                    video_device_->name.c_str(), res);
-                                            sws_freeContext(img_convert_ctx);
-                                            VS_WAIT(100);
-                                            err_count++;
-                                            continue;
-                                        }
-                                        // convert to mjpeg
-                                        av_init_packet(&mjpeg_packet);
-                                        mjpeg_packet.data = NULL;
-                                        mjpeg_packet.size = 0;
-                                        // do the encoding
-                                        int ret = encode(mjpeg_codec_context, frame_encoded, mjpeg_packet,
-                                                         frames, VSTR_CODEC_MJPEG);
-
-
-                                        av_free_packet(&mjpeg_packet);
-
-                                        if (ret < 0) {
-                                            LOG_ERR("Video Device (%s): Error MJPEG-encoding frame. Error code (%d)\n",
-                                                    video_device_->name.c_str(), res);
-                                            sws_freeContext(img_convert_ctx);
-                                            err_count++;
-                                            continue;
-                                        }
+                                    if (encode_codecs & VSTR_CODEC_MJPEG) {
+                                        frames[VSTR_CODEC_MJPEG] = encode_picture(video_device_, frame_encoded, VSTR_CODEC_MJPEG);
+                                        encoded = (frames[VSTR_CODEC_MJPEG] != NULL);
                                     }
                                     // FLV STUFF
-                                    if (codec_type & VSTR_CODEC_FLV) {
-                                        fill_codec_context(flv_codec_context);
-                                        flv_codec_context->qmin = 2;
-                                        flv_codec_context->qmax = 31;
-                                        res = avcodec_open2(flv_codec_context, flv_codec, NULL);
-                                        // open codec for encoding
-                                        if (res < 0) {
-                                            LOG_ERR("Video Device (%s): Could not open FLV codec. Error code (%d)\n",
-                                                    video_device_->name.c_str(), res);
-                                            sws_freeContext(img_convert_ctx);
-                                            VS_WAIT(100);
-                                            err_count++;
-                                            continue;
-                                        }
-                                        // convert to flv
-                                        av_init_packet(&flv_packet);
-                                        flv_packet.data = NULL;
-                                        flv_packet.size = 0;
-
-                                        // do the encoding
-                                        int ret = encode(flv_codec_context, frame_encoded, flv_packet,
-                                                         frames, VSTR_CODEC_FLV);
-                                        av_free_packet(&flv_packet);
-                                        if (ret < 0) {
-                                            LOG_ERR("Video Device (%s): Error FLV-encoding frame. Error code (%d)\n",
-                                                    video_device_->name.c_str(), res);
-                                            sws_freeContext(img_convert_ctx);
-                                            err_count++;
-                                            continue;
-                                        }
+                                    if (encoded && (encode_codecs & VSTR_CODEC_FLV)) {
+                                        frames[VSTR_CODEC_FLV] = encode_picture(video_device_, frame_encoded, VSTR_CODEC_FLV);
+                                        encoded = (frames[VSTR_CODEC_FLV] != NULL);
+                                    }
+                                    if (!encoded) {
+                                        av_free_packet(&packet);
+                                        VS_WAIT(100);
+                                        err_count++;
+                                        continue;
                                     }
-                                    // clear up
-                                    sws_freeContext(img_convert_ctx);
                                 }
 
                                 av_free_packet(&packet);
 
-                                if (frameFinished) {
+                                if (frame_encoded != NULL) {
                                     return true;
-                                } else {
-                                    //err_count++;
                                 }
 
                             }
@@ -567,33 +884,24 @@ namespace ugcs {
                 }
             }
 
-            LOG_DEBUG("Video Device: Closing. Free mjpeg_codec_context.\n");
-            if (mjpeg_codec_context != NULL) {
-                if (avcodec_is_open(mjpeg_codec_context)) {
-                    avcodec_close(mjpeg_codec_context);
-                }
+            LOG_DEBUG("Video Device: Closing. Free encoder sessions (opens: %d, reuses: %d).\n",
+                      (int)encoders.get_open_count(), (int)encoders.get_reuse_count());
+            encoders.close_all();
+            {
+                std::lock_guard<std::mutex> lock(renditions_mutex);
+                renditions.clear();
             }
-
-            LOG_DEBUG("Video Device: Closing. Free flv_codec_context.\n");
-            if (flv_codec_context != NULL) {
-                if (avcodec_is_open(flv_codec_context)) {
-                    avcodec_close(flv_codec_context);
-                }
+            {
+                std::lock_guard<std::mutex> lock(workers_mutex);
+                mjpeg_workers.clear();
             }
 
             LOG_DEBUG("Video Device: Closing. Free frames.\n");
             ffmpeg_utils::frame_free(&frame);
 
-            LOG_DEBUG("Video Device: Closing. Free encoded frames.\n");
-            ffmpeg_utils::frame_free(&frame_encoded);
-
-            LOG_DEBUG("Video Device: Closing. Free buffer.\n");
-            if (this->buffer) {
-                av_free(buffer);
-                this->buffer = NULL;
-            } else {
-                LOG_DEBUG("Video Device: Closing. Buffer is NULL.\n");
-            }
+            LOG_DEBUG("Video Device: Closing. Free converter (scaled: %d, passed through: %d).\n",
+                      (int)converter.get_scaled_count(), (int)converter.get_passthrough_count());
+            converter.close();
 
             LOG_DEBUG("Video Device: Closing. Free format context.\n");
             if (format_context_initialized) {
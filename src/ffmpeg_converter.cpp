@@ -0,0 +1,165 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file ffmpeg_converter.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/ffmpeg_converter.h"
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+
+        ffmpeg_converter::ffmpeg_converter() {
+            this->target_format = AV_PIX_FMT_YUVJ420P;
+            this->sws_context = NULL;
+            this->frame_converted = NULL;
+            this->buffer = NULL;
+            this->width = 0;
+            this->height = 0;
+            this->src_format = AV_PIX_FMT_YUV420P;
+            this->dst_width = 0;
+            this->dst_height = 0;
+            this->scaled_count = 0;
+            this->passthrough_count = 0;
+        }
+
+
+        ffmpeg_converter::~ffmpeg_converter() {
+            close();
+        }
+
+
+        void ffmpeg_converter::set_target_format(AVPixelFormat format) {
+            if (format != target_format) {
+                close();
+                target_format = format;
+            }
+        }
+
+
+        bool ffmpeg_converter::prepare(int width, int height, AVPixelFormat src_format, int dst_width, int dst_height) {
+            if (frame_converted == NULL || dst_width != this->dst_width || dst_height != this->dst_height) {
+                if (buffer) {
+                    av_free(buffer);
+                    buffer = NULL;
+                }
+                if (frame_converted == NULL) {
+                    frame_converted = ffmpeg_utils::frame_alloc();
+                    if (frame_converted == NULL) {
+                        return false;
+                    }
+                }
+                int num_bytes = avpicture_get_size(target_format, dst_width, dst_height);
+                buffer = (uint8_t *) av_malloc(num_bytes * sizeof(uint8_t));
+                if (buffer == NULL) {
+                    return false;
+                }
+                avpicture_fill((AVPicture *) frame_converted, buffer, target_format, dst_width, dst_height);
+                frame_converted->width = dst_width;
+                frame_converted->height = dst_height;
+                frame_converted->format = target_format;
+                LOG_DEBUG("Converter: destination buffer allocated for %dx%d", dst_width, dst_height);
+            }
+
+            // downscaling with area averaging doesn't alias, plain conversion takes the fastest path.
+            // Returns the same context if parameters are not changed.
+            int flags = (dst_width != width || dst_height != height) ? SWS_AREA : SWS_FAST_BILINEAR;
+            sws_context = sws_getCachedContext(sws_context, width, height, src_format,
+                                               dst_width, dst_height, target_format, flags,
+                                               NULL, NULL, NULL);
+            if (sws_context == NULL) {
+                return false;
+            }
+
+            this->width = width;
+            this->height = height;
+            this->src_format = src_format;
+            this->dst_width = dst_width;
+            this->dst_height = dst_height;
+            return true;
+        }
+
+
+        AVFrame* ffmpeg_converter::convert(AVFrame *src, int width, int height, AVPixelFormat src_format, AVColorRange src_range) {
+            // decoder already gives full-range 4:2:0 frame, encoders can take it directly
+            if (src_format == AV_PIX_FMT_YUVJ420P ||
+                    (src_format == AV_PIX_FMT_YUV420P && src_range == AVCOL_RANGE_JPEG)) {
+                passthrough_count++;
+                return src;
+            }
+
+            if (!prepare(width, height, src_format, width, height)) {
+                LOG_ERR("Converter: cannot prepare conversion for %dx%d, format %d", width, height, (int)src_format);
+                return NULL;
+            }
+
+            sws_scale(sws_context, ((AVPicture *) src)->data,
+                      ((AVPicture *) src)->linesize, 0, height,
+                      ((AVPicture *) frame_converted)->data,
+                      ((AVPicture *) frame_converted)->linesize);
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+            // swscale gives limited range for YUV420P
+            frame_converted->color_range = target_format == AV_PIX_FMT_YUVJ420P ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+#endif
+            scaled_count++;
+            return frame_converted;
+        }
+
+
+        AVFrame* ffmpeg_converter::scale(AVFrame *src, int dst_width, int dst_height) {
+            AVPixelFormat format = (AVPixelFormat)src->format;
+            if (!prepare(src->width, src->height, format, dst_width, dst_height)) {
+                LOG_ERR("Converter: cannot prepare scaling of %dx%d to %dx%d, format %d",
+                        src->width, src->height, dst_width, dst_height, (int)format);
+                return NULL;
+            }
+
+            sws_scale(sws_context, ((AVPicture *) src)->data,
+                      ((AVPicture *) src)->linesize, 0, src->height,
+                      ((AVPicture *) frame_converted)->data,
+                      ((AVPicture *) frame_converted)->linesize);
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+            // source is in target format already, resizing keeps its range
+            frame_converted->color_range = src->color_range;
+#endif
+            scaled_count++;
+            return frame_converted;
+        }
+
+
+        void ffmpeg_converter::close() {
+            if (sws_context) {
+                sws_freeContext(sws_context);
+                sws_context = NULL;
+            }
+            if (frame_converted) {
+                ffmpeg_utils::frame_free(&frame_converted);
+                frame_converted = NULL;
+            }
+            if (buffer) {
+                av_free(buffer);
+                buffer = NULL;
+            }
+            width = 0;
+            height = 0;
+            dst_width = 0;
+            dst_height = 0;
+        }
+
+
+        int64_t ffmpeg_converter::get_scaled_count() {
+            return scaled_count;
+        }
+
+
+        int64_t ffmpeg_converter::get_passthrough_count() {
+            return passthrough_count;
+        }
+
+    }
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file ffmpeg_encoder_cache.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/ffmpeg_encoder_cache.h"
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+
+        bool encoder_key::operator==(const encoder_key &other) const {
+            return codec_id == other.codec_id &&
+                   width == other.width &&
+                   height == other.height &&
+                   pix_fmt == other.pix_fmt &&
+                   qmin == other.qmin &&
+                   qmax == other.qmax;
+        }
+
+        bool encoder_key::operator!=(const encoder_key &other) const {
+            return !(*this == other);
+        }
+
+
+        ffmpeg_encoder_cache::ffmpeg_encoder_cache() {
+            this->open_count = 0;
+            this->reuse_count = 0;
+        }
+
+
+        ffmpeg_encoder_cache::~ffmpeg_encoder_cache() {
+            close_all();
+        }
+
+
+        AVCodecContext* ffmpeg_encoder_cache::get(AVCodec *codec, const encoder_key &key, configure_function configure) {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+
+            auto found = sessions.find(key.codec_id);
+            if (found != sessions.end()) {
+                if (found->second.key == key) {
+                    reuse_count++;
+                    return found->second.context;
+                }
+                // input geometry or quality was changed, rebuild session
+                LOG_DEBUG("Encoder session (codec %d): parameters changed (%dx%d -> %dx%d), reopening.",
+                          key.codec_id, found->second.key.width, found->second.key.height, key.width, key.height);
+                free_session(found->second);
+                sessions.erase(found);
+            }
+
+            AVCodecContext *context = avcodec_alloc_context3(codec);
+            if (!context) {
+                LOG_ERR("Encoder session (codec %d): could not allocate codec context.", key.codec_id);
+                return NULL;
+            }
+            configure(context);
+
+            int res = avcodec_open2(context, codec, NULL);
+            if (res < 0) {
+                LOG_ERR("Encoder session (codec %d): could not open codec. Error code (%d)", key.codec_id, res);
+                av_free(context);
+                return NULL;
+            }
+            open_count++;
+
+            encoder_session session;
+            session.key = key;
+            session.context = context;
+            sessions[key.codec_id] = session;
+
+            LOG_DEBUG("Encoder session (codec %d): opened for %dx%d. Opens: %d, reuses: %d.",
+                      key.codec_id, key.width, key.height, (int)open_count, (int)reuse_count);
+            return context;
+        }
+
+
+        void ffmpeg_encoder_cache::free_session(encoder_session &session) {
+            if (session.context != NULL) {
+                if (avcodec_is_open(session.context)) {
+                    avcodec_close(session.context);
+                }
+                av_free(session.context);
+                session.context = NULL;
+            }
+        }
+
+
+        void ffmpeg_encoder_cache::close_all() {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            for (auto iter = sessions.begin(); iter != sessions.end(); ++iter) {
+                free_session(iter->second);
+            }
+            sessions.clear();
+        }
+
+
+        int64_t ffmpeg_encoder_cache::get_open_count() {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            return open_count;
+        }
+
+
+        int64_t ffmpeg_encoder_cache::get_reuse_count() {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            return reuse_count;
+        }
+
+    }
+}
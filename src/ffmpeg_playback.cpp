@@ -26,16 +26,11 @@ namespace ugcs {
 
         void ffmpeg_playback::init(video_device* vd) {
             this->video_device_ = vd;
-            this->encoded_buffer = NULL;
-            this->encoded_buffer_size = 0;
             this->last_frame_time = 0;
         }
 
 
         void ffmpeg_playback::sendStream(sockets::Socket_handle& fd) {
-            unsigned char *frame = NULL, *tmp = NULL;
-            int max_frame_size = 0;
-            int tenk = 10 * 1024;
             char buffer[BUFFER_SIZE] = { 0 };
             double timestamp;
 
@@ -51,32 +46,22 @@ namespace ugcs {
 
             if (res_send < 0) {
                 LOG_ERROR("Playback process (%s): error sending http header, error code = %d", video_device_->playback_video_id.c_str(), res_send);
-                free(frame);
                 return;
             }
+            // file frames are sent in order from the first one
+            std::shared_ptr<frame_ring> ring = video_device_->get_frame_ring(VSTR_CODEC_MJPEG);
+            frame_ring::cursor position;
+
             while (!stop_requested) {
                 /* wait for fresh frames */
-                std::unique_lock<std::mutex> lock(video_mutex_);
-                video_condition_.wait(lock);
-                lock.unlock();
-                /* check if frame buffer is large enough, increase it if necessary */
-                if (encoded_buffer_size > max_frame_size) {
-                    max_frame_size = encoded_buffer_size + tenk;
-                    if ((tmp = (unsigned char*)realloc(frame, (size_t)max_frame_size)) == NULL) {
-                        free(frame);
-                        int ret = sockets::Send_code(fd, 500, "not enough memory");
-                        if (ret < 0) {
-                            LOG_ERROR("Playback process (%s): write failed, done anyway, error code: %d", video_device_->playback_video_id.c_str(), ret);
-                        }
-                        else {
-                            LOG_DEBUG("Playback process (%s): write ok", video_device_->playback_video_id.c_str());
-                        }
-                        LOG_ERROR("Playback process (%s): Not enought memory.", video_device_->playback_video_id.c_str());
-                        return;
-                    }
-                    frame = tmp;
+                if (!ring->wait(position, PIPELINE_QUEUE_WAIT_MS)) {
+                    continue;
+                }
+                /* frame is referenced while it's being sent, no copying */
+                encoded_frame::Ptr frame;
+                if (!ring->read_next(position, frame)) {
+                    continue;
                 }
-                memcpy(frame, encoded_buffer, (size_t)encoded_buffer_size);
 
                 timestamp = (double)utils::getMilliseconds() / 1000;
                 // print the individual mimetype and the length
@@ -85,19 +70,14 @@ namespace ugcs {
                 sprintf(buffer, "Content-Type: image/jpeg\r\n"
                         "Content-Length: %d\r\n"
                         "X-Timestamp: %.06lf\r\n"
-                        "\r\n", encoded_buffer_size, timestamp);
+                        "\r\n", frame->get_size(), timestamp);
                 if (send(fd, buffer, strlen(buffer), 0) < 0) {
                     LOG_ERROR("Playback process (%s): error sending header", video_device_->playback_video_id.c_str());
                     break; }
 
-                if (frame) {
-                    if (send(fd, reinterpret_cast <const char *>(frame), encoded_buffer_size, 0) < 0) {
-                        LOG_ERROR("Playback process (%s): error sending http body", video_device_->playback_video_id.c_str());
-                        break; }
-                } else {
-                    LOG_ERROR("Playback process (%s): error sending http body - no frame exists", video_device_->playback_video_id.c_str());
-                    break;
-                }
+                if (send(fd, reinterpret_cast <const char *>(frame->get_data()), frame->get_size(), 0) < 0) {
+                    LOG_ERROR("Playback process (%s): error sending http body", video_device_->playback_video_id.c_str());
+                    break; }
 
                 sprintf(buffer, "\r\n--boundarydonotcross \r\n");
 
@@ -106,7 +86,9 @@ namespace ugcs {
                 }
 
             }
-            free(frame);
+            if (position.skipped > 0) {
+                LOG_DEBUG("Playback process (%s): %d frames were skipped by slow client", video_device_->playback_video_id.c_str(), (int)position.skipped);
+            }
         }
 
 
@@ -168,7 +150,8 @@ namespace ugcs {
                     LOG_INFO("Playback process (%s): Start reading.", video_device_->playback_video_id.c_str());
                 }
 
-                res = video_device_->get_frame(&encoded_buffer, encoded_buffer_size);
+                encoded_frame::Ptr frame;
+                res = video_device_->get_frame(video_cursor, frame);
 
                 if (res) {
                     // set frame time
@@ -14,7 +14,6 @@ namespace ugcs {
 
 
         ffmpeg_save_flv::ffmpeg_save_flv() {
-            this->frame = new video_frame();
             this->flv_packet = new AVPacket();
             this->save_done = true;
             this->stop_init = false;
@@ -113,8 +112,8 @@ namespace ugcs {
             this->is_running = true;
             while (is_running) {
                 // notification will come from video_device when new frame appears.
-                std::unique_lock<std::mutex> lock(this->frame->video_mutex_);
-                this->frame->video_condition_.wait(lock);
+                std::unique_lock<std::mutex> lock(this->frame_mutex_);
+                this->frame_condition_.wait(lock);
                 if (is_running) {
                     this->save_frame();
                 }
@@ -203,25 +202,26 @@ namespace ugcs {
             }
             save_done = false;
 
-            AVPacket *t_flv_packet = new AVPacket();
-
-            t_flv_packet->data=NULL;
-            t_flv_packet->size=0;
+            encoded_frame::Ptr current_frame = get_current_frame();
+            if (!current_frame) {
+                save_done = true;
+                return false;
+            }
 
-            av_packet_from_data(t_flv_packet, frame->encoded_buffer, frame->encoded_buffer_size);
+            // packet references frame data, no copying
+            AVPacket t_flv_packet;
+            current_frame->fill_packet(&t_flv_packet);
 
-            t_flv_packet->flags=1;
+            t_flv_packet.flags=1;
             // set ts;
-            t_flv_packet->dts = frame->ts;
-            t_flv_packet->pts = frame->ts;
+            t_flv_packet.dts = current_frame->get_ts();
+            t_flv_packet.pts = current_frame->get_ts();
 
-            av_write_frame (flv_format_context, t_flv_packet);
+            av_write_frame (flv_format_context, &t_flv_packet);
 
             set_outer_stream_state(VSTR_OST_STATE_RUNNING, "");
 
-            t_flv_packet->data=NULL;
-            t_flv_packet->size=0;
-            delete t_flv_packet;
+            av_free_packet(&t_flv_packet);
 
             save_done = true;
             return true;
@@ -241,7 +241,7 @@ namespace ugcs {
             LOG_INFO("Stopping video broadcasting process (%s)", this->output_filename.c_str());
             if (this->is_running) {
                 this->is_running = false;
-                this->frame->video_condition_.notify_all();
+                this->frame_condition_.notify_all();
                 LOG_INFO("Stopping video broadcasting process, closing frames (%s)", this->output_filename.c_str());
                 // wait until run-loop stop
                 std::unique_lock<std::mutex> lock(this->stopping_mutex_);
@@ -10,13 +10,43 @@
 #include <ugcs/vstreamer/common.h>
 #include "ugcs/vstreamer/ffmpeg_save_mjpeg.h"
 
+#include <cstdio>
+
 namespace ugcs {
 
     namespace vstreamer {
 
+        /** file written by muxer in whole blocks */
+        struct ffmpeg_save_mjpeg::block_output {
+            FILE *file;
+            std::shared_ptr<recording_writer::session> session;
+        };
+
+
+        namespace {
+            /** AVIOContext write callback, called with full block (the last one may be shorter) */
+            int write_block(void *opaque, uint8_t *data, int size) {
+                ffmpeg_save_mjpeg::block_output *output = (ffmpeg_save_mjpeg::block_output *)opaque;
+                int64_t start_us = utils::getMicroseconds();
+                size_t written = fwrite(data, 1, size, output->file);
+                if (output->session) {
+                    output->session->block_written(written, utils::getMicroseconds() - start_us);
+                }
+                return written == (size_t)size ? size : -1;
+            }
+
+            FILE* open_unbuffered(const std::string &filename) {
+                FILE *file = fopen(filename.c_str(), "wb");
+                if (file) {
+                    // muxer output is already collected in blocks
+                    setvbuf(file, NULL, _IONBF, 0);
+                }
+                return file;
+            }
+        }
+
 
         ffmpeg_save_mjpeg::ffmpeg_save_mjpeg() {
-            frame = new video_frame();
             this->request_ts = -1;
             this->is_initialized = false;
             this->is_running = false;
@@ -27,6 +57,17 @@ namespace ugcs {
             this->mjpeg_codec = NULL;
             this->mjpeg_codec_context = NULL;
             this->first_frame_ts = 0;
+            this->last_saved_ts = -1;
+            this->width = 0;
+            this->height = 0;
+            this->segment_max_ms = 0;
+            this->segment_max_bytes = 0;
+            this->segment_frames = 0;
+            this->output = NULL;
+            this->segment_offset = 0;
+            this->flush_ms = RECORDING_DEFAULT_FLUSH_MS;
+            this->last_flush_ts = -1;
+            this->last_pts = -1;
 
             // on avlibcodec 54 and 53 (linux) we cannot create MJPEG encoder for pix_fmt=AV_PIX_FMT_YUV420P, so
             // we need to use AV_PIX_FMT_YUVJ420P. But in versions 55+ this format is deprecated. So on, in version
@@ -59,7 +100,19 @@ namespace ugcs {
 
             this->type = type;
             this->first_frame_ts = -1;
+            this->last_saved_ts = -1;
             this->request_ts = request_ts;
+            this->folder = folder;
+            this->session_name = session_name;
+            this->width = width;
+            this->height = height;
+            this->segment_frames = 0;
+            this->segment_offset = 0;
+            this->segment_max_ms = (int64_t)utils::getPositiveIntProperty("vstreamer.recording.segment_minutes", 0) * 60 * 1000;
+            this->segment_max_bytes = (int64_t)utils::getPositiveIntProperty("vstreamer.recording.segment_mb", 0) * 1024 * 1024;
+            this->flush_ms = utils::getPositiveIntProperty("vstreamer.recording.flush_ms", RECORDING_DEFAULT_FLUSH_MS);
+            this->last_flush_ts = -1;
+            this->last_pts = -1;
 
             // register all ffmpeg modules
             av_register_all();
@@ -73,51 +126,73 @@ namespace ugcs {
                 return false;
             }
 
+            // segmented session is written to numbered files listed in manifest,
+            // metadata keeps the name of single file session
+            std::string filename = this->output_filename;
+            manifest.segments.clear();
+            if (segment_max_ms > 0 || segment_max_bytes > 0) {
+                recording_manifest::segment first;
+                first.file = recording_manifest::get_segment_file(session_name, 1);
+                first.start_ms = 0;
+                first.end_ms = -1;
+                first.bytes = 0;
+                manifest.segments.push_back(first);
+                manifest_filename = recording_manifest::get_filename(folder, session_name);
+                filename = recording_manifest::get_path(folder, first.file);
+                if (!manifest.save(manifest_filename)) {
+                    LOG_ERR("Save Session (%s): Cannot write manifest %s.", session_name.c_str(), manifest_filename.c_str());
+                    return false;
+                }
+            }
+
             // init mjpeg
-            LOG_DEBUG("MJPEG Initiation for saving process (%s)", this->output_filename.c_str());
-            res = init_mjpeg(session_name, width, height);
+            LOG_DEBUG("MJPEG Initiation for saving process (%s)", filename.c_str());
+            res = init_mjpeg(session_name, filename, width, height);
             if (!res) {
                 return false;
             }
             LOG_DEBUG("MJPEG init done! Starting saving process (%s)", this->output_filename.c_str());
 
-            std::thread t(&ffmpeg_save_mjpeg::run, this);
-            t.detach();
+            this->is_initialized = true;
+            this->run();
 
             LOG_DEBUG("Saving process is started (%s)", this->output_filename.c_str());
 
-            this->is_initialized = true;
-
             return true;
         }
 
 
         void ffmpeg_save_mjpeg::run() {
             std::string metadata_filename = this->output_filename + "." + VSTR_RECORDING_VIDEO_METADATA_EXTENSION;
-            if (this->metadata_file.is_open()) {
-                this->metadata_file.close();
+            metadata.duration_ms = 0;
+            metadata.frame_count = 0;
+            metadata.width = width;
+            metadata.height = height;
+            metadata.codec = "mjpeg";
+            metadata.index_offset = 0;
+            metadata.preroll_ms = 0;
+            metadata.open(metadata_filename);
+
+            // frames are written on recording writer thread, video device only queues them
+            std::atomic_store(&writer_session, recording_writer::get_instance()->open_session(this->output_filename,
+                [this](const encoded_frame::Ptr &frame) { this->save_frame(frame); }));
+            if (output) {
+                output->session = writer_session;
             }
+            this->is_running = true;
+        }
 
-            this->metadata_file.open(metadata_filename, std::ios::out);
 
-            this->is_running = true;
-            while (this->is_running) {
-                std::unique_lock<std::mutex> lock(this->frame->video_mutex_);
-                // notification will come from video_device when new frame appears.
-                this->frame->video_condition_.wait(lock);
-                if (this->is_running) {
-                    this->save_frame();
-                }
+        void ffmpeg_save_mjpeg::add_frame(const encoded_frame::Ptr &frame) {
+            base_save::add_frame(frame);
+            std::shared_ptr<recording_writer::session> current_session = std::atomic_load(&writer_session);
+            if (this->is_running && current_session) {
+                current_session->push(frame);
             }
-            this->metadata_file.close();
-            VS_WAIT(500);
-            // notify everybody about finishing run-loop
-            this->stopping_condition_.notify_all();
-
         }
 
 
-        bool ffmpeg_save_mjpeg::init_mjpeg(std::string session_name, int width, int height) {
+        bool ffmpeg_save_mjpeg::init_mjpeg(std::string session_name, std::string filename, int width, int height) {
 
             // find the mjpeg video encoder (for output or encoding)
 #if (LIBAVCODEC_VERSION_MAJOR < 54)
@@ -138,10 +213,10 @@ namespace ugcs {
 
             mjpeg_format_context = NULL;
             if (this->type == VSTR_SAVE_FILE) {
-                //avformat_alloc_output_context2(&mjpeg_format_context, NULL, NULL, output_filename.c_str());
+                //avformat_alloc_output_context2(&mjpeg_format_context, NULL, NULL, filename.c_str());
                 mjpeg_format_context = avformat_alloc_context();
-                //avformat_alloc_output_context2(&flv_format_context, NULL, NULL, output_filename.c_str());
-                mjpeg_fmt = av_guess_format("mpg", output_filename.c_str(), NULL);
+                //avformat_alloc_output_context2(&flv_format_context, NULL, NULL, filename.c_str());
+                mjpeg_fmt = av_guess_format("mp4", NULL, NULL);
                 mjpeg_format_context->oformat = mjpeg_fmt;
             } else {
                 // not implemented
@@ -177,16 +252,21 @@ namespace ugcs {
 
             // if we save to file add headers and flags
             if (this->type == VSTR_SAVE_FILE) {
-                av_dump_format(mjpeg_format_context, 0, output_filename.c_str(), 1);
-                int ret = avio_open(&mjpeg_format_context->pb, output_filename.c_str(), AVIO_FLAG_WRITE );
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_ERROR, "Could not open output file '%s'", output_filename.c_str());
+                av_dump_format(mjpeg_format_context, 0, filename.c_str(), 1);
+                if (!open_output(filename)) {
+                    av_log(NULL, AV_LOG_ERROR, "Could not open output file '%s'", filename.c_str());
                     return false;
                 }
 
                 av_dict_set(&mjpeg_format_context->metadata, "test", "123456", 0);
 
-                ret = avformat_write_header(mjpeg_format_context, NULL);
+                // fragmented MP4: empty moov in header, every fragment (moof) indexes its own
+                // frames with offsets from its own start, so file is playable and seekable up
+                // to the last flushed fragment. Fragments are cut by flush_fragment().
+                AVDictionary *options = NULL;
+                av_dict_set(&options, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+                int ret = avformat_write_header(mjpeg_format_context, &options);
+                av_dict_free(&options);
                 if (ret < 0) {
                     av_log(NULL, AV_LOG_ERROR, "Error occurred when opening output file\n");
                     return false;
@@ -201,42 +281,55 @@ namespace ugcs {
 
 
         bool ffmpeg_save_mjpeg::save_frame() {
+            return save_frame(get_current_frame());
+        }
+
+
+        bool ffmpeg_save_mjpeg::save_frame(const encoded_frame::Ptr &current_frame) {
 
 #if (LIBAVCODEC_VERSION_MAJOR >= 54)
 
-            AVPacket *t_mjpg_packet = new AVPacket();
-            t_mjpg_packet->data=NULL;
+            if (!current_frame) {
+                return false;
+            }
 
-            ffmpeg_utils::packet_from_data(t_mjpg_packet, frame->encoded_buffer, frame->encoded_buffer_size);
+            if (first_frame_ts < 0 && !preroll_frames.empty()) {
+                // recording starts with frames captured before request, live frames continue their timeline
+                first_frame_ts = preroll_frames.front()->get_ts();
+                LOG_INFO("Save Session (%s): %d pre-roll frames (%d ms).", this->output_filename.c_str(),
+                         (int)preroll_frames.size(), (int)(request_ts - first_frame_ts));
+                // recording time of request, players start live part from it
+                metadata.preroll_ms = request_ts > first_frame_ts ? request_ts - first_frame_ts : 0;
+                for (auto iter = preroll_frames.begin(); iter != preroll_frames.end(); ++iter) {
+                    write_frame(*iter);
+                }
+                std::vector<encoded_frame::Ptr> tmp;
+                preroll_frames.swap(tmp);
+            }
+            if (current_frame->get_ts() <= last_saved_ts) {
+                // already saved with pre-roll
+                return true;
+            }
 
             if (first_frame_ts < 0) {
                 // this is the first frame. Let's decide what to do. If this frame is close enough to
                 // real request time, lets save it twice. First time with request ts and second time
                 // with current ts. Else if frame is far from request time - let's create dummy first frame
                 // with request ts.
-                if (frame->ts - request_ts < DUMMY_FRAME_MAXIMUM_LAG_TIME) {
-                    t_mjpg_packet->dts = 0;
-                    t_mjpg_packet->pts = 0;
-                    t_mjpg_packet->flags = 1;
-                    av_write_frame (mjpeg_format_context, t_mjpg_packet);
+                if (current_frame->get_ts() - request_ts < DUMMY_FRAME_MAXIMUM_LAG_TIME) {
+                    // packet references frame data, no copying
+                    AVPacket t_mjpg_packet;
+                    current_frame->fill_packet(&t_mjpg_packet);
+                    write_packet(&t_mjpg_packet, 0);
+                    av_free_packet(&t_mjpg_packet);
+                    segment_frames++;
                 } else {
                     this->save_dummy_frame(request_ts);
                 }
                 first_frame_ts = request_ts;
             }
 
-            t_mjpg_packet->dts = frame->ts - first_frame_ts;
-            t_mjpg_packet->pts = frame->ts - first_frame_ts;
-            t_mjpg_packet->flags = 1;
-
-            av_write_frame (mjpeg_format_context, t_mjpg_packet);
-            t_mjpg_packet->size=0;
-            t_mjpg_packet->data=NULL;
-            delete t_mjpg_packet;
-
-             // save duration
-            metadata_file.seekg(0, std::ios::beg);
-            metadata_file << this->get_recording_duration();
+            write_frame(current_frame);
 
             return true;
 #else
@@ -245,6 +338,183 @@ namespace ugcs {
         }
 
 
+        void ffmpeg_save_mjpeg::write_frame(const encoded_frame::Ptr &frame) {
+            if (!manifest.segments.empty() && segment_frames > 0) {
+                // segment is finished before the frame which doesn't fit, so no frame is lost
+                int64_t duration = frame->get_ts() - first_frame_ts - manifest.segments.back().start_ms;
+                int64_t bytes = mjpeg_format_context ? avio_tell(mjpeg_format_context->pb) - segment_offset : 0;
+                if ((segment_max_ms > 0 && duration >= segment_max_ms) ||
+                    (segment_max_bytes > 0 && bytes + frame->get_size() > segment_max_bytes)) {
+                    rotate_segment(frame->get_ts());
+                }
+            }
+            if (!mjpeg_format_context) {
+                // next segment could not be opened
+                return;
+            }
+            // packet references frame data, no copying
+            AVPacket t_mjpg_packet;
+            frame->fill_packet(&t_mjpg_packet);
+            write_packet(&t_mjpg_packet, frame->get_ts() - first_frame_ts);
+            av_free_packet(&t_mjpg_packet);
+            last_saved_ts = frame->get_ts();
+            segment_frames++;
+            // kept in memory, metadata file is updated once a period
+            metadata.frame_written(last_saved_ts - first_frame_ts);
+
+            if (last_flush_ts < 0) {
+                last_flush_ts = last_saved_ts;
+            } else if (last_saved_ts - last_flush_ts >= flush_ms) {
+                flush_fragment();
+                last_flush_ts = last_saved_ts;
+            }
+        }
+
+
+        void ffmpeg_save_mjpeg::write_packet(AVPacket *packet, int64_t ms) {
+            // muxer chooses stream time base, timestamps are milliseconds from recording start
+            int64_t pts = av_rescale_q(ms, (AVRational){1, 1000}, mjpeg_stream->time_base);
+            if (pts <= last_pts) {
+                // MP4 needs increasing timestamps, frame may come earlier than recording request
+                pts = last_pts + 1;
+            }
+            packet->pts = pts;
+            packet->dts = pts;
+            packet->flags = 1;
+            av_write_frame(mjpeg_format_context, packet);
+            last_pts = pts;
+        }
+
+
+        void ffmpeg_save_mjpeg::flush_fragment() {
+            // write buffered frames as a fragment and pass it to the file. The block is cut here, so
+            // shorter period means less data lost on crash but more and smaller (partial) writes
+            av_write_frame(mjpeg_format_context, NULL);
+            avio_flush(mjpeg_format_context->pb);
+            metadata.save();
+        }
+
+
+        void ffmpeg_save_mjpeg::rotate_segment(int64_t ts) {
+            // the same muxer writes the whole session, only its file is switched between
+            // fragments. The first segment starts with header (ftyp, moov), the last one ends
+            // with index (mfra), so segments joined byte by byte are one fragmented MP4 and
+            // offsets in its index are offsets in joined segments.
+            flush_fragment();
+            last_flush_ts = last_saved_ts;
+            update_manifest(last_saved_ts - first_frame_ts);
+
+            recording_manifest::segment next;
+            next.file = recording_manifest::get_segment_file(session_name, (int)manifest.segments.size() + 1);
+            next.start_ms = ts - first_frame_ts;
+            next.end_ms = -1;
+            next.bytes = 0;
+
+            std::string filename = recording_manifest::get_path(folder, next.file);
+            LOG_INFO("Save Session (%s): next segment %s.", session_name.c_str(), filename.c_str());
+            FILE *file = open_unbuffered(filename);
+            if (!file) {
+                LOG_ERR("Save Session (%s): Cannot open segment %s, recording is stopped.", session_name.c_str(), filename.c_str());
+                // index is written to current segment, it stays the last one
+                close_output();
+                manifest.save(manifest_filename);
+                return;
+            }
+            segment_offset = avio_tell(mjpeg_format_context->pb);
+            fclose(output->file);
+            output->file = file;
+            manifest.segments.push_back(next);
+            segment_frames = 0;
+            manifest.save(manifest_filename);
+        }
+
+
+        void ffmpeg_save_mjpeg::close_output() {
+            if (!mjpeg_format_context) {
+                return;
+            }
+            flush_fragment();
+            // trailer is fragment index (mfra) of the whole session, offset in joined segments
+            metadata.index_offset = avio_tell(mjpeg_format_context->pb);
+            av_write_trailer(mjpeg_format_context);
+            if (!manifest.segments.empty()) {
+                manifest.segments.back().bytes = avio_tell(mjpeg_format_context->pb) - segment_offset;
+            }
+            avcodec_close(mjpeg_codec_context);
+            mjpeg_codec_context = NULL;
+            close_file();
+            avformat_close_input(&mjpeg_format_context);
+        }
+
+
+        bool ffmpeg_save_mjpeg::open_output(const std::string &filename) {
+            FILE *file = open_unbuffered(filename);
+            if (!file) {
+                return false;
+            }
+            int block_size = recording_writer::get_instance()->get_write_block_size();
+            unsigned char *buffer = (unsigned char *)av_malloc(block_size);
+            if (!buffer) {
+                fclose(file);
+                return false;
+            }
+            output = new block_output();
+            output->file = file;
+            output->session = writer_session;
+            AVIOContext *pb = avio_alloc_context(buffer, block_size, 1, output, NULL, write_block, NULL);
+            if (!pb) {
+                av_free(buffer);
+                fclose(file);
+                delete output;
+                output = NULL;
+                return false;
+            }
+            // blocks are written one after another, fragmented MP4 doesn't seek back
+            pb->seekable = 0;
+            mjpeg_format_context->pb = pb;
+            mjpeg_format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+            // default (-1 since ffmpeg 3) flushes custom I/O after every packet, which would
+            // write each frame separately; buffer is flushed when it's full or by flush_fragment()
+#ifdef AVFMT_FLAG_FLUSH_PACKETS
+            mjpeg_format_context->flags &= ~AVFMT_FLAG_FLUSH_PACKETS;
+#endif
+#if (LIBAVFORMAT_VERSION_MICRO >= 100) && (LIBAVFORMAT_VERSION_INT >= ((54<<16)+(63<<8)+100))
+            mjpeg_format_context->flush_packets = 0;
+#endif
+            return true;
+        }
+
+
+        void ffmpeg_save_mjpeg::close_file() {
+            AVIOContext *pb = mjpeg_format_context->pb;
+            if (pb) {
+                avio_flush(pb);
+                av_freep(&pb->buffer);
+                av_free(pb);
+                mjpeg_format_context->pb = NULL;
+            }
+            if (output) {
+                fclose(output->file);
+                delete output;
+                output = NULL;
+            }
+        }
+
+
+        void ffmpeg_save_mjpeg::update_manifest(int64_t end_ms) {
+            if (manifest.segments.empty()) {
+                return;
+            }
+            recording_manifest::segment &current = manifest.segments.back();
+            current.end_ms = end_ms;
+            if (mjpeg_format_context) {
+                // size of closed output is set by close_output()
+                current.bytes = avio_tell(mjpeg_format_context->pb) - segment_offset;
+            }
+            manifest.save(manifest_filename);
+        }
+
+
         bool ffmpeg_save_mjpeg::save_dummy_frame(int64_t ts) {
 
 // win & mac only
@@ -291,10 +561,7 @@ namespace ugcs {
                 return false;
             }
 
-            t_mjpg_packet.dts = 0;
-            t_mjpg_packet.pts = 0;
-            t_mjpg_packet.flags = 1;
-            av_write_frame (mjpeg_format_context, &t_mjpg_packet);
+            write_packet(&t_mjpg_packet, 0);
             av_free_packet(&t_mjpg_packet);
             av_free(black_frame);
             LOG_DEBUG("Black frame was successfully created");
@@ -327,16 +594,11 @@ namespace ugcs {
         void ffmpeg_save_mjpeg::close(){
             LOG_INFO("Stopping video recording process (%s)", this->output_filename.c_str());
             if (this->is_running) {
-                //stop waiting in run-loop without saving frame
-
                 this->is_running = false;
-                this->frame->video_condition_.notify_all();
 
-                LOG_INFO("Stopping video recording process, close files (%s)", this->output_filename.c_str());
-                // wait until run-loop stop
-                std::unique_lock<std::mutex> lock(this->stopping_mutex_);
-                // notification will come from video_device when run-loop stops
-                this->stopping_condition_.wait(lock);
+                LOG_INFO("Stopping video recording process, write queued frames (%s)", this->output_filename.c_str());
+                // returns when frames queued so far are written
+                recording_writer::get_instance()->close_session(writer_session);
             } else {
                 LOG_INFO("Stopping video recording process, recording is not active (%s)", this->output_filename.c_str());
             }
@@ -344,21 +606,35 @@ namespace ugcs {
             if (this->is_initialized) {
                 LOG_INFO("Stopping video recording process, free codec resources (%s)", this->output_filename.c_str());
                 // free ffmpeg resources
-                av_write_trailer(mjpeg_format_context);
-
-                avcodec_close(mjpeg_codec_context);
-                avformat_close_input(&mjpeg_format_context);
+                close_output();
+                // with final size of the last segment, which ends with index
+                update_manifest(last_saved_ts >= 0 ? last_saved_ts - first_frame_ts : 0);
                 this->is_initialized = false;
 
             } else {
                 LOG_INFO("Video recording process (%s) has not been initialized", this->output_filename.c_str());
             }
+            // after output is closed, so metadata has final duration and index
+            this->metadata.close();
+            std::atomic_store(&writer_session, std::shared_ptr<recording_writer::session>());
             LOG_INFO("Video recording process (%s) is succesfully stopped", this->output_filename.c_str());
         }
 
 
         int64_t ffmpeg_save_mjpeg::get_recording_duration() {
-            return this->frame->ts - this->first_frame_ts;
+            encoded_frame::Ptr current_frame = get_current_frame();
+            if (!current_frame || this->first_frame_ts < 0) {
+                return 0;
+            }
+            return current_frame->get_ts() - this->first_frame_ts;
+        }
+
+
+        void ffmpeg_save_mjpeg::get_stats(Json::Value &stats) {
+            std::shared_ptr<recording_writer::session> current_session = std::atomic_load(&writer_session);
+            if (current_session) {
+                current_session->get_stats(stats);
+            }
         }
 
 
@@ -62,6 +62,121 @@ namespace ugcs {
 #endif
             }
 
+
+            int jpeg_dht_insert_position(const uint8_t *data, int size) {
+                // picture should start with SOI
+                if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+                    return -1;
+                }
+                int pos = 2;
+                while (pos + 4 <= size) {
+                    if (data[pos] != 0xFF) {
+                        return -1;
+                    }
+                    uint8_t marker = data[pos + 1];
+                    if (marker == 0xFF) {
+                        // fill byte
+                        pos++;
+                        continue;
+                    }
+                    if (marker == 0xC4) {
+                        // tables are present
+                        return -1;
+                    }
+                    if (marker == 0xDA) {
+                        // start of scan, tables must be placed before it
+                        return pos;
+                    }
+                    int length = (data[pos + 2] << 8) | data[pos + 3];
+                    if (length < 2) {
+                        return -1;
+                    }
+                    pos += 2 + length;
+                }
+                return -1;
+            }
+
+
+            const std::vector<uint8_t>& jpeg_default_dht_segment() {
+                static const uint8_t bits_dc_luminance[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+                static const uint8_t bits_dc_chrominance[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+                static const uint8_t val_dc[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+                static const uint8_t bits_ac_luminance[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+                static const uint8_t val_ac_luminance[162] = {
+                    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+                    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+                    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+                    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+                    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+                    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+                    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+                    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+                    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+                    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+                    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+                    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+                    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+                    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+                    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+                    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+                    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+                    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+                    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+                    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+                    0xf9, 0xfa
+                };
+
+                static const uint8_t bits_ac_chrominance[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+                static const uint8_t val_ac_chrominance[162] = {
+                    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+                    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+                    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+                    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+                    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+                    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+                    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+                    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+                    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+                    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+                    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+                    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+                    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+                    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+                    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+                    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+                    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+                    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+                    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+                    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+                    0xf9, 0xfa
+                };
+
+                struct table_builder {
+                    static void add(std::vector<uint8_t> &segment, uint8_t table_class_id,
+                                    const uint8_t *bits, const uint8_t *values, size_t values_count) {
+                        segment.push_back(table_class_id);
+                        segment.insert(segment.end(), bits, bits + 16);
+                        segment.insert(segment.end(), values, values + values_count);
+                    }
+                    static std::vector<uint8_t> build() {
+                        std::vector<uint8_t> segment = { 0xFF, 0xC4, 0, 0 };
+                        add(segment, 0x00, bits_dc_luminance, val_dc, sizeof(val_dc));
+                        add(segment, 0x10, bits_ac_luminance, val_ac_luminance, sizeof(val_ac_luminance));
+                        add(segment, 0x01, bits_dc_chrominance, val_dc, sizeof(val_dc));
+                        add(segment, 0x11, bits_ac_chrominance, val_ac_chrominance, sizeof(val_ac_chrominance));
+                        // segment length excludes marker
+                        size_t length = segment.size() - 2;
+                        segment[2] = (uint8_t)(length >> 8);
+                        segment[3] = (uint8_t)(length & 0xFF);
+                        return segment;
+                    }
+                };
+
+                static const std::vector<uint8_t> segment = table_builder::build();
+                return segment;
+            }
+
         }
     }
 }
\ No newline at end of file
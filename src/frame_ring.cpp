@@ -0,0 +1,165 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file frame_ring.cpp
+*/
+
+#include "ugcs/vstreamer/frame_ring.h"
+
+#include <chrono>
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+
+        frame_ring::frame_ring(int capacity) {
+            this->slots.resize(capacity > 0 ? capacity : 1);
+            this->head = 0;
+            this->subscribers = 0;
+            this->delivered = 0;
+            this->dropped = 0;
+        }
+
+
+        void frame_ring::publish(const encoded_frame::Ptr &frame) {
+            int64_t seq = frame->get_seq();
+            std::atomic_store(&slots[seq % slots.size()], frame);
+            head.store(seq + 1, std::memory_order_release);
+            {
+                // consumer checks head under this lock, so wake up is not lost
+                std::lock_guard<std::mutex> lock(wait_mutex);
+            }
+            wait_condition.notify_all();
+
+            std::shared_ptr<const listener_list> current_listeners = std::atomic_load(&listeners);
+            if (current_listeners) {
+                for (auto iter = current_listeners->begin(); iter != current_listeners->end(); ++iter) {
+                    (*iter)();
+                }
+            }
+        }
+
+
+        void frame_ring::add_listener(const std::function<void()> &listener) {
+            std::lock_guard<std::mutex> lock(listeners_mutex);
+            std::shared_ptr<listener_list> updated = std::make_shared<listener_list>();
+            std::shared_ptr<const listener_list> current_listeners = std::atomic_load(&listeners);
+            if (current_listeners) {
+                *updated = *current_listeners;
+            }
+            updated->push_back(listener);
+            std::atomic_store(&listeners, std::shared_ptr<const listener_list>(updated));
+        }
+
+
+        frame_ring::cursor frame_ring::make_cursor() {
+            cursor position;
+            position.next_seq = head.load(std::memory_order_acquire);
+            return position;
+        }
+
+
+        bool frame_ring::read_next(cursor &position, encoded_frame::Ptr &frame) {
+            for (;;) {
+                int64_t current_head = head.load(std::memory_order_acquire);
+                if (position.next_seq >= current_head) {
+                    return false;
+                }
+                int64_t oldest = current_head - (int64_t)slots.size();
+                if (position.next_seq < oldest) {
+                    position.skipped += oldest - position.next_seq;
+                    position.next_seq = oldest;
+                }
+                encoded_frame::Ptr slot_frame = std::atomic_load(&slots[position.next_seq % slots.size()]);
+                if (slot_frame && slot_frame->get_seq() == position.next_seq) {
+                    frame = slot_frame;
+                    position.next_seq++;
+                    return true;
+                }
+                // slot was overwritten by producer after head was read
+            }
+        }
+
+
+        bool frame_ring::read_latest(cursor &position, encoded_frame::Ptr &frame) {
+            for (;;) {
+                int64_t current_head = head.load(std::memory_order_acquire);
+                if (position.next_seq >= current_head) {
+                    return false;
+                }
+                int64_t latest = current_head - 1;
+                encoded_frame::Ptr slot_frame = std::atomic_load(&slots[latest % slots.size()]);
+                if (slot_frame && slot_frame->get_seq() == latest) {
+                    frame = slot_frame;
+                    position.skipped += latest - position.next_seq;
+                    position.next_seq = latest + 1;
+                    return true;
+                }
+            }
+        }
+
+
+        encoded_frame::Ptr frame_ring::get_latest() {
+            cursor position;
+            encoded_frame::Ptr frame;
+            read_latest(position, frame);
+            return frame;
+        }
+
+
+        bool frame_ring::wait(const cursor &position, int timeout_ms) {
+            if (head.load(std::memory_order_acquire) > position.next_seq) {
+                return true;
+            }
+            std::unique_lock<std::mutex> lock(wait_mutex);
+            return wait_condition.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] {
+                return head.load(std::memory_order_acquire) > position.next_seq;
+            });
+        }
+
+
+        int frame_ring::get_capacity() {
+            return (int)slots.size();
+        }
+
+
+        int64_t frame_ring::get_published_count() {
+            return head.load(std::memory_order_acquire);
+        }
+
+
+        void frame_ring::add_subscriber() {
+            subscribers++;
+        }
+
+
+        void frame_ring::remove_subscriber() {
+            subscribers--;
+        }
+
+
+        int frame_ring::get_subscriber_count() {
+            return subscribers;
+        }
+
+
+        void frame_ring::count_delivery(int64_t delivered, int64_t dropped) {
+            this->delivered += delivered;
+            this->dropped += dropped;
+        }
+
+
+        int64_t frame_ring::get_delivered_count() {
+            return delivered;
+        }
+
+
+        int64_t frame_ring::get_dropped_count() {
+            return dropped;
+        }
+
+    }
+}
@@ -8,11 +8,6 @@
 #include "ugcs/vstreamer/http_generic_server.h"
 
 
-template<typename T>
-inline T min(T a, T b) {
-	return (a < b ? a : b);
-}
-
 namespace ugcs {
 
 namespace vstreamer {
@@ -20,6 +15,8 @@ namespace vstreamer {
 	HttpGenericServer::HttpGenericServer(int port) :
 		stop_requested_(false), port_(port) {
 		sd_len = 0;
+		for (int i = 0; i < MAX_NUM_SOCKETS; i++)
+			sd[i] = (sockets::Socket_handle) -1;
 	}
 
 	HttpGenericServer::~HttpGenericServer() {
@@ -148,8 +145,6 @@ namespace vstreamer {
 						if (sockets::Disable_sigpipe(fd) < 0) {
 							LOG_ERROR("HttpServer (%d): set nonblocking fd failed ", port_);
 						}
-						/* start new thread that will handle this TCP connected client */
-
 						if (getnameinfo((struct sockaddr *) &client_addr, addr_len,
 										name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
 							LOG("HttpServer (%d): Serving client %s", port_, name);
@@ -158,8 +153,7 @@ namespace vstreamer {
 							sd[i] = (sockets::Socket_handle) -1;
 							break;
 						}
-						std::thread trr(std::bind(&HttpGenericServer::client, this, fd));
-						trr.detach();
+						dispatchClient(fd);
 					}
 				}
 			}
@@ -171,101 +165,12 @@ namespace vstreamer {
 	}
 
 
-		void HttpGenericServer::initIOBuffer(iobuffer *iobuf) {
-			memset(iobuf->buffer, 0, sizeof(iobuf->buffer));
-			iobuf->level = 0;
-		}
-
-		void HttpGenericServer::initRequest(request *req) {
-			req->type = A_UNKNOWN;
-			req->type = A_UNKNOWN;
-			req->parameter = NULL;
-			req->client = NULL;
-			req->credentials = NULL;
+		void HttpGenericServer::dispatchClient(sockets::Socket_handle fd) {
+			/* start new thread that will handle this TCP connected client */
+			std::thread trr(std::bind(&HttpGenericServer::client, this, fd));
+			trr.detach();
 		}
 
-		void HttpGenericServer::freeRequest(request *req) {
-			if (req->parameter != NULL)
-				free(req->parameter);
-			if (req->client != NULL)
-				free(req->client);
-			if (req->credentials != NULL)
-				free(req->credentials);
-		}
-
-		int HttpGenericServer::readWithTimeout(sockets::Socket_handle& fd, iobuffer *iobuf, char *buffer,
-			size_t len, int timeout) {
-			size_t copied = 0;
-			int rc, i;
-			fd_set fds;
-			struct timeval tv;
-
-			memset(buffer, 0, len);
-
-			while ((copied < len)) {
-				i = min((size_t)iobuf->level, len - copied);
-				memcpy(buffer + copied, iobuf->buffer + IO_BUFFER - iobuf->level, (size_t) i);
-
-				iobuf->level -= i;
-				copied += i;
-				if (copied >= len)
-					return copied;
-
-				/* select will return in case of timeout or new data arrived */
-				tv.tv_sec = timeout;
-				tv.tv_usec = 0;
-				FD_ZERO(&fds);
-				FD_SET(fd, &fds);
-				if ((rc = select(fd + 1, &fds, NULL, NULL, &tv)) <= 0) {
-					if (rc < 0)
-						exit(EXIT_FAILURE);
-
-					/* this must be a timeout */
-					return copied;
-				}
-
-				initIOBuffer(iobuf);
-
-				/*
-				 * there should be at least one byte, because select signalled it.
-				 * But: It may happen (very seldomly), that the socket gets closed remotly between
-				 * the select() and the following read. That is the reason for not relying
-				 * on reading at least one byte.
-				 */
-				//if ((iobuf->level = read(fd, &iobuf->buffer, IO_BUFFER)) <= 0) {
-				if ((iobuf->level = recv(fd, iobuf->buffer, IO_BUFFER, 0)) <= 0) {
-					/* an error occured */
-					LOG_ERROR("HttpServer (%d): Error while reading request", port_);
-					return -1;
-				}
-
-				/* align data to the end of the buffer if less than IO_BUFFER bytes were read */
-				memmove(iobuf->buffer + (IO_BUFFER - iobuf->level), iobuf->buffer,
-						(size_t) iobuf->level);
-			}
-
-			return 0;
-		}
-
-		int HttpGenericServer::readLineWithTimeout(sockets::Socket_handle& fd, iobuffer *iobuf, char *buffer,
-			size_t len, int timeout) {
-			char c = '\0', *out = buffer;
-			unsigned int i;
-
-			memset(buffer, 0, len);
-
-			for (i = 0; i < len && c != '\n'; i++) {
-				if (readWithTimeout(fd, iobuf, &c, 1, timeout) <= 0) {
-					/* timeout or error occured */
-					return -1;
-				}
-				*out++ = c;
-			}
-
-			return i;
-		}
-
-
         void HttpGenericServer::sendCode(sockets::Socket_handle& fd, int response_code, const char *message, std::string content_type) {
 			int ret = sockets::Send_code(fd, response_code, message, content_type);
 			if (ret < 0) {
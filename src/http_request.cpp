@@ -0,0 +1,376 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file http_request.cpp
+*/
+
+#include "ugcs/vstreamer/http_request.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <cstring>
+#include <cctype>
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        namespace {
+            bool is_space(char c) {
+                return c == ' ' || c == '\t';
+            }
+
+            /** end of line starting at position, points after '\n' */
+            size_t find_line_end(const char *data, size_t position, size_t size) {
+                const void *found = memchr(data + position, '\n', size - position);
+                return found ? (size_t)((const char *)found - data) + 1 : size;
+            }
+        }
+
+
+        http_request::http_request() {
+            this->buffer.resize(HTTP_REQUEST_BUFFER_SIZE);
+            this->data_size = 0;
+            this->scan_position = 0;
+            this->header_size = 0;
+            this->content_length = 0;
+            this->complete = false;
+        }
+
+
+        http_parse_result http_request::read(sockets::Socket_handle fd, int timeout_ms) {
+            int64_t deadline = utils::getMilliseconds() + timeout_ms;
+            for (;;) {
+                http_parse_result result = parse();
+                if (result != VSTR_HTTP_INCOMPLETE) {
+                    return result;
+                }
+
+                // make room for the rest of request
+                size_t needed = header_size > 0 ? header_size + content_length : data_size + 1;
+                if (buffer.size() < needed) {
+                    buffer.resize(needed);
+                } else if (data_size == buffer.size()) {
+                    buffer.resize(buffer.size() * 2);
+                }
+
+                int64_t remaining = deadline - utils::getMilliseconds();
+                if (remaining <= 0) {
+                    return VSTR_HTTP_CLOSED;
+                }
+                fd_set fds;
+                struct timeval tv;
+                tv.tv_sec = (long)(remaining / 1000);
+                tv.tv_usec = (long)(remaining % 1000) * 1000;
+                FD_ZERO(&fds);
+                FD_SET(fd, &fds);
+                if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0) {
+                    return VSTR_HTTP_CLOSED;
+                }
+                int received = recv(fd, &buffer[data_size], buffer.size() - data_size, 0);
+                if (received <= 0) {
+                    return VSTR_HTTP_CLOSED;
+                }
+                data_size += received;
+            }
+        }
+
+
+        http_parse_result http_request::parse() {
+            if (complete) {
+                return VSTR_HTTP_COMPLETE;
+            }
+            if (header_size == 0) {
+                if (scan_position == 0) {
+                    // empty lines before request line are ignored
+                    size_t skipped = 0;
+                    while (skipped < data_size && (buffer[skipped] == '\r' || buffer[skipped] == '\n')) {
+                        skipped++;
+                    }
+                    if (skipped > 0) {
+                        memmove(&buffer[0], &buffer[skipped], data_size - skipped);
+                        data_size -= skipped;
+                    }
+                }
+                // headers end with empty line, scan only data received since previous call
+                const char *data = &buffer[0];
+                for (size_t i = scan_position; i < data_size; i++) {
+                    if (data[i] != '\n' || i == 0) {
+                        continue;
+                    }
+                    if (data[i - 1] == '\n' || (i >= 2 && data[i - 1] == '\r' && data[i - 2] == '\n')) {
+                        header_size = i + 1;
+                        break;
+                    }
+                }
+                if (header_size == 0) {
+                    scan_position = data_size;
+                    return data_size > HTTP_MAX_HEADER_SIZE ? VSTR_HTTP_TOO_LARGE : VSTR_HTTP_INCOMPLETE;
+                }
+                if (header_size > HTTP_MAX_HEADER_SIZE) {
+                    return VSTR_HTTP_TOO_LARGE;
+                }
+                http_parse_result result = parse_head();
+                if (result != VSTR_HTTP_COMPLETE) {
+                    return result;
+                }
+            }
+            if (data_size - header_size < content_length) {
+                return VSTR_HTTP_INCOMPLETE;
+            }
+            complete = true;
+            return VSTR_HTTP_COMPLETE;
+        }
+
+
+        http_parse_result http_request::parse_head() {
+            const char *data = &buffer[0];
+
+            // request line: method SP target SP version
+            size_t line_end = find_line_end(data, 0, header_size);
+            size_t end = line_end - 1;
+            if (end > 0 && data[end - 1] == '\r') {
+                end--;
+            }
+            const char *first_space = (const char *)memchr(data, ' ', end);
+            if (first_space == NULL || first_space == data) {
+                return VSTR_HTTP_BAD_REQUEST;
+            }
+            method.offset = 0;
+            method.length = first_space - data;
+
+            size_t target_start = method.length + 1;
+            const char *second_space = (const char *)memchr(data + target_start, ' ', end - target_start);
+            if (second_space == NULL || (size_t)(second_space - data) == target_start) {
+                return VSTR_HTTP_BAD_REQUEST;
+            }
+            size_t target_end = second_space - data;
+            version.offset = target_end + 1;
+            version.length = end - version.offset;
+            if (version.length < 5 || strncmp(data + version.offset, "HTTP/", 5) != 0) {
+                return VSTR_HTTP_BAD_REQUEST;
+            }
+
+            // absolute form: skip scheme and host
+            if (data[target_start] != '/') {
+                const char *scheme_end = (const char *)memchr(data + target_start, ':', target_end - target_start);
+                if (scheme_end == NULL || target_end - (scheme_end - data) < 3 || strncmp(scheme_end, "://", 3) != 0) {
+                    return VSTR_HTTP_BAD_REQUEST;
+                }
+                size_t host_start = (scheme_end - data) + 3;
+                const char *path_start = (const char *)memchr(data + host_start, '/', target_end - host_start);
+                target_start = path_start ? (size_t)(path_start - data) : target_end;
+            }
+            const char *question = (const char *)memchr(data + target_start, '?', target_end - target_start);
+            size_t path_end = question ? (size_t)(question - data) : target_end;
+            path.offset = target_start;
+            path.length = path_end - target_start;
+            if (question) {
+                query.offset = path_end + 1;
+                query.length = target_end - query.offset;
+            }
+
+            // header fields: name ":" OWS value OWS
+            size_t position = line_end;
+            while (position < header_size) {
+                line_end = find_line_end(data, position, header_size);
+                end = line_end - 1;
+                if (end > position && data[end - 1] == '\r') {
+                    end--;
+                }
+                if (end == position) {
+                    // empty line, end of headers
+                    break;
+                }
+                if (is_space(data[position]) || headers.size() >= HTTP_MAX_HEADERS) {
+                    // folded lines are obsolete
+                    return VSTR_HTTP_BAD_REQUEST;
+                }
+                const char *colon = (const char *)memchr(data + position, ':', end - position);
+                if (colon == NULL || colon == data + position) {
+                    return VSTR_HTTP_BAD_REQUEST;
+                }
+                header_field field;
+                field.name.offset = position;
+                field.name.length = (colon - data) - position;
+                size_t value_start = (colon - data) + 1;
+                while (value_start < end && is_space(data[value_start])) {
+                    value_start++;
+                }
+                size_t value_end = end;
+                while (value_end > value_start && is_space(data[value_end - 1])) {
+                    value_end--;
+                }
+                field.value.offset = value_start;
+                field.value.length = value_end - value_start;
+                headers.push_back(field);
+                position = line_end;
+            }
+
+            if (has_header("Transfer-Encoding")) {
+                // chunked request bodies are not used by clients of this server
+                return VSTR_HTTP_BAD_REQUEST;
+            }
+            const header_field *length_field = find_header("Content-Length");
+            if (length_field != NULL) {
+                if (length_field->value.length == 0 || length_field->value.length > 9) {
+                    return length_field->value.length == 0 ? VSTR_HTTP_BAD_REQUEST : VSTR_HTTP_TOO_LARGE;
+                }
+                size_t length = 0;
+                for (size_t i = 0; i < length_field->value.length; i++) {
+                    char c = data[length_field->value.offset + i];
+                    if (c < '0' || c > '9') {
+                        return VSTR_HTTP_BAD_REQUEST;
+                    }
+                    length = length * 10 + (c - '0');
+                }
+                if (length > HTTP_MAX_BODY_SIZE) {
+                    return VSTR_HTTP_TOO_LARGE;
+                }
+                content_length = length;
+            }
+            return VSTR_HTTP_COMPLETE;
+        }
+
+
+        void http_request::consume() {
+            size_t request_size = complete ? header_size + content_length : 0;
+            if (request_size > 0) {
+                memmove(&buffer[0], &buffer[request_size], data_size - request_size);
+                data_size -= request_size;
+            }
+            if (buffer.size() > HTTP_REQUEST_BUFFER_SIZE && data_size <= HTTP_REQUEST_BUFFER_SIZE) {
+                // don't keep buffer of large request for the whole connection
+                std::vector<char>(buffer.begin(), buffer.begin() + HTTP_REQUEST_BUFFER_SIZE).swap(buffer);
+            }
+            scan_position = 0;
+            header_size = 0;
+            content_length = 0;
+            complete = false;
+            method = token();
+            path = token();
+            query = token();
+            version = token();
+            headers.clear();
+        }
+
+
+        bool http_request::has_pending_data() const {
+            size_t request_size = complete ? header_size + content_length : 0;
+            return data_size > request_size;
+        }
+
+
+        bool http_request::method_is(const char *value) const {
+            return token_equals(method, value, false);
+        }
+
+
+        std::string http_request::get_method() const {
+            return get_string(method);
+        }
+
+
+        std::string http_request::get_path() const {
+            return get_string(path);
+        }
+
+
+        bool http_request::path_is(const char *value) const {
+            return token_equals(path, value, false);
+        }
+
+
+        bool http_request::path_starts_with(const char *prefix) const {
+            size_t length = strlen(prefix);
+            return path.length >= length && memcmp(&buffer[path.offset], prefix, length) == 0;
+        }
+
+
+        std::string http_request::get_query() const {
+            return get_string(query);
+        }
+
+
+        std::string http_request::get_version() const {
+            return get_string(version);
+        }
+
+
+        std::string http_request::get_header(const char *name) const {
+            const header_field *field = find_header(name);
+            return field ? get_string(field->value) : std::string();
+        }
+
+
+        bool http_request::has_header(const char *name) const {
+            return find_header(name) != NULL;
+        }
+
+
+        bool http_request::is_keep_alive() const {
+            std::string options = get_header("Connection");
+            for (size_t i = 0; i < options.length(); i++) {
+                options[i] = (char)tolower((unsigned char)options[i]);
+            }
+            if (token_equals(version, "HTTP/1.0", false)) {
+                return options.find("keep-alive") != std::string::npos;
+            }
+            return options.find("close") == std::string::npos;
+        }
+
+
+        const char* http_request::get_body() const {
+            // request without body may end exactly at the end of buffer
+            return buffer.data() + header_size;
+        }
+
+
+        size_t http_request::get_body_length() const {
+            return content_length;
+        }
+
+
+        std::string http_request::get_body_string() const {
+            return std::string(get_body(), content_length);
+        }
+
+
+        const http_request::header_field* http_request::find_header(const char *name) const {
+            for (auto iter = headers.begin(); iter != headers.end(); ++iter) {
+                if (token_equals(iter->name, name, true)) {
+                    return &(*iter);
+                }
+            }
+            return NULL;
+        }
+
+
+        std::string http_request::get_string(const token &part) const {
+            if (part.length == 0) {
+                return std::string();
+            }
+            return std::string(&buffer[part.offset], part.length);
+        }
+
+
+        bool http_request::token_equals(const token &part, const char *value, bool ignore_case) const {
+            size_t length = strlen(value);
+            if (part.length != length) {
+                return false;
+            }
+            const char *data = &buffer[part.offset];
+            if (!ignore_case) {
+                return memcmp(data, value, length) == 0;
+            }
+            for (size_t i = 0; i < length; i++) {
+                if (tolower((unsigned char)data[i]) != tolower((unsigned char)value[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    }
+}
@@ -0,0 +1,44 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file jpeg_encoder.cpp
+*/
+
+#include "ugcs/vstreamer/jpeg_encoder.h"
+#ifdef TURBOJPEG_ENCODER
+#include "ugcs/vstreamer/turbo_jpeg_encoder.h"
+#endif
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        bool jpeg_encoder::is_available(const std::string &name) {
+            if (name == JPEG_ENCODER_FFMPEG) {
+                return true;
+            }
+#ifdef TURBOJPEG_ENCODER
+            if (name == JPEG_ENCODER_TURBOJPEG) {
+                return true;
+            }
+#endif
+            return false;
+        }
+
+
+        std::unique_ptr<jpeg_encoder> jpeg_encoder::create(const std::string &name) {
+#ifdef TURBOJPEG_ENCODER
+            if (name == JPEG_ENCODER_TURBOJPEG) {
+                std::unique_ptr<turbo_jpeg_encoder> encoder(new turbo_jpeg_encoder());
+                if (encoder->is_initialized()) {
+                    return std::unique_ptr<jpeg_encoder>(encoder.release());
+                }
+            }
+#endif
+            return std::unique_ptr<jpeg_encoder>();
+        }
+
+    }
+}
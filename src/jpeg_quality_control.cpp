@@ -0,0 +1,190 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file jpeg_quality_control.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/jpeg_quality_control.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <cmath>
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        namespace {
+            /** per device setting if present, otherwise common one */
+            int get_device_property(const std::string &name, const std::string &device_name, int default_value) {
+                return utils::getPositiveIntProperty(name + "." + device_name,
+                                                     utils::getPositiveIntProperty(name, default_value));
+            }
+        }
+
+
+        jpeg_quality_control::jpeg_quality_control() {
+            this->qmin = JPEG_QSCALE_BEST;
+            this->qmax = JPEG_QSCALE_WORST;
+            this->qscale = JPEG_QSCALE_BEST;
+            this->target_kbps = 0;
+            this->encoder_name = JPEG_ENCODER_FFMPEG;
+            this->encoder_threads = 1;
+            this->period_start = 0;
+            this->period_bytes = 0;
+            this->period_frames = 0;
+            this->period_encode_us = 0;
+            this->delivered_mark = 0;
+            this->dropped_mark = 0;
+            this->kbps = 0;
+            this->encode_ms = 0;
+            this->encoder_load_percent = 0;
+            this->drop_percent = 0;
+        }
+
+
+        void jpeg_quality_control::init(const std::string &device_name) {
+            std::lock_guard<std::mutex> lock(control_mutex);
+            qmin = get_device_property("vstreamer.mjpeg.qmin", device_name, JPEG_QSCALE_BEST);
+            qmax = get_device_property("vstreamer.mjpeg.qmax", device_name, JPEG_QSCALE_WORST);
+            if (qmin > JPEG_QSCALE_WORST) {
+                qmin = JPEG_QSCALE_WORST;
+            }
+            if (qmax > JPEG_QSCALE_WORST) {
+                qmax = JPEG_QSCALE_WORST;
+            }
+            if (qmax < qmin) {
+                qmax = qmin;
+            }
+            // 0 is default here, so absent and wrong values are both "no target"
+            auto props = ugcs::vsm::Properties::Get_instance();
+            std::string target_name = "vstreamer.mjpeg.target_kbps." + device_name;
+            if (!props->Exists(target_name)) {
+                target_name = "vstreamer.mjpeg.target_kbps";
+            }
+            target_kbps = props->Exists(target_name) ? props->Get_int(target_name) : 0;
+            if (target_kbps < 0) {
+                target_kbps = 0;
+            }
+            std::string encoder_key = "vstreamer.mjpeg.encoder." + device_name;
+            if (!props->Exists(encoder_key)) {
+                encoder_key = "vstreamer.mjpeg.encoder";
+            }
+            encoder_name = props->Exists(encoder_key) ? props->Get(encoder_key) : JPEG_ENCODER_FFMPEG;
+            if (!jpeg_encoder::is_available(encoder_name)) {
+                LOG_ERR("Video device %s: JPEG encoder \"%s\" is not available, using %s.",
+                        device_name.c_str(), encoder_name.c_str(), JPEG_ENCODER_FFMPEG);
+                encoder_name = JPEG_ENCODER_FFMPEG;
+            }
+            // start from the best quality, the first period shows the real bitrate
+            qscale = qmin;
+            period_start = 0;
+            LOG_INFO("Video device %s: MJPEG qscale %d..%d, target bitrate %d kbps, %s encoder.",
+                     device_name.c_str(), qmin, qmax, target_kbps, encoder_name.c_str());
+        }
+
+
+        void jpeg_quality_control::set_encoder_threads(int threads) {
+            std::lock_guard<std::mutex> lock(control_mutex);
+            encoder_threads = threads > 0 ? threads : 1;
+        }
+
+
+        int jpeg_quality_control::get_qscale() {
+            return qscale;
+        }
+
+
+        std::string jpeg_quality_control::get_encoder_name() {
+            std::lock_guard<std::mutex> lock(control_mutex);
+            return encoder_name;
+        }
+
+
+        void jpeg_quality_control::frame_encoded(int size, int64_t encode_us, const std::shared_ptr<frame_ring> &ring) {
+            std::lock_guard<std::mutex> lock(control_mutex);
+            int64_t now = utils::getMilliseconds();
+            if (period_start == 0) {
+                period_start = now;
+                delivered_mark = ring->get_delivered_count();
+                dropped_mark = ring->get_dropped_count();
+            }
+            period_bytes += size;
+            period_frames++;
+            period_encode_us += encode_us;
+
+            int64_t period_ms = now - period_start;
+            if (period_ms < JPEG_QUALITY_ADJUST_MS) {
+                return;
+            }
+            adjust(period_ms, ring);
+            period_start = now;
+            period_bytes = 0;
+            period_frames = 0;
+            period_encode_us = 0;
+            delivered_mark = ring->get_delivered_count();
+            dropped_mark = ring->get_dropped_count();
+        }
+
+
+        void jpeg_quality_control::adjust(int64_t period_ms, const std::shared_ptr<frame_ring> &ring) {
+            kbps = (double)period_bytes * 8 / period_ms;
+            encode_ms = (double)period_encode_us / period_frames / 1000.0;
+            encoder_load_percent = (int)(period_encode_us / 10 / period_ms / encoder_threads);
+            int64_t delivered = ring->get_delivered_count() - delivered_mark;
+            int64_t dropped = ring->get_dropped_count() - dropped_mark;
+            drop_percent = (delivered + dropped > 0) ? (int)(dropped * 100 / (delivered + dropped)) : 0;
+
+            int current = qscale;
+            int next = current;
+            if (target_kbps > 0) {
+                double deviation = kbps * 100.0 / target_kbps - 100.0;
+                if (std::fabs(deviation) > JPEG_QUALITY_BITRATE_TOLERANCE_PERCENT) {
+                    // move halfway to qscale which would give target bitrate
+                    double wanted = current * kbps / target_kbps;
+                    next = (int)std::floor((current + wanted) / 2 + 0.5);
+                    if (next == current) {
+                        next += deviation > 0 ? 1 : -1;
+                    }
+                }
+            } else if (drop_percent == 0) {
+                // without target quality returns to the best when viewers keep up
+                next = current - 1;
+            }
+            bool overloaded = drop_percent > JPEG_QUALITY_MAX_DROP_PERCENT ||
+                              encoder_load_percent > JPEG_QUALITY_MAX_ENCODER_LOAD_PERCENT;
+            if (overloaded && next <= current) {
+                next = current + 1;
+            }
+            if (next < qmin) {
+                next = qmin;
+            }
+            if (next > qmax) {
+                next = qmax;
+            }
+            if (next != current) {
+                LOG_DEBUG("MJPEG quality: qscale %d -> %d (%.0f kbps, target %d, viewers dropped %d%%, encoder load %d%%).",
+                          current, next, kbps, target_kbps, drop_percent, encoder_load_percent);
+                qscale = next;
+            }
+        }
+
+
+        void jpeg_quality_control::get_stats(Json::Value &stats) {
+            std::lock_guard<std::mutex> lock(control_mutex);
+            stats["qscale"] = (int)qscale;
+            stats["qmin"] = qmin;
+            stats["qmax"] = qmax;
+            stats["target_kbps"] = target_kbps;
+            stats["encoder"] = encoder_name;
+            stats["encoder_threads"] = encoder_threads;
+            stats["kbps"] = kbps;
+            stats["encode_ms"] = encode_ms;
+            stats["encoder_load_percent"] = encoder_load_percent;
+            stats["viewer_drop_percent"] = drop_percent;
+        }
+
+    }
+}
@@ -12,8 +12,9 @@ namespace ugcs {
 
 	namespace vstreamer {
 
-		MjpegServer::MjpegServer(int port, video_device* vd) : HttpGenericServer(port) {
+		MjpegServer::MjpegServer(int port, video_device* vd, bool listen) : HttpGenericServer(port) {
 			this->started = false;
+			this->listening = listen;
 			this->last_frame_time = 0;
 			init(vd);
 		}
@@ -27,9 +28,10 @@ namespace ugcs {
         void MjpegServer::init(video_device* vd) {
             this->video_device_ = vd;
 			this->connections_number = 0;
-			this->encoded_buffer = NULL;
-			this->encoded_buffer_size = 0;
 			this->last_connection_time = 0;
+			this->snapshot_deadline = 0;
+			this->snapshot_seq = 0;
+			this->snapshot_subscribed = false;
 
 
 			vd->port = this->port_;
@@ -37,90 +39,78 @@ namespace ugcs {
         }
 
 
-		void MjpegServer::sendStream(sockets::Socket_handle& fd) {
-			unsigned char *frame = NULL, *tmp = NULL;
-			int max_frame_size = 0;
-			int tenk = 10 * 1024;
-			char buffer[BUFFER_SIZE] = { 0 };
-			double timestamp;
+		void MjpegServer::client(sockets::Socket_handle& fd) {
+			client(fd, stream_limits(), 1);
+		}
 
-			std::string header_tmp = "Connection: close\r\nServer: vstreamer_server\r\n Cache-Control: no-cache, no-store, must-revalidate, pre-check=0, post-check=0, max-age=0\r\n Pragma: no-cache\r\n";
 
-            sprintf(buffer, "HTTP/1.0 200 OK\r\n"
-				"%s"
+		void MjpegServer::client(sockets::Socket_handle& fd, const stream_limits &limits, int scale) {
+			std::shared_ptr<frame_ring> ring = video_device_->get_rendition_ring(scale);
+			if (!ring) {
+				scale = 1;
+				ring = video_device_->get_frame_ring(VSTR_CODEC_MJPEG);
+			}
+			connections_number++;
+			last_connection_time = utils::getMilliseconds();
+			LOG("MjpegServer (%d): HTTP client (%d) connected, size: %s, max fps: %d, max kbps: %d. Current number of clients: %d",
+				port_, fd, video_device::get_rendition_name(scale).c_str(), limits.max_fps, limits.max_kbps, (int)connections_number);
+
+			std::string header_tmp = "Connection: close\r\nServer: vstreamer_server\r\n Cache-Control: no-cache, no-store, must-revalidate, pre-check=0, post-check=0, max-age=0\r\n Pragma: no-cache\r\n";
+			std::string preamble = "HTTP/1.0 200 OK\r\n" + header_tmp +
 				"Content-Type: multipart/x-mixed-replace;boundary=boundarydonotcross \r\n"
 				"\r\n"
-				"--boundarydonotcross \r\n", header_tmp.c_str());
-
-
+				"--boundarydonotcross \r\n";
+
+			// start to send video stream to client, engine closes socket when stream ends
+			stream_engine::get_instance()->add_stream(fd, ring, preamble, this,
+				[this](const frame_ring::cursor &position) {
+					connections_number--;
+					LOG("MjpegServer (%d): Disconnecting HTTP client, %d frames skipped. Clients left: %d.",
+						port_, (int)position.skipped, (int)connections_number);
+				}, limits);
+		}
 
-			if (send(fd, buffer, strlen(buffer), 0) < 0) {
-				free(frame);
-				return;
-			}
 
-			while (!stop_requested_) {
+		void MjpegServer::dispatchClient(sockets::Socket_handle fd) {
+			client(fd);
+		}
 
-				// wait until capturing starts
-				if(!video_device_->video_cap_opened) {
-					VS_WAIT(100);
-					continue;
-				}
 
-				/* wait for fresh frames */
-				std::unique_lock<std::mutex> lock(video_mutex_);
-				video_condition_.wait(lock);
-				lock.unlock();
-				/* check if frame buffer is large enough, increase it if necessary */
-				if (encoded_buffer_size > max_frame_size) {
-					max_frame_size = encoded_buffer_size + tenk;
-					if ((tmp = (unsigned char*)realloc(frame, (size_t) max_frame_size)) == NULL) {
-						free(frame);
-						sendCode(fd, 500, "not enough memory");
-						LOG_ERROR("MjpegServer (%d): Not enought memory.", port_);
-						return;
-					}
-					frame = tmp;
-				}
-				memcpy(frame, encoded_buffer, (size_t) encoded_buffer_size);
-				timestamp = (double)utils::getMilliseconds() / 1000;
-				// print the individual mimetype and the length
-				// sending the content-length fixes random stream disruption observed
-				// with firefox
-				sprintf(buffer, "Content-Type: image/jpeg\r\n"
-					"Content-Length: %d\r\n"
-					"X-Timestamp: %.06lf\r\n"
-					"\r\n", encoded_buffer_size, timestamp);
-				if (send(fd, buffer, strlen(buffer), 0) < 0) { break; }
-
-				if (frame) {
-					if (send(fd, reinterpret_cast <const char *>(frame), encoded_buffer_size, 0) < 0) { break; }
-				}
-				else {
-					break;
-				}
-
-				sprintf(buffer, "\r\n--boundarydonotcross \r\n");
-				if (send(fd, buffer, strlen(buffer), 0) < 0) { break; }
+		void MjpegServer::requestSnapshot() {
+			std::shared_ptr<frame_ring> ring = video_device_->get_frame_ring(VSTR_CODEC_MJPEG);
+			snapshot_seq = ring->get_published_count();
+			snapshot_deadline = utils::getMilliseconds() + SNAPSHOT_CAPTURE_TIMEOUT_MS;
+			// snapshot needs MJPEG frame even if nobody watches the stream
+			if (!snapshot_subscribed.exchange(true)) {
+				ring->add_subscriber();
 			}
-			free(frame);
+			std::lock_guard<std::mutex> lock(capture_mutex_);
+			capture_condition_.notify_all();
 		}
 
 
-		void MjpegServer::client(sockets::Socket_handle& fd) {
-			connections_number++;
-			last_connection_time = utils::getMilliseconds();
-			LOG("MjpegServer (%d): HTTP client (%d) connected. Current number of clients: %d", port_, fd, connections_number);
-			
-			// start to send video stream to client
+		void MjpegServer::checkSnapshot() {
+			if (!snapshot_subscribed) {
+				return;
+			}
+			std::shared_ptr<frame_ring> ring = video_device_->get_frame_ring(VSTR_CODEC_MJPEG);
+			int64_t deadline = snapshot_deadline;
+			if (ring->get_published_count() <= snapshot_seq && utils::getMilliseconds() < deadline) {
+				return;
+			}
+			// frame is in ring (or request timed out), snapshot is served from it
+			if (snapshot_subscribed.exchange(false)) {
+				ring->remove_subscriber();
+			}
+			if (snapshot_deadline != deadline && !snapshot_subscribed.exchange(true)) {
+				// new request came meanwhile
+				ring->add_subscriber();
+			}
+		}
 
-			sendStream(fd);
 
-			// finish sending stream
-			ugcs::vstreamer::sockets::Close_socket(fd);
-			connections_number--;
-			LOG("MjpegServer (%d): Disconnecting HTTP client. Clients left: %d.", port_, connections_number);
-			return;
+		bool MjpegServer::isSnapshotRequested() {
+			return utils::getMilliseconds() < snapshot_deadline;
 		}
 
 
@@ -130,12 +120,18 @@ namespace ugcs {
 
 			std::thread tvid(&MjpegServer::video, this);
 			tvid.detach();
-			run();
+			if (listening) {
+				run();
+			}
 		}
 
 		void MjpegServer::cleanUp() {
 
 			LOG("MjpegServer (%d): Cleaning up ressources allocated by server thread", port_);
+			stream_engine::get_instance()->close_streams(this);
+			if (snapshot_subscribed.exchange(false)) {
+				video_device_->get_frame_ring(VSTR_CODEC_MJPEG)->remove_subscriber();
+			}
             if (!stop_requested_) {
                 stop_requested_ = true;
 
@@ -146,11 +142,13 @@ namespace ugcs {
             }
 
             started = false;
-			for (int i = 0; i < MAX_NUM_SOCKETS; i++) {
-				sockets::Close_socket(sd[i]);
+			if (listening) {
+				for (int i = 0; i < MAX_NUM_SOCKETS; i++) {
+					sockets::Close_socket(sd[i]);
+				}
+				sockets::Done_sockets();
 			}
 			video_device_->server_started = false;
-			sockets::Done_sockets();
             started = false;
 		}
 
@@ -176,13 +174,16 @@ namespace ugcs {
 
 
 			while (!stop_requested_) {
+                checkSnapshot();
                 if (connections_number == 0	&& !video_device_->is_recording_active && !video_device_->is_outer_streams_active) {
                     // set first value for frame time even we haven't any frames yet.
                     // (for timeout handling purposes)
                     last_frame_time = utils::getMilliseconds();
                 }
-				// try to capture only if there are connections
-				if (connections_number > 0 || video_device_->is_recording_active || video_device_->is_outer_streams_active || (utils::getMilliseconds() - last_connection_time) < TIME_TO_CONTINUE_CAPTURING_MS ) {
+				// keep device open while there are consumers and for a while after the last one
+				// (reconnecting viewer doesn't wait for device), snapshot of idle device needs only one frame,
+				// pre-roll needs frames all the time
+				if (connections_number > 0 || video_device_->is_recording_active || video_device_->is_outer_streams_active || (utils::getMilliseconds() - last_connection_time) < TIME_TO_CONTINUE_CAPTURING_MS || isSnapshotRequested() || video_device_->has_preroll()) {
 
 					// init capture sequence. Skip if already capturing.
 					if (!video_device_->video_cap_opened) {
@@ -192,14 +193,22 @@ namespace ugcs {
                         if (!res) {
                             continue;
                         }
-						// Ok then. Init is done.
-                  		video_device_->video_cap_opened = true;
 					    // Set no_connection_time to zero;
-						LOG_INFO("MjpegServer (%d): Start capturing, connections number = %d, recording is %s", port_, connections_number, (video_device_->is_recording_active ? "on" : "off"));
+						LOG_INFO("MjpegServer (%d): Start capturing, connections number = %d, recording is %s", port_, (int)connections_number, (video_device_->is_recording_active ? "on" : "off"));
+
+					}
 
+					if (!video_device_->has_subscribers()) {
+						// device stays open, but nothing is decoded or encoded
+						last_frame_time = utils::getMilliseconds();
+						std::unique_lock<std::mutex> lock(capture_mutex_);
+						capture_condition_.wait_for(lock, std::chrono::milliseconds(PIPELINE_QUEUE_WAIT_MS),
+							[this] { return video_device_->has_subscribers(); });
+						continue;
 					}
 
-					res = video_device_->get_frame(&encoded_buffer, encoded_buffer_size);
+					encoded_frame::Ptr frame;
+					res = video_device_->get_frame(video_cursor, frame);
 					if (res) {
                         // set frame time
                         last_frame_time = utils::getMilliseconds();
@@ -213,7 +222,6 @@ namespace ugcs {
 						// free all resources, turn off cap and try again
 						LOG_INFO("MjpegServer (%d): Something wrong happend while capturing. Error Code: %d.", port_, res);
                         video_device_->close();
-                        video_device_->video_cap_opened = false;
 					}
 				}
 				else {
@@ -222,9 +230,9 @@ namespace ugcs {
 					if (video_device_->video_cap_opened) {
                         video_device_->close();
 					}
-					video_device_->video_cap_opened = false;
-					// wait a second before check number of connections
-					VS_WAIT(500);
+					// wait before check number of connections, snapshot request wakes up at once
+					std::unique_lock<std::mutex> lock(capture_mutex_);
+					capture_condition_.wait_for(lock, std::chrono::milliseconds(500), [this] { return isSnapshotRequested(); });
 				}
 			}
             if (video_device_->video_cap_opened) {
@@ -232,7 +240,6 @@ namespace ugcs {
             }
             LOG_DEBUG("MjpegServer (%d): Left video stream", port_);
             video_condition_.notify_all();
-            video_device_->video_cap_opened = false;
 		}
 
         bool MjpegServer::isTimeout() {
@@ -70,14 +70,6 @@ namespace ugcs {
                     return false;
                 }
 
-                // allocate flv codec context (for output)
-                flv_codec_context = avcodec_alloc_context3(flv_codec);
-                if (!flv_codec_context) {
-                    LOG_ERR("Video Device (%s): Could not allocate video FLV codec context!\n", video_device_->name.c_str());
-                    video_device_->video_cap_opened = false;
-                    return false;
-                }
-
                 frame_encoded = av_frame_alloc();
                 int numBytes;
                 numBytes = avpicture_get_size(pEncodedFormat, video_device_->width, video_device_->height);
@@ -89,7 +81,7 @@ namespace ugcs {
         }
 
 
-        bool opencv_cap::get_frame(video_device* video_device_, std::map<int, video_frame*> &frames, int codec_type) {
+        bool opencv_cap::get_frame(video_device* video_device_, std::map<int, std::shared_ptr<encoded_frame>> &frames, int codec_type) {
 
             int err_count = 0;
             cv::Mat frame;
@@ -110,21 +102,16 @@ namespace ugcs {
                                 encode_params.push_back(CV_IMWRITE_JPEG_QUALITY);
                                 encode_params.push_back(95);
 
-                                video_frame* vf;
-                                if (frames.count(VSTR_CODEC_MJPEG) > 0) {
-                                    vf = frames.at(VSTR_CODEC_MJPEG);
-                                } else
-                                {
-                                    vf = new video_frame();
-                                    frames[VSTR_CODEC_MJPEG] = vf;
-                                }
-                                vf->ts = utils::getMilliseconds();
-
                                 cv::imencode(".jpeg", frame, encoded_vector, encode_params);
 
-                                vf->encoded_buffer_size = encoded_vector.size();
-                                vf->encoded_buffer = (unsigned char*)realloc(vf->encoded_buffer, (size_t)vf->encoded_buffer_size);
-                                memcpy(vf->encoded_buffer, &encoded_vector[0], (size_t)vf->encoded_buffer_size);
+                                std::shared_ptr<encoded_frame> vf = encoded_frame::create((int)encoded_vector.size(), VSTR_CODEC_MJPEG);
+                                if (!vf) {
+                                    err_count++;
+                                    continue;
+                                }
+                                memcpy(vf->get_writable_data(), &encoded_vector[0], encoded_vector.size());
+                                vf->set_geometry(video_device_->width, video_device_->height);
+                                frames[VSTR_CODEC_MJPEG] = vf;
 
                             }
 
@@ -135,41 +122,43 @@ namespace ugcs {
                                 cv::cvtColor(frame , yuv_frame, CV_BGR2YUV_I420 );
                                 // fill ffmpeg frame
                                 avpicture_fill((AVPicture*)frame_encoded, yuv_frame.data, pEncodedFormat, video_device_->width, video_device_->height);
-                                // init context
-                                flv_codec_context->pix_fmt = pEncodedFormat;
-                                flv_codec_context->color_range = AVCOL_RANGE_JPEG;
-                                flv_codec_context->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
-                                flv_codec_context->width = video_device_->width;
-                                flv_codec_context->height = video_device_->height;
-                                // set top quality
-                                flv_codec_context->qmin=2;
-                                flv_codec_context->qmax=31;
-                                // set fps and bitrate tolerance
-                                flv_codec_context->time_base.num = DEFAULT_FRAMERATE_NUM;
-                                flv_codec_context->time_base.den = DEFAULT_FRAMERATE_DEN;
-                                flv_codec_context->bit_rate_tolerance = DEFAULT_FRAMERATE_BIT_TOLERANCE;
-
-                                int res = avcodec_open2(flv_codec_context, flv_codec, NULL);
+                                // get opened encoder, it's reopened only when frame size changes
+                                encoder_key key;
+                                key.codec_id = AV_CODEC_ID_FLV1;
+                                key.width = video_device_->width;
+                                key.height = video_device_->height;
+                                key.pix_fmt = pEncodedFormat;
+                                key.qmin = 2;
+                                key.qmax = 31;
+                                AVCodecContext *flv_codec_context = encoders.get(flv_codec, key, [&](AVCodecContext *ctx) {
+                                    ctx->pix_fmt = pEncodedFormat;
+                                    ctx->color_range = AVCOL_RANGE_JPEG;
+                                    ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+                                    ctx->width = video_device_->width;
+                                    ctx->height = video_device_->height;
+                                    ctx->qmin = key.qmin;
+                                    ctx->qmax = key.qmax;
+                                    // set fps and bitrate tolerance
+                                    ctx->time_base.num = DEFAULT_FRAMERATE_NUM;
+                                    ctx->time_base.den = DEFAULT_FRAMERATE_DEN;
+                                    ctx->bit_rate_tolerance = DEFAULT_FRAMERATE_BIT_TOLERANCE;
+                                });
                                 // open codec for encoding
-                                if (res < 0) {
-                                    LOG_ERR("Video Device (%s): Could not open FLV codec. Error code (%d)\n", video_device_->name.c_str(), res);
+                                if (flv_codec_context == NULL) {
+                                    LOG_ERR("Video Device (%s): Could not open FLV codec.\n", video_device_->name.c_str());
                                     VS_WAIT(100);
                                     err_count++;
                                     continue;
                                 }
                                 // convert to flv
-                                av_init_packet(&flv_packet);
-                                flv_packet.data = NULL;
-                                flv_packet.size = 0;
-
-                                // do the encoding
-                                int ret = fcap->encode(flv_codec_context, frame_encoded, flv_packet, frames, VSTR_CODEC_FLV);
-                                av_free_packet(&flv_packet);
-                                if (ret < 0) {
-                                    LOG_ERR("Video Device (%s): Error FLV-encoding frame. Error code (%d)\n", video_device_->name.c_str(), res);
+                                std::shared_ptr<encoded_frame> flv_vf = fcap->encode(flv_codec_context, frame_encoded, VSTR_CODEC_FLV);
+                                if (!flv_vf) {
+                                    LOG_ERR("Video Device (%s): Error FLV-encoding frame.\n", video_device_->name.c_str());
                                     err_count++;
                                     continue;
                                 }
+                                flv_vf->set_geometry(video_device_->width, video_device_->height);
+                                frames[VSTR_CODEC_FLV] = flv_vf;
                             }
 
                             return true;
@@ -193,6 +182,13 @@ namespace ugcs {
 
         void opencv_cap::close() {
             cap.release();
+            encoders.close_all();
+        }
+
+
+        void opencv_cap::get_stats(Json::Value &stats) {
+            stats["encoder_opens"] = (Json::Int)encoders.get_open_count();
+            stats["encoder_reuses"] = (Json::Int)encoders.get_reuse_count();
         }
 
     }
@@ -0,0 +1,68 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file pipeline_picture.cpp
+*/
+
+#include "ugcs/vstreamer/capture_pipeline.h"
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        pipeline_picture::pipeline_picture() {
+            this->frame = ffmpeg_utils::frame_alloc();
+            this->buffer = NULL;
+            this->width = 0;
+            this->height = 0;
+            this->format = -1;
+            this->seq = 0;
+            this->capture_ms = 0;
+        }
+
+
+        pipeline_picture::~pipeline_picture() {
+            if (frame) {
+                ffmpeg_utils::frame_free(&frame);
+            }
+            if (buffer) {
+                av_free(buffer);
+            }
+        }
+
+
+        bool pipeline_picture::copy_from(AVFrame *src) {
+            if (frame == NULL) {
+                return false;
+            }
+            AVPixelFormat src_format = (AVPixelFormat)src->format;
+            if (buffer == NULL || src->width != width || src->height != height || src->format != format) {
+                if (buffer) {
+                    av_free(buffer);
+                }
+                int num_bytes = avpicture_get_size(src_format, src->width, src->height);
+                buffer = (uint8_t *) av_malloc(num_bytes * sizeof(uint8_t));
+                if (buffer == NULL) {
+                    return false;
+                }
+                avpicture_fill((AVPicture *) frame, buffer, src_format, src->width, src->height);
+                width = src->width;
+                height = src->height;
+                format = src->format;
+                frame->width = width;
+                frame->height = height;
+                frame->format = format;
+            }
+            av_picture_copy((AVPicture *) frame, (const AVPicture *) src, src_format, width, height);
+            frame->pts = src->pts;
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+            // YUV420P pictures may be of either range, encoders need to know it
+            frame->color_range = src->color_range;
+#endif
+            return true;
+        }
+
+    }
+}
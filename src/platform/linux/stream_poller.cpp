@@ -0,0 +1,108 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/*
+ * stream_poller.cpp
+ *
+ *  Linux specific poller: edge-triggered epoll with eventfd for wake up.
+ */
+
+#include <ugcs/vsm/vsm.h>
+#include <ugcs/vstreamer/stream_poller.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+// number of events taken by one epoll_wait call
+#define EPOLL_MAX_EVENTS 64
+
+namespace ugcs {
+namespace vstreamer {
+
+struct stream_poller::poller_state {
+    int epoll_fd;
+    int wake_fd;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+};
+
+
+stream_poller::stream_poller() : state(new poller_state) {
+    state->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    state->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (state->epoll_fd < 0 || state->wake_fd < 0) {
+        LOG_ERR("Stream poller: could not create epoll, error: %d", errno);
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    // wake fd is marked with empty context
+    ev.data.ptr = NULL;
+    epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, state->wake_fd, &ev);
+}
+
+
+stream_poller::~stream_poller() {
+    if (state->wake_fd >= 0) {
+        close(state->wake_fd);
+    }
+    if (state->epoll_fd >= 0) {
+        close(state->epoll_fd);
+    }
+}
+
+
+bool stream_poller::add(sockets::Socket_handle fd, void *context) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = context;
+    return epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+
+void stream_poller::set_write_interest(sockets::Socket_handle, bool) {
+    // edge-triggered: writability is reported only when socket buffer frees up
+}
+
+
+void stream_poller::remove(sockets::Socket_handle fd) {
+    struct epoll_event ev;
+    epoll_ctl(state->epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+
+int stream_poller::wait(std::vector<poll_event> &events, int timeout_ms) {
+    events.clear();
+    int count = epoll_wait(state->epoll_fd, state->events, EPOLL_MAX_EVENTS, timeout_ms);
+    if (count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < count; i++) {
+        struct epoll_event &ev = state->events[i];
+        if (ev.data.ptr == NULL) {
+            uint64_t value;
+            while (read(state->wake_fd, &value, sizeof(value)) > 0) {}
+            continue;
+        }
+        poll_event event;
+        event.context = ev.data.ptr;
+        event.readable = (ev.events & EPOLLIN) != 0;
+        event.writable = (ev.events & EPOLLOUT) != 0;
+        event.closed = (ev.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+        events.push_back(event);
+    }
+    return (int)events.size();
+}
+
+
+void stream_poller::wake() {
+    uint64_t value = 1;
+    if (write(state->wake_fd, &value, sizeof(value)) < 0) {
+        // counter overflow means poller is already woken up
+    }
+}
+
+}
+}
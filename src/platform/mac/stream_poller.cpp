@@ -0,0 +1,123 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/*
+ * stream_poller.cpp
+ *
+ *  Mac specific poller: poll() with self-pipe for wake up.
+ */
+
+#include <ugcs/vsm/vsm.h>
+#include <ugcs/vstreamer/stream_poller.h>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace ugcs {
+namespace vstreamer {
+
+struct stream_poller::poller_state {
+    int wake_pipe[2];
+    /** first element is wake pipe */
+    std::vector<struct pollfd> fds;
+    std::vector<void *> contexts;
+};
+
+
+stream_poller::stream_poller() : state(new poller_state) {
+    state->wake_pipe[0] = -1;
+    state->wake_pipe[1] = -1;
+    if (pipe(state->wake_pipe) < 0) {
+        LOG_ERR("Stream poller: could not create pipe, error: %d", errno);
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(state->wake_pipe[i], F_SETFL, fcntl(state->wake_pipe[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+    struct pollfd wake_fd;
+    wake_fd.fd = state->wake_pipe[0];
+    wake_fd.events = POLLIN;
+    wake_fd.revents = 0;
+    state->fds.push_back(wake_fd);
+    state->contexts.push_back(NULL);
+}
+
+
+stream_poller::~stream_poller() {
+    for (int i = 0; i < 2; i++) {
+        if (state->wake_pipe[i] >= 0) {
+            close(state->wake_pipe[i]);
+        }
+    }
+}
+
+
+bool stream_poller::add(sockets::Socket_handle fd, void *context) {
+    struct pollfd socket_fd;
+    socket_fd.fd = fd;
+    socket_fd.events = POLLIN | POLLOUT;
+    socket_fd.revents = 0;
+    state->fds.push_back(socket_fd);
+    state->contexts.push_back(context);
+    return true;
+}
+
+
+void stream_poller::set_write_interest(sockets::Socket_handle fd, bool enabled) {
+    for (size_t i = 1; i < state->fds.size(); i++) {
+        if (state->fds[i].fd == fd) {
+            state->fds[i].events = enabled ? (POLLIN | POLLOUT) : POLLIN;
+            return;
+        }
+    }
+}
+
+
+void stream_poller::remove(sockets::Socket_handle fd) {
+    for (size_t i = 1; i < state->fds.size(); i++) {
+        if (state->fds[i].fd == fd) {
+            state->fds.erase(state->fds.begin() + i);
+            state->contexts.erase(state->contexts.begin() + i);
+            return;
+        }
+    }
+}
+
+
+int stream_poller::wait(std::vector<poll_event> &events, int timeout_ms) {
+    events.clear();
+    int count = poll(&state->fds[0], state->fds.size(), timeout_ms);
+    if (count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (state->fds[0].revents & POLLIN) {
+        char buffer[64];
+        while (read(state->wake_pipe[0], buffer, sizeof(buffer)) > 0) {}
+    }
+    for (size_t i = 1; i < state->fds.size(); i++) {
+        short revents = state->fds[i].revents;
+        if (revents == 0) {
+            continue;
+        }
+        poll_event event;
+        event.context = state->contexts[i];
+        event.readable = (revents & POLLIN) != 0;
+        event.writable = (revents & POLLOUT) != 0;
+        event.closed = (revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+        events.push_back(event);
+    }
+    return (int)events.size();
+}
+
+
+void stream_poller::wake() {
+    char value = 1;
+    if (write(state->wake_pipe[1], &value, 1) < 0) {
+        // pipe is full, poller is already woken up
+    }
+}
+
+}
+}
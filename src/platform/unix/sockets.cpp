@@ -11,6 +11,9 @@
 // This file should be built only on Linux platforms
 #include <ugcs/vstreamer/sockets.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 void
 ugcs::vstreamer::sockets::Init_sockets() {
@@ -33,3 +36,50 @@ ugcs::vstreamer::sockets::get_error() {
     return errno;
 }
 
+int
+ugcs::vstreamer::sockets::Send_vector(Socket_handle s, const Send_buffer *buffers, int count) {
+    // SEND_VECTOR_CHUNK is far below IOV_MAX
+    struct iovec iov[SEND_VECTOR_CHUNK];
+    int total = 0;
+    for (int first = 0; first < count; first += SEND_VECTOR_CHUNK) {
+        int chunk = count - first < SEND_VECTOR_CHUNK ? count - first : SEND_VECTOR_CHUNK;
+        size_t chunk_size = 0;
+        for (int i = 0; i < chunk; i++) {
+            iov[i].iov_base = const_cast<void *>(buffers[first + i].data);
+            iov[i].iov_len = buffers[first + i].size;
+            chunk_size += buffers[first + i].size;
+        }
+        // sendmsg is writev which accepts send flags (no SIGPIPE on linux)
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = chunk;
+        ssize_t res;
+        do {
+            res = sendmsg(s, &msg, SEND_FLAGS);
+        } while (res < 0 && errno == EINTR);
+        if (res < 0) {
+            // data of previous chunks is already sent
+            return total > 0 ? total : -1;
+        }
+        total += (int)res;
+        if ((size_t)res < chunk_size) {
+            break;
+        }
+    }
+    return total;
+}
+
+int
+ugcs::vstreamer::sockets::Set_nonblocking(Socket_handle s) {
+    int flags = fcntl(s, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(s, F_SETFL, flags | O_NONBLOCK);
+}
+
+bool
+ugcs::vstreamer::sockets::Is_would_block() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
@@ -48,6 +48,45 @@ ugcs::vstreamer::sockets::get_error() {
 	return WSAGetLastError();
 }
 
+int
+ugcs::vstreamer::sockets::Send_vector(Socket_handle s, const Send_buffer *buffers, int count)
+{
+	WSABUF wsa_buffers[SEND_VECTOR_CHUNK];
+	int total = 0;
+	for (int first = 0; first < count; first += SEND_VECTOR_CHUNK) {
+		int chunk = count - first < SEND_VECTOR_CHUNK ? count - first : SEND_VECTOR_CHUNK;
+		size_t chunk_size = 0;
+		for (int i = 0; i < chunk; i++) {
+			wsa_buffers[i].buf = (CHAR *)buffers[first + i].data;
+			wsa_buffers[i].len = (ULONG)buffers[first + i].size;
+			chunk_size += buffers[first + i].size;
+		}
+		DWORD sent = 0;
+		if (WSASend(s, wsa_buffers, chunk, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+			// data of previous chunks is already sent
+			return total > 0 ? total : -1;
+		}
+		total += (int)sent;
+		if ((size_t)sent < chunk_size) {
+			break;
+		}
+	}
+	return total;
+}
+
+int
+ugcs::vstreamer::sockets::Set_nonblocking(Socket_handle s)
+{
+	u_long mode = 1;
+	return ioctlsocket(s, FIONBIO, &mode);
+}
+
+bool
+ugcs::vstreamer::sockets::Is_would_block()
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
 
 
 #endif // _WIN32
@@ -0,0 +1,121 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/*
+ * stream_poller.cpp
+ *
+ *  Windows specific poller: WSAPoll. Winsock has no pollable pipe, so wake()
+ *  is emulated with short poll timeout.
+ */
+
+// This file should be built only on windows platforms
+#if _WIN32
+
+#include <ugcs/vsm/vsm.h>
+#include <ugcs/vstreamer/stream_poller.h>
+
+#include <atomic>
+
+// longest time wait() sleeps without checking for wake()
+#define WIN_POLL_WAKE_CHECK_MS 10
+
+namespace ugcs {
+namespace vstreamer {
+
+struct stream_poller::poller_state {
+    std::vector<WSAPOLLFD> fds;
+    std::vector<void *> contexts;
+    std::atomic<bool> woken;
+};
+
+
+stream_poller::stream_poller() : state(new poller_state) {
+    state->woken = false;
+}
+
+
+stream_poller::~stream_poller() {
+}
+
+
+bool stream_poller::add(sockets::Socket_handle fd, void *context) {
+    WSAPOLLFD socket_fd;
+    socket_fd.fd = fd;
+    socket_fd.events = POLLRDNORM | POLLWRNORM;
+    socket_fd.revents = 0;
+    state->fds.push_back(socket_fd);
+    state->contexts.push_back(context);
+    return true;
+}
+
+
+void stream_poller::set_write_interest(sockets::Socket_handle fd, bool enabled) {
+    for (size_t i = 0; i < state->fds.size(); i++) {
+        if (state->fds[i].fd == fd) {
+            state->fds[i].events = enabled ? (POLLRDNORM | POLLWRNORM) : POLLRDNORM;
+            return;
+        }
+    }
+}
+
+
+void stream_poller::remove(sockets::Socket_handle fd) {
+    for (size_t i = 0; i < state->fds.size(); i++) {
+        if (state->fds[i].fd == fd) {
+            state->fds.erase(state->fds.begin() + i);
+            state->contexts.erase(state->contexts.begin() + i);
+            return;
+        }
+    }
+}
+
+
+int stream_poller::wait(std::vector<poll_event> &events, int timeout_ms) {
+    events.clear();
+    int waited = 0;
+    do {
+        if (state->woken.exchange(false)) {
+            return 0;
+        }
+        int step = timeout_ms < WIN_POLL_WAKE_CHECK_MS ? timeout_ms : WIN_POLL_WAKE_CHECK_MS;
+        int count;
+        if (state->fds.empty()) {
+            Sleep(step);
+            count = 0;
+        } else {
+            count = WSAPoll(&state->fds[0], (ULONG)state->fds.size(), step);
+        }
+        if (count < 0) {
+            return -1;
+        }
+        if (count > 0) {
+            break;
+        }
+        waited += step;
+    } while (waited < timeout_ms);
+
+    for (size_t i = 0; i < state->fds.size(); i++) {
+        SHORT revents = state->fds[i].revents;
+        if (revents == 0) {
+            continue;
+        }
+        poll_event event;
+        event.context = state->contexts[i];
+        event.readable = (revents & POLLRDNORM) != 0;
+        event.writable = (revents & POLLWRNORM) != 0;
+        event.closed = (revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+        events.push_back(event);
+    }
+    return (int)events.size();
+}
+
+
+void stream_poller::wake() {
+    state->woken = true;
+}
+
+}
+}
+
+#endif // _WIN32
@@ -0,0 +1,72 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file preroll_buffer.cpp
+*/
+
+#include "ugcs/vstreamer/preroll_buffer.h"
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        preroll_buffer::preroll_buffer(int64_t duration_ms, int64_t max_bytes) {
+            this->duration_ms = duration_ms;
+            this->max_bytes = max_bytes;
+            this->bytes = 0;
+            this->dropped_count = 0;
+        }
+
+
+        void preroll_buffer::add(const encoded_frame::Ptr &frame) {
+            std::lock_guard<std::mutex> lock(buffer_mutex);
+            frames.push_back(frame);
+            bytes += frame->get_size();
+            while (frames.size() > 1) {
+                const encoded_frame::Ptr &oldest = frames.front();
+                bool too_old = frame->get_ts() - oldest->get_ts() > duration_ms;
+                if (!too_old && bytes <= max_bytes) {
+                    break;
+                }
+                if (!too_old) {
+                    dropped_count++;
+                }
+                bytes -= oldest->get_size();
+                frames.pop_front();
+            }
+        }
+
+
+        std::vector<encoded_frame::Ptr> preroll_buffer::get_frames(int64_t now_ts) {
+            std::lock_guard<std::mutex> lock(buffer_mutex);
+            std::vector<encoded_frame::Ptr> result;
+            result.reserve(frames.size());
+            // frames kept before capturing stopped for a while don't belong to pre-roll
+            for (auto iter = frames.begin(); iter != frames.end(); ++iter) {
+                if (now_ts - (*iter)->get_ts() <= duration_ms) {
+                    result.push_back(*iter);
+                }
+            }
+            return result;
+        }
+
+
+        int64_t preroll_buffer::get_duration_ms() {
+            return duration_ms;
+        }
+
+
+        void preroll_buffer::get_stats(Json::Value &stats) {
+            std::lock_guard<std::mutex> lock(buffer_mutex);
+            stats["duration_ms"] = (Json::Int)duration_ms;
+            stats["max_bytes"] = (Json::Int)max_bytes;
+            stats["frames"] = (Json::UInt)frames.size();
+            stats["bytes"] = (Json::Int)bytes;
+            stats["buffered_ms"] = frames.empty() ? 0 : (Json::Int)(frames.back()->get_ts() - frames.front()->get_ts());
+            stats["dropped_for_memory"] = (Json::Int)dropped_count;
+        }
+
+    }
+}
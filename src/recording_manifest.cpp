@@ -0,0 +1,151 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file recording_manifest.cpp
+*/
+
+#include "ugcs/vstreamer/recording_manifest.h"
+#include "ugcs/vstreamer/common.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <json/json.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        namespace {
+            /** true if video, manifest or metadata of session with this file name exists */
+            bool session_exists(const std::string &filename) {
+                return utils::checkFileExists(filename) ||
+                       utils::checkFileExists(filename + "." + VSTR_RECORDING_MANIFEST_EXTENSION) ||
+                       utils::checkFileExists(filename + "." + VSTR_RECORDING_VIDEO_METADATA_EXTENSION);
+            }
+        }
+
+
+        std::string recording_manifest::get_session_filename(const std::string &folder, const std::string &video_id) {
+            std::string filename = utils::createFullFilename(folder, video_id, VSTR_RECORDING_VIDEO_EXTENSION);
+            if (session_exists(filename)) {
+                return filename;
+            }
+            std::string legacy_filename = utils::createFullFilename(folder, video_id, VSTR_RECORDING_LEGACY_VIDEO_EXTENSION);
+            if (session_exists(legacy_filename)) {
+                return legacy_filename;
+            }
+            return filename;
+        }
+
+
+        std::string recording_manifest::get_filename(const std::string &folder, const std::string &video_id) {
+            return get_session_filename(folder, video_id) + "." + VSTR_RECORDING_MANIFEST_EXTENSION;
+        }
+
+
+        std::string recording_manifest::get_segment_file(const std::string &video_id, int number) {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), ".%03d.", number);
+            return video_id + suffix + VSTR_RECORDING_VIDEO_EXTENSION;
+        }
+
+
+        std::string recording_manifest::get_path(const std::string &folder, const std::string &file) {
+            if (folder.empty() || folder.back() == '/' || folder.back() == '\\') {
+                return folder + file;
+            }
+            return folder + "/" + file;
+        }
+
+
+        std::vector<std::string> recording_manifest::get_video_files(const std::string &folder, const std::string &video_id) {
+            std::vector<std::string> files;
+            recording_manifest manifest;
+            if (manifest.load(get_filename(folder, video_id))) {
+                for (auto iter = manifest.segments.begin(); iter != manifest.segments.end(); ++iter) {
+                    std::string filename = get_path(folder, iter->file);
+                    if (utils::checkFileExists(filename)) {
+                        files.push_back(filename);
+                    }
+                }
+                return files;
+            }
+            std::string filename = get_session_filename(folder, video_id);
+            if (utils::checkFileExists(filename)) {
+                files.push_back(filename);
+            }
+            return files;
+        }
+
+
+        bool recording_manifest::load(const std::string &filename) {
+            segments.clear();
+            std::ifstream file(filename.c_str());
+            if (!file.is_open()) {
+                return false;
+            }
+            Json::Value root;
+            Json::Reader reader;
+            if (!reader.parse(file, root) || !root["segments"].isArray()) {
+                return false;
+            }
+            const Json::Value &list = root["segments"];
+            for (Json::UInt i = 0; i < list.size(); i++) {
+                segment item;
+                item.file = list[i]["file"].asString();
+                item.start_ms = (int64_t)list[i]["start_ms"].asDouble();
+                item.end_ms = list[i]["end_ms"].isNull() ? -1 : (int64_t)list[i]["end_ms"].asDouble();
+                item.bytes = (int64_t)list[i]["bytes"].asDouble();
+                if (item.file.empty() || item.file.find_first_of("/\\") != std::string::npos) {
+                    // manifest refers to files of its folder only
+                    return false;
+                }
+                segments.push_back(item);
+            }
+            return true;
+        }
+
+
+        bool recording_manifest::save(const std::string &filename) {
+            Json::Value root;
+            Json::Value &list = root["segments"];
+            list = Json::Value(Json::arrayValue);
+            for (auto iter = segments.begin(); iter != segments.end(); ++iter) {
+                Json::Value item;
+                item["file"] = iter->file;
+                // 64-bit values are kept in doubles, jsoncpp integers are 32-bit
+                item["start_ms"] = (double)iter->start_ms;
+                item["end_ms"] = iter->end_ms < 0 ? Json::Value() : Json::Value((double)iter->end_ms);
+                item["bytes"] = (double)iter->bytes;
+                list.append(item);
+            }
+            Json::FastWriter writer;
+            // written aside and renamed, so readers never see half written manifest
+            std::string tmp_filename = filename + ".tmp";
+            {
+                std::ofstream file(tmp_filename.c_str(), std::ios::out | std::ios::trunc);
+                if (!file.is_open()) {
+                    return false;
+                }
+                file << writer.write(root);
+                if (!file.good()) {
+                    return false;
+                }
+            }
+            if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+                // rename doesn't replace existing file on windows
+                std::remove(filename.c_str());
+                if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+                    std::remove(tmp_filename.c_str());
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    }
+}
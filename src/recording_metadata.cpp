@@ -0,0 +1,188 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file recording_metadata.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/recording_metadata.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <cstring>
+#include <cstdlib>
+
+#define METADATA_FLAG_FINISHED 1
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        namespace {
+            void put_uint32(unsigned char *data, uint32_t value) {
+                for (int i = 0; i < 4; i++) {
+                    data[i] = (unsigned char)(value >> (8 * i));
+                }
+            }
+
+            void put_int64(unsigned char *data, int64_t value) {
+                for (int i = 0; i < 8; i++) {
+                    data[i] = (unsigned char)((uint64_t)value >> (8 * i));
+                }
+            }
+
+            uint32_t get_uint32(const unsigned char *data) {
+                uint32_t value = 0;
+                for (int i = 3; i >= 0; i--) {
+                    value = (value << 8) | data[i];
+                }
+                return value;
+            }
+
+            int64_t get_int64(const unsigned char *data) {
+                uint64_t value = 0;
+                for (int i = 7; i >= 0; i--) {
+                    value = (value << 8) | data[i];
+                }
+                return (int64_t)value;
+            }
+        }
+
+
+        recording_metadata::recording_metadata() {
+            this->duration_ms = 0;
+            this->frame_count = 0;
+            this->width = 0;
+            this->height = 0;
+            this->index_offset = 0;
+            this->preroll_ms = 0;
+            this->finished = false;
+            this->is_binary = true;
+            this->file = NULL;
+            this->saved_at = 0;
+        }
+
+
+        recording_metadata::~recording_metadata() {
+            close();
+        }
+
+
+        bool recording_metadata::open(const std::string &filename) {
+            close();
+            file = fopen(filename.c_str(), "wb");
+            if (!file) {
+                LOG_ERR("Cannot create metadata file %s.", filename.c_str());
+                return false;
+            }
+            finished = false;
+            return save();
+        }
+
+
+        void recording_metadata::frame_written(int64_t duration_ms) {
+            this->duration_ms = duration_ms;
+            frame_count++;
+            if (utils::getMilliseconds() - saved_at >= RECORDING_METADATA_SAVE_PERIOD_MS) {
+                save();
+            }
+        }
+
+
+        bool recording_metadata::save() {
+            if (!file) {
+                return false;
+            }
+            unsigned char header[RECORDING_METADATA_SIZE];
+            memset(header, 0, sizeof(header));
+            memcpy(header, RECORDING_METADATA_MAGIC, 4);
+            put_uint32(header + 4, RECORDING_METADATA_VERSION);
+            put_int64(header + 8, duration_ms);
+            put_int64(header + 16, frame_count);
+            put_uint32(header + 24, (uint32_t)width);
+            put_uint32(header + 28, (uint32_t)height);
+            strncpy((char *)header + 32, codec.c_str(), RECORDING_METADATA_CODEC_SIZE - 1);
+            put_int64(header + 48, index_offset);
+            put_uint32(header + 56, finished ? METADATA_FLAG_FINISHED : 0);
+            put_uint32(header + 60, (uint32_t)preroll_ms);
+
+            saved_at = utils::getMilliseconds();
+            // header has fixed size and is overwritten in place
+            if (fseek(file, 0, SEEK_SET) != 0 ||
+                fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+                fflush(file) != 0) {
+                return false;
+            }
+            return true;
+        }
+
+
+        void recording_metadata::close() {
+            if (!file) {
+                return;
+            }
+            finished = true;
+            save();
+            fclose(file);
+            file = NULL;
+        }
+
+
+        bool recording_metadata::load(const std::string &filename) {
+            FILE *input = fopen(filename.c_str(), "rb");
+            if (!input) {
+                return false;
+            }
+            unsigned char header[RECORDING_METADATA_SIZE];
+            size_t size = fread(header, 1, sizeof(header), input);
+            fclose(input);
+
+            if (size < sizeof(header) || memcmp(header, RECORDING_METADATA_MAGIC, 4) != 0) {
+                // older versions wrote duration as text
+                std::string text((const char *)header, size);
+                size_t end = text.find_first_of("\r\n");
+                if (end != std::string::npos) {
+                    text = text.substr(0, end);
+                }
+                if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+                    return false;
+                }
+                duration_ms = std::atoll(text.c_str());
+                is_binary = false;
+                return true;
+            }
+            duration_ms = get_int64(header + 8);
+            frame_count = get_int64(header + 16);
+            width = (int)get_uint32(header + 24);
+            height = (int)get_uint32(header + 28);
+            char codec_name[RECORDING_METADATA_CODEC_SIZE + 1];
+            memcpy(codec_name, header + 32, RECORDING_METADATA_CODEC_SIZE);
+            codec_name[RECORDING_METADATA_CODEC_SIZE] = 0;
+            codec = codec_name;
+            index_offset = get_int64(header + 48);
+            finished = (get_uint32(header + 56) & METADATA_FLAG_FINISHED) != 0;
+            // reserved and zero in files without pre-roll
+            preroll_ms = get_uint32(header + 60);
+            is_binary = true;
+            return true;
+        }
+
+
+        void recording_metadata::get_json(Json::Value &value) {
+            value["duration"] = (Json::Int)duration_ms;
+            if (!is_binary) {
+                return;
+            }
+            value["frames"] = (Json::Int)frame_count;
+            value["width"] = width;
+            value["height"] = height;
+            value["codec"] = codec;
+            // jsoncpp integers are 32-bit, offset of large file doesn't fit
+            value["index_offset"] = (double)index_offset;
+            value["preroll_ms"] = (Json::Int)preroll_ms;
+            value["finished"] = finished;
+        }
+
+    }
+}
@@ -0,0 +1,213 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file recording_writer.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/recording_writer.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <thread>
+#include <algorithm>
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        struct recording_writer::writer_thread {
+            std::thread thread;
+            std::mutex thread_mutex;
+            /** notified when frames are queued and when thread finished a pass over sessions */
+            std::condition_variable thread_condition;
+            /** frames were queued since the last pass */
+            bool pending;
+            /** number of finished passes over sessions */
+            int64_t pass_count;
+            bool in_pass;
+            std::vector<std::shared_ptr<session>> sessions;
+        };
+
+
+        recording_writer::session::session(const std::string &name, const write_handler &write, size_t queue_size) :
+            queue(queue_size) {
+            this->name = name;
+            this->write = write;
+            this->thread = NULL;
+            this->written_count = 0;
+            this->latency_total_us = 0;
+            this->latency_max_us = 0;
+            this->block_count = 0;
+            this->block_bytes = 0;
+            this->block_total_us = 0;
+            this->block_max_us = 0;
+        }
+
+
+        void recording_writer::session::push(const encoded_frame::Ptr &frame) {
+            queued_frame item;
+            item.frame = frame;
+            item.queued_us = utils::getMicroseconds();
+            if (!queue.push(item)) {
+                LOG_DEBUG("Recording writer: session %s can't keep up, the oldest frame is dropped.", name.c_str());
+            }
+            {
+                std::lock_guard<std::mutex> lock(thread->thread_mutex);
+                thread->pending = true;
+            }
+            thread->thread_condition.notify_all();
+        }
+
+
+        void recording_writer::session::block_written(int64_t bytes, int64_t write_us) {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            block_count++;
+            block_bytes += bytes;
+            block_total_us += write_us;
+            if (write_us > block_max_us) {
+                block_max_us = write_us;
+            }
+        }
+
+
+        void recording_writer::session::get_stats(Json::Value &stats) {
+            stats["queue_depth"] = (Json::UInt)queue.get_depth();
+            stats["queue_capacity"] = (Json::UInt)queue.get_capacity();
+            stats["dropped"] = (Json::UInt)queue.get_dropped_count();
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats["written"] = (Json::UInt)written_count;
+            int64_t written = written_count > 0 ? written_count : 1;
+            stats["avg_latency_ms"] = (double)latency_total_us / written / 1000.0;
+            stats["max_latency_ms"] = (double)latency_max_us / 1000.0;
+            stats["blocks"] = (Json::UInt)block_count;
+            int64_t blocks = block_count > 0 ? block_count : 1;
+            stats["avg_block_kb"] = (double)block_bytes / blocks / 1024.0;
+            stats["avg_block_write_ms"] = (double)block_total_us / blocks / 1000.0;
+            stats["max_block_write_ms"] = (double)block_max_us / 1000.0;
+        }
+
+
+        std::shared_ptr<recording_writer> recording_writer::get_instance() {
+            static std::shared_ptr<recording_writer> instance(new recording_writer(
+                utils::getPositiveIntProperty("vstreamer.recording.writer_threads", RECORDING_DEFAULT_WRITER_THREADS),
+                utils::getPositiveIntProperty("vstreamer.recording.queue_size", RECORDING_DEFAULT_QUEUE_SIZE),
+                utils::getPositiveIntProperty("vstreamer.recording.write_block_kb", RECORDING_DEFAULT_WRITE_BLOCK_KB) * 1024));
+            return instance;
+        }
+
+
+        recording_writer::recording_writer(int thread_count, int queue_size, int write_block_size) {
+            this->next_thread = 0;
+            this->stop_requested = false;
+            this->queue_size = (size_t)queue_size;
+            // whole blocks of file system pages
+            this->write_block_size = std::max(RECORDING_WRITE_BLOCK_ALIGN,
+                                              write_block_size / RECORDING_WRITE_BLOCK_ALIGN * RECORDING_WRITE_BLOCK_ALIGN);
+            for (int i = 0; i < thread_count; i++) {
+                std::shared_ptr<writer_thread> thread = std::make_shared<writer_thread>();
+                thread->pending = false;
+                thread->pass_count = 0;
+                thread->in_pass = false;
+                thread->thread = std::thread(&recording_writer::write_loop, this, thread);
+                threads.push_back(thread);
+            }
+            LOG_INFO("Recording writer: %d threads, %d frames queued per recording, %d KB blocks.",
+                     thread_count, queue_size, this->write_block_size / 1024);
+        }
+
+
+        recording_writer::~recording_writer() {
+            stop_requested = true;
+            for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+                {
+                    std::lock_guard<std::mutex> lock((*iter)->thread_mutex);
+                    (*iter)->pending = true;
+                }
+                (*iter)->thread_condition.notify_all();
+            }
+            for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+                if ((*iter)->thread.joinable()) {
+                    (*iter)->thread.join();
+                }
+            }
+        }
+
+
+        std::shared_ptr<recording_writer::session> recording_writer::open_session(const std::string &name, const write_handler &write) {
+            std::shared_ptr<session> recording(new session(name, write, queue_size));
+            // frames of session are written by one thread, in order
+            std::shared_ptr<writer_thread> thread = threads[next_thread++ % threads.size()];
+            recording->thread = thread.get();
+            std::lock_guard<std::mutex> lock(thread->thread_mutex);
+            thread->sessions.push_back(recording);
+            return recording;
+        }
+
+
+        void recording_writer::close_session(const std::shared_ptr<session> &recording) {
+            writer_thread *thread = recording->thread;
+            {
+                std::unique_lock<std::mutex> lock(thread->thread_mutex);
+                // frames queued before close are written by the pass which starts after this point
+                thread->pending = true;
+                thread->thread_condition.notify_all();
+                int64_t wanted_pass = thread->pass_count + (thread->in_pass ? 2 : 1);
+                thread->thread_condition.wait(lock, [&] {
+                    return stop_requested || thread->pass_count >= wanted_pass;
+                });
+                thread->sessions.erase(std::remove(thread->sessions.begin(), thread->sessions.end(), recording),
+                                       thread->sessions.end());
+            }
+            // pass which started before removal may still hold the session
+            std::lock_guard<std::mutex> write_lock(recording->write_mutex);
+            recording->queue.close();
+        }
+
+
+        int recording_writer::get_write_block_size() {
+            return write_block_size;
+        }
+
+
+        void recording_writer::write_loop(std::shared_ptr<writer_thread> thread) {
+            std::unique_lock<std::mutex> lock(thread->thread_mutex);
+            while (!stop_requested) {
+                if (!thread->pending) {
+                    thread->thread_condition.wait_for(lock, std::chrono::milliseconds(RECORDING_WRITER_POLL_MS));
+                }
+                thread->pending = false;
+                thread->in_pass = true;
+                std::vector<std::shared_ptr<session>> sessions = thread->sessions;
+                lock.unlock();
+
+                for (auto iter = sessions.begin(); iter != sessions.end(); ++iter) {
+                    drain(iter->get());
+                }
+
+                lock.lock();
+                thread->in_pass = false;
+                thread->pass_count++;
+                thread->thread_condition.notify_all();
+            }
+        }
+
+
+        void recording_writer::drain(session *recording) {
+            std::lock_guard<std::mutex> write_lock(recording->write_mutex);
+            session::queued_frame item;
+            while (recording->queue.pop(item, 0)) {
+                recording->write(item.frame);
+                int64_t latency_us = utils::getMicroseconds() - item.queued_us;
+                std::lock_guard<std::mutex> lock(recording->stats_mutex);
+                recording->written_count++;
+                recording->latency_total_us += latency_us;
+                if (latency_us > recording->latency_max_us) {
+                    recording->latency_max_us = latency_us;
+                }
+            }
+        }
+
+    }
+}
@@ -11,48 +11,83 @@
 #include <ugcs/vstreamer/sockets.h>
 
 
-int ugcs::vstreamer::sockets::Send_code(sockets::Socket_handle& fd, int response_code, const char *message, std::string content_type) {
-    std::string s_tmp(message);
-    char buffer[s_tmp.length() + 1024];
-    memset(buffer, 0, s_tmp.length() + 1024);
+int ugcs::vstreamer::sockets::Send_code(sockets::Socket_handle& fd, int response_code, const char *message, std::string content_type, bool keep_alive) {
+    if (response_code != 200) {
+        content_type = "text/plain";
+    }
+    return Send_response(fd, response_code, content_type, "", message, strlen(message), keep_alive);
+}
 
-    std::string header_tmp = "Connection: close\r\nServer: vstreamer_server\r\nCache-Control: no-cache\r\nConnection: close\r\nPragma: no-cache\r\n";
-    header_tmp = header_tmp + "Content-Length: " + std::to_string(strlen(message)) + "\r\n";
 
+int ugcs::vstreamer::sockets::Send_response(sockets::Socket_handle& fd, int response_code, const std::string &content_type,
+                                            const std::string &headers, const void *body, size_t body_size, bool keep_alive) {
+    const char *status;
     if (response_code == 200) {
-        sprintf(buffer, "HTTP/1.0 200 OK\r\n"
-                "Content-type: %s\r\n"
-                "%s"
-                "\r\n %s",content_type.c_str(),  header_tmp.c_str(), message);
+        status = "200 OK";
+    }
+    else if (response_code == 304) {
+        status = "304 Not Modified";
     }
     else if (response_code == 500) {
-        sprintf(buffer, "HTTP/1.0 500 Internal Server Error\r\n"
-                "Content-type: text/plain\r\n"
-                "%s"
-                "\r\n"
-                "%s", header_tmp.c_str(), message);
+        status = "500 Internal Server Error";
     }
     else if (response_code == 400) {
-        sprintf(buffer, "HTTP/1.0 400 Bad Request\r\n"
-                "Content-type: text/plain\r\n"
-                "%s"
-                "\r\n"
-                "%s", header_tmp.c_str(), message);
+        status = "400 Bad Request";
+    }
+    else if (response_code == 503) {
+        status = "503 Service Unavailable";
     }
     else {
-        sprintf(buffer, "HTTP/1.0 501 Not Implemented\r\n"
-                "Content-type: text/plain\r\n"
-                "%s"
-                "\r\n"
-                "%s", header_tmp.c_str(), message);
+        status = "501 Not Implemented";
     }
 
-    int res = send(fd, buffer, strlen(buffer), 0);
+    std::string header = std::string("HTTP/1.1 ") + status + "\r\n"
+            "Server: vstreamer_server\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Pragma: no-cache\r\n"
+            "Connection: " + (keep_alive ? "keep-alive" : "close") + "\r\n" + headers;
+    if (response_code == 304) {
+        // response without body
+        body_size = 0;
+    } else {
+        header += "Content-type: " + content_type + "\r\n"
+                  "Content-Length: " + std::to_string(body_size) + "\r\n";
+    }
+    header += "\r\n";
 
-    sockets::Close_socket(fd);
+    // header and body are sent without copying body
+    Send_buffer buffers[2];
+    buffers[0].data = header.data();
+    buffers[0].size = header.size();
+    buffers[1].data = body;
+    buffers[1].size = body_size;
+    size_t remaining = header.size() + body_size;
+    int res = 0;
+    while (remaining > 0) {
+        int sent = Send_vector(fd, buffers, buffers[1].size > 0 ? 2 : 1);
+        if (sent <= 0) {
+            res = -1;
+            break;
+        }
+        res += sent;
+        remaining -= sent;
+        for (int i = 0; i < 2 && sent > 0; i++) {
+            size_t part = (size_t)sent < buffers[i].size ? (size_t)sent : buffers[i].size;
+            buffers[i].data = (const char *)buffers[i].data + part;
+            buffers[i].size -= part;
+            sent -= (int)part;
+        }
+        if (buffers[0].size == 0) {
+            buffers[0] = buffers[1];
+            buffers[1].size = 0;
+        }
+    }
 
-    return res;
+    if (!keep_alive) {
+        sockets::Close_socket(fd);
+    }
 
+    return res;
 }
 
 
@@ -0,0 +1,572 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file stream_engine.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/stream_engine.h"
+#include "ugcs/vstreamer/stream_poller.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <thread>
+#include <mutex>
+#include <future>
+#include <deque>
+
+// size of multipart part header
+#define STREAM_PART_HEADER_SIZE 128
+// size of buffer for discarded client data
+#define STREAM_DRAIN_BUFFER_SIZE 512
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        namespace {
+            const char PART_BOUNDARY[] = "\r\n--boundarydonotcross \r\n";
+
+            slow_client_policy get_policy() {
+                auto props = ugcs::vsm::Properties::Get_instance();
+                std::string name = "vstreamer.stream.slow_client_policy";
+                if (!props->Exists(name)) {
+                    return VSTR_SLOW_CLIENT_LATEST;
+                }
+                std::string value = props->Get(name);
+                if (value == "keyframe") {
+                    return VSTR_SLOW_CLIENT_KEYFRAME;
+                } else if (value == "disconnect") {
+                    return VSTR_SLOW_CLIENT_DISCONNECT;
+                } else if (value != "latest") {
+                    LOG_ERR("Stream engine: unknown value of %s, using latest.", name.c_str());
+                }
+                return VSTR_SLOW_CLIENT_LATEST;
+            }
+
+            const char* get_policy_name(slow_client_policy policy) {
+                switch (policy) {
+                case VSTR_SLOW_CLIENT_KEYFRAME:
+                    return "keyframe";
+                case VSTR_SLOW_CLIENT_DISCONNECT:
+                    return "disconnect";
+                default:
+                    return "latest";
+                }
+            }
+        }
+
+
+        struct stream_engine::stream_connection {
+            sockets::Socket_handle fd;
+            std::shared_ptr<frame_ring> ring;
+            frame_ring::cursor position;
+            const void *owner;
+            close_handler on_close;
+            /** http response header, sent once before frames */
+            std::string preamble;
+            /** part being sent: header, frame and boundary */
+            char part_header[STREAM_PART_HEADER_SIZE];
+            size_t part_header_size;
+            encoded_frame::Ptr frame;
+            size_t part_sent;
+            bool sending;
+            /** frames waiting for sending */
+            std::deque<encoded_frame::Ptr> queue;
+            /** queue was dropped, next queued frame must be key frame */
+            bool wait_keyframe;
+            int64_t sent_count;
+            /** frames dropped from queue (frames skipped in ring are counted in position) */
+            int64_t dropped_count;
+            stream_limits limits;
+            /** capture time before which frames are skipped (fps limit) */
+            int64_t next_frame_ts;
+            /** bytes which may be sent now (bitrate limit), negative after large frame */
+            int64_t byte_budget;
+            /** capture time of the last frame checked against bitrate limit */
+            int64_t budget_ts;
+            /** frames skipped to meet frame rate and bitrate limits */
+            int64_t decimated_count;
+            /** socket buffer is full, waiting for write event */
+            bool write_blocked;
+            bool closed;
+        };
+
+
+        struct stream_engine::io_thread {
+            stream_poller poller;
+            std::thread thread;
+            std::mutex commands_mutex;
+            std::vector<std::function<void()>> commands;
+            /** used by I/O thread only */
+            std::vector<stream_connection *> connections;
+            /** rings which wake up this thread */
+            std::vector<std::weak_ptr<frame_ring>> listened_rings;
+        };
+
+
+        std::shared_ptr<stream_engine> stream_engine::get_instance() {
+            static std::shared_ptr<stream_engine> instance(new stream_engine(
+                utils::getPositiveIntProperty("vstreamer.stream.io_threads", STREAM_ENGINE_DEFAULT_IO_THREADS)));
+            return instance;
+        }
+
+
+        stream_engine::stream_engine(int thread_count) {
+            this->next_thread = 0;
+            this->stop_requested = false;
+            this->policy = get_policy();
+            this->client_queue_size = utils::getPositiveIntProperty("vstreamer.stream.client_queue_size",
+                                                                     STREAM_DEFAULT_CLIENT_QUEUE_SIZE);
+            this->max_client_lag_ms = 1000 * (int64_t)utils::getPositiveIntProperty("vstreamer.stream.max_client_lag_sec",
+                                                                                     STREAM_DEFAULT_MAX_CLIENT_LAG_SEC);
+            for (int i = 0; i < thread_count; i++) {
+                std::shared_ptr<io_thread> thread = std::make_shared<io_thread>();
+                thread->thread = std::thread(&stream_engine::io_loop, this, thread);
+                threads.push_back(thread);
+            }
+            LOG_INFO("Stream engine: started %d I/O threads, slow client policy: %s.", thread_count, get_policy_name(policy));
+        }
+
+
+        stream_engine::~stream_engine() {
+            stop_requested = true;
+            for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+                (*iter)->poller.wake();
+            }
+            for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+                if ((*iter)->thread.joinable()) {
+                    (*iter)->thread.join();
+                }
+            }
+        }
+
+
+        void stream_engine::add_stream(sockets::Socket_handle fd, const std::shared_ptr<frame_ring> &ring,
+                                       const std::string &preamble, const void *owner, const close_handler &on_close,
+                                       const stream_limits &limits) {
+            if (sockets::Set_nonblocking(fd) < 0) {
+                LOG_ERR("Stream engine: could not set socket %d non-blocking.", (int)fd);
+            }
+            stream_connection *connection = new stream_connection();
+            connection->fd = fd;
+            connection->ring = ring;
+            // first frame sent is the one published after connection
+            connection->position = ring->make_cursor();
+            connection->owner = owner;
+            connection->on_close = on_close;
+            connection->preamble = preamble;
+            connection->part_header_size = 0;
+            connection->part_sent = 0;
+            connection->sending = false;
+            connection->wait_keyframe = false;
+            connection->sent_count = 0;
+            connection->dropped_count = 0;
+            connection->limits = limits;
+            connection->next_frame_ts = 0;
+            connection->byte_budget = 0;
+            connection->budget_ts = 0;
+            connection->decimated_count = 0;
+            connection->write_blocked = false;
+            connection->closed = false;
+
+            // producer of ring encodes frames while somebody watches them
+            ring->add_subscriber();
+
+            std::shared_ptr<io_thread> thread = threads[next_thread++ % threads.size()];
+            post(thread, [this, thread, connection]() {
+                attach(thread, connection);
+            });
+        }
+
+
+        void stream_engine::close_streams(const void *owner) {
+            std::vector<std::future<void>> results;
+            for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+                std::shared_ptr<io_thread> thread = *iter;
+                std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+                results.push_back(done->get_future());
+                post(thread, [this, thread, owner, done]() {
+                    for (auto conn = thread->connections.begin(); conn != thread->connections.end(); ++conn) {
+                        if ((*conn)->owner == owner) {
+                            (*conn)->closed = true;
+                        }
+                    }
+                    sweep(thread.get());
+                    done->set_value();
+                });
+            }
+            for (auto iter = results.begin(); iter != results.end(); ++iter) {
+                iter->wait();
+            }
+        }
+
+
+        bool stream_engine::get_client_stats(const std::shared_ptr<frame_ring> &ring, Json::Value &clients) {
+            clients = Json::Value(Json::arrayValue);
+            std::vector<std::future<Json::Value>> results;
+            for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+                std::shared_ptr<io_thread> thread = *iter;
+                std::shared_ptr<std::promise<Json::Value>> done = std::make_shared<std::promise<Json::Value>>();
+                results.push_back(done->get_future());
+                post(thread, [this, thread, ring, done]() {
+                    Json::Value thread_clients(Json::arrayValue);
+                    int64_t now = utils::getMilliseconds();
+                    for (auto conn = thread->connections.begin(); conn != thread->connections.end(); ++conn) {
+                        stream_connection *connection = *conn;
+                        if (connection->ring != ring || connection->closed) {
+                            continue;
+                        }
+                        Json::Value client;
+                        client["id"] = (Json::Int)connection->fd;
+                        client["policy"] = get_policy_name(policy);
+                        client["queued"] = (Json::Int)connection->queue.size();
+                        client["lag_ms"] = (Json::Int)get_lag(connection, now);
+                        client["sent"] = (Json::Int)connection->sent_count;
+                        client["dropped"] = (Json::Int)(connection->dropped_count + connection->position.skipped);
+                        client["max_fps"] = connection->limits.max_fps;
+                        client["max_kbps"] = connection->limits.max_kbps;
+                        client["decimated"] = (Json::Int)connection->decimated_count;
+                        thread_clients.append(client);
+                    }
+                    done->set_value(thread_clients);
+                });
+            }
+            // stats must not hang the caller when I/O threads are stopped or busy
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(STREAM_ENGINE_STATS_TIMEOUT_MS);
+            for (auto iter = results.begin(); iter != results.end(); ++iter) {
+                if (iter->wait_until(deadline) != std::future_status::ready) {
+                    LOG_DEBUG("Stream engine: client stats are unavailable, I/O thread doesn't answer.");
+                    clients = Json::Value();
+                    return false;
+                }
+                Json::Value thread_clients = iter->get();
+                for (Json::UInt i = 0; i < thread_clients.size(); i++) {
+                    clients.append(thread_clients[i]);
+                }
+            }
+            return true;
+        }
+
+
+        void stream_engine::post(const std::shared_ptr<io_thread> &thread, const std::function<void()> &command) {
+            {
+                std::lock_guard<std::mutex> lock(thread->commands_mutex);
+                thread->commands.push_back(command);
+            }
+            thread->poller.wake();
+        }
+
+
+        void stream_engine::attach(const std::shared_ptr<io_thread> &thread, stream_connection *connection) {
+            thread->connections.push_back(connection);
+            if (!thread->poller.add(connection->fd, connection)) {
+                LOG_ERR("Stream engine: could not watch socket %d.", (int)connection->fd);
+                connection->closed = true;
+                return;
+            }
+
+            // wake up this thread on frames of connection device
+            bool listened = false;
+            for (auto iter = thread->listened_rings.begin(); iter != thread->listened_rings.end();) {
+                std::shared_ptr<frame_ring> ring = iter->lock();
+                if (!ring) {
+                    iter = thread->listened_rings.erase(iter);
+                    continue;
+                }
+                if (ring == connection->ring) {
+                    listened = true;
+                }
+                ++iter;
+            }
+            if (!listened) {
+                std::weak_ptr<io_thread> weak_thread = thread;
+                connection->ring->add_listener([weak_thread]() {
+                    std::shared_ptr<io_thread> listener_thread = weak_thread.lock();
+                    if (listener_thread) {
+                        listener_thread->poller.wake();
+                    }
+                });
+                thread->listened_rings.push_back(connection->ring);
+            }
+
+            fill_queue(connection);
+            if (!flush(thread.get(), connection)) {
+                connection->closed = true;
+            }
+        }
+
+
+        void stream_engine::io_loop(std::shared_ptr<io_thread> thread) {
+            std::vector<poll_event> events;
+            std::vector<std::function<void()>> commands;
+
+            while (!stop_requested) {
+                if (thread->poller.wait(events, STREAM_ENGINE_POLL_MS) < 0) {
+                    LOG_ERR("Stream engine: poll failed.");
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    continue;
+                }
+
+                for (auto iter = events.begin(); iter != events.end(); ++iter) {
+                    stream_connection *connection = static_cast<stream_connection *>(iter->context);
+                    if (connection->closed) {
+                        continue;
+                    }
+                    if (iter->readable && !drain(connection)) {
+                        connection->closed = true;
+                        continue;
+                    }
+                    if (iter->closed) {
+                        connection->closed = true;
+                        continue;
+                    }
+                    if (iter->writable) {
+                        connection->write_blocked = false;
+                    }
+                }
+
+                // commands may delete connections, so they run after events are handled
+                {
+                    std::lock_guard<std::mutex> lock(thread->commands_mutex);
+                    commands.swap(thread->commands);
+                }
+                for (auto iter = commands.begin(); iter != commands.end(); ++iter) {
+                    (*iter)();
+                }
+                commands.clear();
+
+                // new frames may be published, queue them and send to every connection which can take data
+                int64_t now = utils::getMilliseconds();
+                for (auto iter = thread->connections.begin(); iter != thread->connections.end(); ++iter) {
+                    stream_connection *connection = *iter;
+                    if (connection->closed) {
+                        continue;
+                    }
+                    fill_queue(connection);
+                    if (policy == VSTR_SLOW_CLIENT_DISCONNECT && get_lag(connection, now) > max_client_lag_ms) {
+                        LOG_INFO("Stream engine: client %d lags more than %d ms, disconnecting.",
+                                 (int)connection->fd, (int)max_client_lag_ms);
+                        connection->closed = true;
+                        continue;
+                    }
+                    if (!connection->write_blocked && !flush(thread.get(), connection)) {
+                        connection->closed = true;
+                    }
+                }
+                sweep(thread.get());
+            }
+
+            for (auto iter = thread->connections.begin(); iter != thread->connections.end(); ++iter) {
+                (*iter)->closed = true;
+            }
+            sweep(thread.get());
+        }
+
+
+        bool stream_engine::flush(io_thread *thread, stream_connection *connection) {
+            for (;;) {
+                if (!connection->sending) {
+                    if (connection->preamble.empty()) {
+                        if (connection->queue.empty()) {
+                            // nothing to send until next frame
+                            thread->poller.set_write_interest(connection->fd, false);
+                            return true;
+                        }
+                        connection->frame = connection->queue.front();
+                        connection->queue.pop_front();
+                        double timestamp = (double)utils::getMilliseconds() / 1000;
+                        // sending the content-length fixes random stream disruption observed
+                        // with firefox
+                        int size = snprintf(connection->part_header, STREAM_PART_HEADER_SIZE,
+                                            "Content-Type: image/jpeg\r\n"
+                                            "Content-Length: %d\r\n"
+                                            "X-Timestamp: %.06lf\r\n"
+                                            "\r\n", connection->frame->get_size(), timestamp);
+                        connection->part_header_size = size > 0 ? (size_t)size : 0;
+                    }
+                    connection->part_sent = 0;
+                    connection->sending = true;
+                }
+
+                // skip already sent bytes of the part
+                sockets::Send_buffer buffers[4];
+                int count = 0;
+                size_t skip = connection->part_sent;
+                size_t left = 0;
+                auto add_buffer = [&](const void *data, size_t size) {
+                    if (skip >= size) {
+                        skip -= size;
+                        return;
+                    }
+                    buffers[count].data = static_cast<const char *>(data) + skip;
+                    buffers[count].size = size - skip;
+                    left += size - skip;
+                    skip = 0;
+                    count++;
+                };
+                if (!connection->preamble.empty()) {
+                    add_buffer(connection->preamble.data(), connection->preamble.size());
+                }
+                if (connection->frame) {
+                    add_buffer(connection->part_header, connection->part_header_size);
+                    add_buffer(connection->frame->get_data(), connection->frame->get_size());
+                    add_buffer(PART_BOUNDARY, sizeof(PART_BOUNDARY) - 1);
+                }
+
+                if (left > 0) {
+                    int res = sockets::Send_vector(connection->fd, buffers, count);
+                    if (res < 0) {
+                        if (sockets::Is_would_block()) {
+                            connection->write_blocked = true;
+                            thread->poller.set_write_interest(connection->fd, true);
+                            return true;
+                        }
+                        return false;
+                    }
+                    connection->part_sent += res;
+                    if ((size_t)res < left) {
+                        continue;
+                    }
+                }
+
+                // part is sent completely
+                if (connection->frame) {
+                    connection->sent_count++;
+                    connection->ring->count_delivery(1, 0);
+                }
+                connection->preamble.clear();
+                connection->frame.reset();
+                connection->sending = false;
+            }
+        }
+
+
+        void stream_engine::fill_queue(stream_connection *connection) {
+            // drops are also counted by ring, they show that viewers can't take the stream
+            int64_t dropped_before = connection->dropped_count + connection->position.skipped;
+            encoded_frame::Ptr frame;
+            while (connection->ring->read_next(connection->position, frame)) {
+                if (connection->wait_keyframe) {
+                    if (!frame->is_key()) {
+                        connection->dropped_count++;
+                        continue;
+                    }
+                    connection->wait_keyframe = false;
+                }
+                if (!pass_limits(connection, frame)) {
+                    connection->decimated_count++;
+                    continue;
+                }
+                if (policy == VSTR_SLOW_CLIENT_LATEST) {
+                    connection->dropped_count += connection->queue.size();
+                    connection->queue.clear();
+                } else if (connection->queue.size() >= client_queue_size) {
+                    if (policy == VSTR_SLOW_CLIENT_KEYFRAME) {
+                        connection->dropped_count += connection->queue.size();
+                        connection->queue.clear();
+                        if (!frame->is_key()) {
+                            connection->dropped_count++;
+                            connection->wait_keyframe = true;
+                            continue;
+                        }
+                    } else {
+                        connection->dropped_count++;
+                        connection->queue.pop_front();
+                    }
+                }
+                connection->queue.push_back(frame);
+            }
+            int64_t dropped = connection->dropped_count + connection->position.skipped - dropped_before;
+            if (dropped > 0) {
+                connection->ring->count_delivery(0, dropped);
+            }
+        }
+
+
+        bool stream_engine::pass_limits(stream_connection *connection, const encoded_frame::Ptr &frame) {
+            const stream_limits &limits = connection->limits;
+            int64_t ts = frame->get_ts();
+            int64_t interval = limits.max_fps > 0 ? 1000 / limits.max_fps : 0;
+            // frame slightly ahead of schedule is taken, capture time jitters
+            if (limits.max_fps > 0 && ts + interval / 4 < connection->next_frame_ts) {
+                return false;
+            }
+            if (limits.max_kbps > 0) {
+                // budget is refilled by capture time and holds at most one second of data
+                int64_t bytes_per_second = (int64_t)limits.max_kbps * 1000 / 8;
+                if (connection->budget_ts == 0) {
+                    connection->byte_budget = bytes_per_second;
+                } else if (ts > connection->budget_ts) {
+                    connection->byte_budget += (ts - connection->budget_ts) * bytes_per_second / 1000;
+                    if (connection->byte_budget > bytes_per_second) {
+                        connection->byte_budget = bytes_per_second;
+                    }
+                }
+                connection->budget_ts = ts;
+                if (connection->byte_budget <= 0) {
+                    return false;
+                }
+                // frame larger than budget is sent, following frames pay for it
+                connection->byte_budget -= frame->get_size();
+            }
+            if (limits.max_fps > 0) {
+                // keep requested cadence, but don't try to catch up after a gap
+                if (connection->next_frame_ts == 0 || ts - connection->next_frame_ts >= interval) {
+                    connection->next_frame_ts = ts + interval;
+                } else {
+                    connection->next_frame_ts += interval;
+                }
+            }
+            return true;
+        }
+
+
+        int64_t stream_engine::get_lag(stream_connection *connection, int64_t now) {
+            encoded_frame::Ptr oldest = connection->frame;
+            if (!oldest && !connection->queue.empty()) {
+                oldest = connection->queue.front();
+            }
+            if (!oldest) {
+                return 0;
+            }
+            return now - oldest->get_ts();
+        }
+
+
+        bool stream_engine::drain(stream_connection *connection) {
+            char buffer[STREAM_DRAIN_BUFFER_SIZE];
+            for (;;) {
+                int res = recv(connection->fd, buffer, sizeof(buffer), 0);
+                if (res > 0) {
+                    continue;
+                }
+                if (res < 0 && sockets::Is_would_block()) {
+                    return true;
+                }
+                return false;
+            }
+        }
+
+
+        void stream_engine::sweep(io_thread *thread) {
+            for (auto iter = thread->connections.begin(); iter != thread->connections.end();) {
+                stream_connection *connection = *iter;
+                if (!connection->closed) {
+                    ++iter;
+                    continue;
+                }
+                thread->poller.remove(connection->fd);
+                sockets::Close_socket(connection->fd);
+                connection->ring->remove_subscriber();
+                if (connection->on_close) {
+                    connection->on_close(connection->position);
+                }
+                delete connection;
+                iter = thread->connections.erase(iter);
+            }
+        }
+
+    }
+}
@@ -0,0 +1,186 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file turbo_jpeg_encoder.cpp
+*/
+
+#ifdef TURBOJPEG_ENCODER
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/common.h"
+#include "ugcs/vstreamer/turbo_jpeg_encoder.h"
+
+#include <cstring>
+
+#ifndef AV_PIX_FMT_YUV420P
+#define AV_PIX_FMT_YUV420P PIX_FMT_YUV420P
+#endif
+
+#ifndef AV_PIX_FMT_YUVJ420P
+#define AV_PIX_FMT_YUVJ420P PIX_FMT_YUVJ420P
+#endif
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        namespace {
+            /** limited (MPEG) range to full (JPEG) range, for luma and chroma samples */
+            struct range_tables {
+                unsigned char luma[256];
+                unsigned char chroma[256];
+
+                range_tables() {
+                    for (int i = 0; i < 256; i++) {
+                        int y = ((i - 16) * 255 + 109) / 219;
+                        int c = 128 + ((i - 128) * 255 + (i >= 128 ? 112 : -112)) / 224;
+                        luma[i] = (unsigned char)(y < 0 ? 0 : (y > 255 ? 255 : y));
+                        chroma[i] = (unsigned char)(c < 0 ? 0 : (c > 255 ? 255 : c));
+                    }
+                }
+            };
+
+            const range_tables& get_range_tables() {
+                static const range_tables tables;
+                return tables;
+            }
+
+            /** @brief True if picture samples are in limited range and have to be expanded for JPEG */
+            bool is_limited_range(AVFrame *picture) {
+                if (picture->format != AV_PIX_FMT_YUV420P) {
+                    return false;
+                }
+#if (LIBAVCODEC_VERSION_INT >= ((55<<16)+(0<<8)+0))
+                return picture->color_range != AVCOL_RANGE_JPEG;
+#else
+                return true;
+#endif
+            }
+        }
+
+
+        turbo_jpeg_encoder::turbo_jpeg_encoder() {
+            this->handle = tjInitCompress();
+            this->buffer = NULL;
+            this->buffer_size = 0;
+            this->width = 0;
+            this->height = 0;
+            if (this->handle == NULL) {
+                LOG_ERR("TurboJPEG: could not create compressor: %s", tjGetErrorStr());
+            }
+        }
+
+
+        turbo_jpeg_encoder::~turbo_jpeg_encoder() {
+            if (buffer != NULL) {
+                tjFree(buffer);
+            }
+            if (handle != NULL) {
+                tjDestroy(handle);
+            }
+        }
+
+
+        bool turbo_jpeg_encoder::is_initialized() {
+            return handle != NULL;
+        }
+
+
+        int turbo_jpeg_encoder::get_quality(int qscale) {
+            // libavcodec quantizes MJPEG with MPEG-1 intra matrix * qscale / 8, which is
+            // about the half of libjpeg tables scaled by qscale / 8, i.e. libjpeg scale factor
+            // is qscale * 100 / 16 percent. libjpeg quality of scale factor S is
+            // (200 - S) / 2 for S <= 100 and 5000 / S otherwise.
+            int scale_percent = qscale * 100 / 16;
+            if (scale_percent < 1) {
+                scale_percent = 1;
+            }
+            int quality = scale_percent <= 100 ? (200 - scale_percent) / 2 : 5000 / scale_percent;
+            return quality < 1 ? 1 : (quality > 100 ? 100 : quality);
+        }
+
+
+        std::shared_ptr<encoded_frame> turbo_jpeg_encoder::encode(AVFrame *picture, int qscale) {
+            std::shared_ptr<encoded_frame> encoded;
+            if (handle == NULL) {
+                return encoded;
+            }
+            if (picture->format != AV_PIX_FMT_YUV420P && picture->format != AV_PIX_FMT_YUVJ420P) {
+                LOG_ERR("TurboJPEG: unsupported pixel format %d.", picture->format);
+                return encoded;
+            }
+            if (buffer == NULL || picture->width != width || picture->height != height) {
+                // the worst case size, so compressor never reallocates it
+                if (buffer != NULL) {
+                    tjFree(buffer);
+                }
+                width = picture->width;
+                height = picture->height;
+                buffer_size = tjBufSize(width, height, TJSAMP_420);
+                buffer = tjAlloc((int)buffer_size);
+                if (buffer == NULL) {
+                    LOG_ERR("TurboJPEG: could not allocate %lu bytes.", buffer_size);
+                    return encoded;
+                }
+            }
+
+            const unsigned char *planes[3] = { picture->data[0], picture->data[1], picture->data[2] };
+            int strides[3] = { picture->linesize[0], picture->linesize[1], picture->linesize[2] };
+            if (is_limited_range(picture)) {
+                // TurboJPEG takes JPEG (full range) YUV, limited range would look washed out
+                expand_range(picture, planes, strides);
+            }
+            unsigned long jpeg_size = buffer_size;
+            if (tjCompressFromYUVPlanes(handle, planes, width, strides, height, TJSAMP_420,
+                                        &buffer, &jpeg_size, get_quality(qscale), TJFLAG_NOREALLOC) != 0) {
+                LOG_ERR("TurboJPEG: compression failed: %s", tjGetErrorStr());
+                return encoded;
+            }
+            encoded = encoded_frame::create((int)jpeg_size, VSTR_CODEC_MJPEG);
+            if (!encoded) {
+                LOG_ERR("TurboJPEG: could not allocate frame of %lu bytes.", jpeg_size);
+                return encoded;
+            }
+            memcpy(encoded->get_writable_data(), buffer, jpeg_size);
+            return encoded;
+        }
+
+
+        void turbo_jpeg_encoder::expand_range(AVFrame *picture, const unsigned char *planes[3], int strides[3]) {
+            const range_tables &tables = get_range_tables();
+            int chroma_width = (width + 1) / 2;
+            int chroma_height = (height + 1) / 2;
+            size_t luma_size = (size_t)width * height;
+            size_t chroma_size = (size_t)chroma_width * chroma_height;
+            full_range.resize(luma_size + 2 * chroma_size);
+
+            unsigned char *luma = &full_range[0];
+            for (int y = 0; y < height; y++) {
+                const unsigned char *src = picture->data[0] + y * picture->linesize[0];
+                unsigned char *dst = luma + (size_t)y * width;
+                for (int x = 0; x < width; x++) {
+                    dst[x] = tables.luma[src[x]];
+                }
+            }
+            planes[0] = luma;
+            strides[0] = width;
+            for (int plane = 1; plane < 3; plane++) {
+                unsigned char *chroma = &full_range[luma_size + (plane - 1) * chroma_size];
+                for (int y = 0; y < chroma_height; y++) {
+                    const unsigned char *src = picture->data[plane] + y * picture->linesize[plane];
+                    unsigned char *dst = chroma + (size_t)y * chroma_width;
+                    for (int x = 0; x < chroma_width; x++) {
+                        dst[x] = tables.chroma[src[x]];
+                    }
+                }
+                planes[plane] = chroma;
+                strides[plane] = chroma_width;
+            }
+        }
+
+    }
+}
+
+#endif
@@ -7,6 +7,7 @@
 */
 
 
+#include <ugcs/vsm/vsm.h>
 #include "ugcs/vstreamer/utils.h"
 
 namespace ugcs {
@@ -59,6 +60,46 @@ namespace utils {
         return stream.str();
     }
 
+    int getPositiveIntProperty(std::string name, int default_value) {
+        auto props = ugcs::vsm::Properties::Get_instance();
+        if (props->Exists(name)) {
+            int value = props->Get_int(name);
+            if (value > 0) {
+                return value;
+            }
+            LOG_ERR("Wrong value of %s, using %d.", name.c_str(), default_value);
+        }
+        return default_value;
+    }
+
+    std::string urlDecode(std::string str) {
+        std::string result;
+        for (std::size_t i = 0; i < str.length(); i++) {
+            if (str[i] == '%' && i + 2 < str.length() && isxdigit(str[i + 1]) && isxdigit(str[i + 2])) {
+                result += (char)std::stoi(str.substr(i + 1, 2), nullptr, 16);
+                i += 2;
+            } else if (str[i] == '+') {
+                result += ' ';
+            } else {
+                result += str[i];
+            }
+        }
+        return result;
+    }
+
+    std::string urlEncode(std::string str) {
+        std::ostringstream stream;
+        for (std::size_t i = 0; i < str.length(); i++) {
+            unsigned char c = (unsigned char)str[i];
+            if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+                stream << c;
+            } else {
+                stream << '%' << std::uppercase << std::hex << (c >> 4) << (c & 0x0f) << std::nouppercase << std::dec;
+            }
+        }
+        return stream.str();
+    }
+
 
 }
 }
@@ -55,6 +55,14 @@ namespace ugcs {
             this->playback_request_ts=-1;
             this->cap_impl = NULL;
             this->type = DEV_CAMERA; // default value
+            this->open_mutex = std::make_shared<std::mutex>();
+            this->publish_mutex = std::make_shared<std::mutex>();
+            this->publish_condition = std::make_shared<std::condition_variable>();
+            this->published_count = 0;
+            int ring_size = utils::getPositiveIntProperty("vstreamer.pipeline.frame_ring_size", FRAME_RING_DEFAULT_SIZE);
+            this->frame_rings[VSTR_CODEC_MJPEG] = std::make_shared<frame_ring>(ring_size);
+            this->frame_rings[VSTR_CODEC_FLV] = std::make_shared<frame_ring>(ring_size);
+            this->quality_control = std::make_shared<jpeg_quality_control>();
 
         }
 
@@ -144,65 +152,260 @@ namespace ugcs {
 
 
         bool video_device::open() {
+            // device is opened by its capture thread and by control requests
+            std::lock_guard<std::mutex> lock(*open_mutex);
+            if (this->video_cap_opened) {
+                return true;
+            }
 
             if (!this->is_cap_defined) {
                 init_video_cap();
             }
             if (this->is_cap_defined) {
-                return cap_impl->open(this);
+                if (!cap_impl->open(this)) {
+                    return false;
+                }
+                // file playback reads frames by time, so it's never staged
+                if (cap_impl->is_staged() && this->type != DEV_FILE && !pipeline) {
+                    std::shared_ptr<capture_pipeline> started_pipeline = std::make_shared<capture_pipeline>(this, cap_impl);
+                    started_pipeline->start();
+                    // stats are read by other threads
+                    std::atomic_store(&pipeline, started_pipeline);
+                }
+                this->video_cap_opened = true;
+                return true;
             }
             return false;
         }
 
 
-        bool video_device::get_frame( unsigned char **encoded_buffer, int& encoded_buffer_size){
+        bool video_device::get_frame(frame_ring::cursor &position, encoded_frame::Ptr &frame){
 
-            int flags = 0;
-            if (this->is_cap_defined) {
-                flags += VSTR_CODEC_MJPEG;
-                if (this->is_outer_streams_active) {
-                    flags += VSTR_CODEC_FLV;
+            if (!this->is_cap_defined) {
+                return false;
+            }
+            if (!pipeline) {
+                int flags = get_requested_codecs();
+                if (flags == 0) {
+                    // the last subscriber has just left, nothing to capture
+                    VS_WAIT(PIPELINE_QUEUE_WAIT_MS);
+                    return true;
+                }
+                std::map<int, std::shared_ptr<encoded_frame>> captured;
+                if (!cap_impl->get_frame(this, captured, flags)) {
+                    return false;
+                }
+                for (auto iter = captured.begin(); iter != captured.end(); ++iter) {
+                    if (iter->second) {
+                        publish_frame(iter->second);
+                    }
+                }
+            } else {
+                // frames are produced by pipeline threads, wait for the next one of any output
+                std::unique_lock<std::mutex> lock(*publish_mutex);
+                int64_t published = published_count;
+                while (published_count == published) {
+                    if (!pipeline->is_running()) {
+                        return false;
+                    }
+                    if (!has_subscribers()) {
+                        return true;
+                    }
+                    publish_condition->wait_for(lock, std::chrono::milliseconds(PIPELINE_QUEUE_WAIT_MS));
+                }
+            }
+            frame_rings.at(VSTR_CODEC_MJPEG)->read_latest(position, frame);
+            return true;
+        }
+
+
+        int video_device::get_requested_codecs() {
+            if (this->type == DEV_FILE) {
+                // playback reads frames by itself
+                return VSTR_CODEC_MJPEG;
+            }
+            int codecs = 0;
+            for (auto iter = frame_rings.begin(); iter != frame_rings.end(); ++iter) {
+                if (iter->second->get_subscriber_count() > 0) {
+                    codecs |= iter->first;
+                }
+            }
+            return codecs;
+        }
+
+
+        bool video_device::has_subscribers() {
+            if (get_requested_codecs() != 0) {
+                return true;
+            }
+            for (auto iter = rendition_rings.begin(); iter != rendition_rings.end(); ++iter) {
+                if (iter->second->get_subscriber_count() > 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+
+        std::shared_ptr<frame_ring> video_device::get_frame_ring(int codec_type) {
+            return frame_rings.at(codec_type);
+        }
+
+
+        void video_device::init_renditions() {
+            auto props = ugcs::vsm::Properties::Get_instance();
+            std::string key = "vstreamer.stream.renditions." + this->name;
+            if (!props->Exists(key)) {
+                key = "vstreamer.stream.renditions";
+            }
+            rendition_rings.clear();
+            if (!props->Exists(key)) {
+                return;
+            }
+            int ring_size = utils::getPositiveIntProperty("vstreamer.pipeline.frame_ring_size", FRAME_RING_DEFAULT_SIZE);
+            std::stringstream value(props->Get(key));
+            std::string item;
+            while (std::getline(value, item, ',')) {
+                item.erase(0, item.find_first_not_of(" \t"));
+                item.erase(item.find_last_not_of(" \t") + 1);
+                int scale = parse_rendition(item);
+                if (scale == 0) {
+                    LOG_ERR("Video device %s: unknown rendition \"%s\" in %s.", this->name.c_str(), item.c_str(), key.c_str());
+                } else if (scale > 1 && rendition_rings.count(scale) == 0) {
+                    rendition_rings[scale] = std::make_shared<frame_ring>(ring_size);
+                    LOG_INFO("Video device %s: MJPEG rendition %s.", this->name.c_str(), get_rendition_name(scale).c_str());
                 }
             }
-            if (flags>0) {
-                bool res = cap_impl->get_frame(this, frames, flags);
+        }
+
+
+        std::vector<int> video_device::get_rendition_scales() {
+            std::vector<int> scales;
+            for (auto iter = rendition_rings.begin(); iter != rendition_rings.end(); ++iter) {
+                scales.push_back(iter->first);
+            }
+            return scales;
+        }
+
+
+        std::shared_ptr<frame_ring> video_device::get_rendition_ring(int scale) {
+            if (scale == 1) {
+                return frame_rings.at(VSTR_CODEC_MJPEG);
+            }
+            auto found = rendition_rings.find(scale);
+            return found != rendition_rings.end() ? found->second : std::shared_ptr<frame_ring>();
+        }
+
+
+        void video_device::init_quality_control() {
+            quality_control->init(this->name);
+        }
+
+
+        std::shared_ptr<jpeg_quality_control> video_device::get_quality_control() {
+            return quality_control;
+        }
+
+
+        void video_device::init_preroll() {
+            int seconds = utils::getPositiveIntProperty("vstreamer.recording.preroll_sec." + this->name,
+                utils::getPositiveIntProperty("vstreamer.recording.preroll_sec", 0));
+            int max_mb = utils::getPositiveIntProperty("vstreamer.recording.preroll_max_mb." + this->name,
+                utils::getPositiveIntProperty("vstreamer.recording.preroll_max_mb", PREROLL_DEFAULT_MAX_MB));
+            if (preroll) {
+                frame_rings.at(VSTR_CODEC_MJPEG)->remove_subscriber();
+                preroll.reset();
+            }
+            if (seconds <= 0) {
+                return;
+            }
+            // pre-roll takes every MJPEG frame, even when nobody watches
+            preroll = std::make_shared<preroll_buffer>((int64_t)seconds * 1000, (int64_t)max_mb * 1024 * 1024);
+            frame_rings.at(VSTR_CODEC_MJPEG)->add_subscriber();
+            LOG_INFO("Video device %s: pre-roll of %d seconds, up to %d MB.", this->name.c_str(), seconds, max_mb);
+        }
+
+
+        bool video_device::has_preroll() {
+            return (bool)preroll;
+        }
+
+
+        void video_device::publish_rendition(int scale, const std::shared_ptr<encoded_frame> &frame) {
+            std::lock_guard<std::mutex> lock(*publish_mutex);
+
+            // only viewers take smaller renditions, recorder and snapshots use full size
+            std::shared_ptr<frame_ring> ring = rendition_rings.at(scale);
+            frame->set_seq(ring->get_published_count());
+            ring->publish(frame);
+            published_count++;
+            publish_condition->notify_all();
+        }
+
+
+        int video_device::parse_rendition(const std::string &name) {
+            if (name == "full" || name == "1/1") {
+                return 1;
+            }
+            if (name.length() > 4 || name.compare(0, 2, "1/") != 0 || !utils::isNumeric(name.substr(2))) {
+                return 0;
+            }
+            int scale = std::atoi(name.substr(2).c_str());
+            return (scale >= 1 && scale <= VSTR_MAX_RENDITION_SCALE) ? scale : 0;
+        }
+
+
+        std::string video_device::get_rendition_name(int scale) {
+            return scale == 1 ? "full" : "1/" + std::to_string(scale);
+        }
+
+
+        void video_device::publish_frame(const std::shared_ptr<encoded_frame> &frame) {
+            std::lock_guard<std::mutex> lock(*publish_mutex);
+
+            std::shared_ptr<frame_ring> ring = frame_rings.at(frame->get_codec());
+            frame->set_seq(ring->get_published_count());
+            ring->publish(frame);
+            published_count++;
+            publish_condition->notify_all();
+
+            if (preroll && frame->get_codec() == VSTR_CODEC_MJPEG) {
+                preroll->add(frame);
+            }
+            if (this->video_cap_opened) {
+                dispatch_frame(frame);
+            }
+        }
+
 
+        void video_device::dispatch_frame(const encoded_frame::Ptr &frame) {
+            if (frame->get_codec() == VSTR_CODEC_FLV) {
                 // add frame to every enabled broadcasting
-                if (res && this->video_cap_opened) {
-                    for (auto iter = outer_streams.begin(); iter != outer_streams.end(); ++iter) {
-                        std::shared_ptr<base_save> os = iter->second;
-           //             if (os->is_process_running() && frames.count(VSTR_CODEC_FLV) > 0 && this->video_cap_opened) {
-                        if (os->is_process_running()) {
-                            os->add_frame(&frames, VSTR_CODEC_FLV);
-                        }
+                for (auto iter = outer_streams.begin(); iter != outer_streams.end(); ++iter) {
+                    std::shared_ptr<base_save> os = iter->second;
+                    if (os->is_process_running()) {
+                        os->add_frame(frame);
                     }
                 }
-
+            } else if (frame->get_codec() == VSTR_CODEC_MJPEG) {
                 // add frame to file recorder if recording is turning on.
-                if (res && this->is_recording_active && this->is_cap_defined) {
+                if (this->is_recording_active && this->is_cap_defined) {
                     if (file_save_impl) {
-                        file_save_impl->add_frame(&frames, VSTR_CODEC_MJPEG);
-                    }
-                }
-
-                // copy frame for streaming to clients
-                if (res && this->is_cap_defined) {
-                    if (frames.count(VSTR_CODEC_MJPEG) > 0 ) {
-                        // to buffer
-                        video_frame *vf = frames.at(VSTR_CODEC_MJPEG);
-                        encoded_buffer_size = vf->encoded_buffer_size;
-                        *encoded_buffer = (unsigned char*)realloc(*encoded_buffer, (size_t) encoded_buffer_size);
-                        memcpy(*encoded_buffer, vf->encoded_buffer, (size_t) encoded_buffer_size);
-                        return true;
+                        file_save_impl->add_frame(frame);
                     }
                 }
             }
-            return false;
         }
 
 
         void video_device::close(){
+            std::lock_guard<std::mutex> lock(*open_mutex);
             if (this->is_cap_defined) {
+                if (pipeline) {
+                    // stages use cap, stop them first
+                    pipeline->stop();
+                    std::atomic_store(&pipeline, std::shared_ptr<capture_pipeline>());
+                }
                 if (cap_impl) {
                     LOG_DEBUG("Video device %s: capturing implementation is going to be closed", this->name.c_str());
                     this->video_cap_opened = false;
@@ -214,6 +417,44 @@ namespace ugcs {
         }
 
 
+        void video_device::get_stats(Json::Value &stats) {
+            if (this->is_cap_defined && cap_impl) {
+                cap_impl->get_stats(stats);
+            }
+            std::shared_ptr<capture_pipeline> current_pipeline = std::atomic_load(&pipeline);
+            if (current_pipeline) {
+                Json::Value pipeline_stats;
+                current_pipeline->get_stats(pipeline_stats);
+                stats["pipeline"] = pipeline_stats;
+            }
+            Json::Value ring_stats;
+            ring_stats["capacity"] = frame_rings.at(VSTR_CODEC_MJPEG)->get_capacity();
+            ring_stats["mjpeg_published"] = (Json::Int)frame_rings.at(VSTR_CODEC_MJPEG)->get_published_count();
+            ring_stats["flv_published"] = (Json::Int)frame_rings.at(VSTR_CODEC_FLV)->get_published_count();
+            stats["frame_ring"] = ring_stats;
+            Json::Value quality_stats;
+            quality_control->get_stats(quality_stats);
+            stats["mjpeg_quality"] = quality_stats;
+            if (preroll) {
+                Json::Value preroll_stats;
+                preroll->get_stats(preroll_stats);
+                stats["preroll"] = preroll_stats;
+            }
+            std::shared_ptr<base_save> recorder = file_save_impl;
+            if (recorder && this->is_recording_active) {
+                Json::Value recording_stats;
+                recorder->get_stats(recording_stats);
+                stats["recording"] = recording_stats;
+            }
+            for (auto iter = rendition_rings.begin(); iter != rendition_rings.end(); ++iter) {
+                Json::Value rendition_stats;
+                rendition_stats["published"] = (Json::Int)iter->second->get_published_count();
+                rendition_stats["subscribers"] = iter->second->get_subscriber_count();
+                stats["renditions"][get_rendition_name(iter->first)] = rendition_stats;
+            }
+        }
+
+
         bool video_device::init_recording(std::string folder, std::string filename, std::string &result_msg, int64_t request_ts) {
             result_msg = "";
             record_request_ts = request_ts;
@@ -225,8 +466,26 @@ namespace ugcs {
                     return false;
                 }
             }
-            file_save_impl = std::make_shared<ffmpeg_save_mjpeg>();
-            this->is_recording_active = file_save_impl->init(folder, filename, this->width, this->height, VSTR_SAVE_FILE, record_request_ts);
+            bool was_active = this->is_recording_active;
+            std::shared_ptr<base_save> recorder = std::make_shared<ffmpeg_save_mjpeg>();
+            bool res = recorder->init(folder, filename, this->width, this->height, VSTR_SAVE_FILE, record_request_ts);
+            {
+                // frames are published under the same lock, so every frame is either
+                // in pre-roll or dispatched to recorder
+                std::lock_guard<std::mutex> lock(*publish_mutex);
+                if (res && preroll) {
+                    // recording starts with the last seconds before request
+                    recorder->set_preroll(preroll->get_frames(utils::getMilliseconds()));
+                }
+                file_save_impl = recorder;
+                this->is_recording_active = res;
+            }
+            // recorder takes MJPEG frames
+            if (this->is_recording_active && !was_active) {
+                frame_rings.at(VSTR_CODEC_MJPEG)->add_subscriber();
+            } else if (!this->is_recording_active && was_active) {
+                frame_rings.at(VSTR_CODEC_MJPEG)->remove_subscriber();
+            }
 
             if (!this->is_recording_active) {
                 result_msg=std::to_string(VSTR_REC_ERR_RECORD_SESSION_ERROR);
@@ -306,6 +565,12 @@ namespace ugcs {
                         break;
                 }
             }
+            // broadcasters take FLV frames
+            if (is_anyone_running && !this->is_outer_streams_active) {
+                frame_rings.at(VSTR_CODEC_FLV)->add_subscriber();
+            } else if (!is_anyone_running && this->is_outer_streams_active) {
+                frame_rings.at(VSTR_CODEC_FLV)->remove_subscriber();
+            }
             this->is_outer_streams_active = is_anyone_running;
 
             return res;
@@ -316,6 +581,7 @@ namespace ugcs {
             if (this->is_recording_active) {
                 // stop record session
                 this->is_recording_active = false;
+                frame_rings.at(VSTR_CODEC_MJPEG)->remove_subscriber();
                 // clear file name
                 this->recording_video_id = "";
                 // clear duration
@@ -0,0 +1,162 @@
+// Copyright (c) 2015, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+* @file worker_pool.cpp
+*/
+
+#include <ugcs/vsm/vsm.h>
+#include "ugcs/vstreamer/worker_pool.h"
+#include "ugcs/vstreamer/utils.h"
+
+#include <exception>
+
+namespace ugcs {
+
+    namespace vstreamer {
+
+        namespace {
+            const char* get_class_name(int type) {
+                return type == VSTR_TASK_HEAVY ? "heavy" : "light";
+            }
+        }
+
+
+        worker_pool::worker_pool(const std::string &name, int worker_count, int heavy_limit, int queue_size) {
+            this->name = name;
+            // one worker for heavy tasks and at least one more kept for light tasks
+            if (worker_count < 2) {
+                LOG_ERR("%s: %d workers requested, at least 2 are needed, using 2.", name.c_str(), worker_count);
+                worker_count = 2;
+            }
+            if (heavy_limit >= worker_count) {
+                heavy_limit = worker_count - 1;
+            }
+            this->heavy_limit = heavy_limit > 0 ? heavy_limit : 1;
+            this->queue_size = queue_size > 0 ? (size_t)queue_size : 1;
+            this->stopping = false;
+            for (int i = 0; i < worker_count; i++) {
+                workers.push_back(std::thread(&worker_pool::work, this));
+            }
+            LOG("%s: %d workers, at most %d heavy requests at once.", name.c_str(), worker_count, this->heavy_limit);
+        }
+
+
+        worker_pool::~worker_pool() {
+            stop();
+        }
+
+
+        bool worker_pool::submit(task_class type, const std::function<void()> &task) {
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                if (stopping || queues[type].size() >= queue_size) {
+                    counters[type].rejected++;
+                    return false;
+                }
+                queued_task queued;
+                queued.run = task;
+                queued.queued_ts = utils::getMicroseconds();
+                queues[type].push_back(queued);
+            }
+            pool_condition.notify_one();
+            return true;
+        }
+
+
+        void worker_pool::stop() {
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                if (stopping) {
+                    return;
+                }
+                stopping = true;
+                queues[VSTR_TASK_LIGHT].clear();
+                queues[VSTR_TASK_HEAVY].clear();
+            }
+            pool_condition.notify_all();
+            for (auto iter = workers.begin(); iter != workers.end(); ++iter) {
+                if (iter->joinable() && iter->get_id() != std::this_thread::get_id()) {
+                    iter->join();
+                }
+            }
+        }
+
+
+        int worker_pool::next_class() {
+            if (!queues[VSTR_TASK_LIGHT].empty()) {
+                return VSTR_TASK_LIGHT;
+            }
+            if (!queues[VSTR_TASK_HEAVY].empty() && counters[VSTR_TASK_HEAVY].running < heavy_limit) {
+                return VSTR_TASK_HEAVY;
+            }
+            return -1;
+        }
+
+
+        void worker_pool::work() {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            while (!stopping) {
+                int type = next_class();
+                if (type < 0) {
+                    pool_condition.wait(lock);
+                    continue;
+                }
+                queued_task task = queues[type].front();
+                queues[type].pop_front();
+                counters[type].running++;
+                lock.unlock();
+
+                int64_t start_ts = utils::getMicroseconds();
+                bool failed = false;
+                try {
+                    task.run();
+                } catch (const std::exception &e) {
+                    LOG_ERR("%s: %s request failed: %s", name.c_str(), get_class_name(type), e.what());
+                    failed = true;
+                }
+                int64_t finish_ts = utils::getMicroseconds();
+
+                lock.lock();
+                class_counters &class_stats = counters[type];
+                class_stats.running--;
+                class_stats.completed++;
+                if (failed) {
+                    class_stats.failed++;
+                }
+                class_stats.wait_total_us += start_ts - task.queued_ts;
+                class_stats.service_total_us += finish_ts - start_ts;
+                if (finish_ts - start_ts > class_stats.service_max_us) {
+                    class_stats.service_max_us = finish_ts - start_ts;
+                }
+                if (type == VSTR_TASK_HEAVY && !queues[VSTR_TASK_HEAVY].empty()) {
+                    // waiting heavy task may run now
+                    pool_condition.notify_one();
+                }
+            }
+        }
+
+
+        void worker_pool::get_stats(Json::Value &stats) {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            stats["workers"] = (Json::Int)workers.size();
+            stats["heavy_limit"] = heavy_limit;
+            stats["queue_size"] = (Json::UInt)queue_size;
+            for (int type = VSTR_TASK_LIGHT; type <= VSTR_TASK_HEAVY; type++) {
+                const class_counters &class_stats = counters[type];
+                Json::Value &class_json = stats[get_class_name(type)];
+                class_json["queued"] = (Json::UInt)queues[type].size();
+                class_json["running"] = class_stats.running;
+                class_json["completed"] = (Json::UInt)class_stats.completed;
+                class_json["rejected"] = (Json::UInt)class_stats.rejected;
+                class_json["failed"] = (Json::UInt)class_stats.failed;
+                int64_t completed = class_stats.completed > 0 ? class_stats.completed : 1;
+                class_json["avg_wait_ms"] = (double)class_stats.wait_total_us / completed / 1000.0;
+                class_json["avg_service_ms"] = (double)class_stats.service_total_us / completed / 1000.0;
+                class_json["max_service_ms"] = (double)class_stats.service_max_us / 1000.0;
+            }
+        }
+
+    }
+}